@@ -0,0 +1,59 @@
+// Buffer_Pool.h
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Fixed pool of `Count` buffers of `Size` bytes, handed out by index.
+//
+// Lets a producer read straight into a buffer and pass it on to a later
+// stage, which hands it back when done, with up to `Count` buffers in
+// flight and no allocation:
+//
+//   uint8_t slot = pool.acquire();
+//   if (slot != pool.kNone) {
+//     fill(pool.data(slot));
+//     ...
+//     pool.release(slot);
+//   }
+//
+// Not thread safe, meant for use from one task.
+template <uint8_t Count, size_t Size>
+class BufferPool {
+    static_assert(Count != 0 && Count <= 32, "BufferPool holds 1 to 32 buffers");
+
+  public:
+    static const uint8_t kNone = 0xFF;
+    static const size_t kSize = Size;
+
+    // A free buffer, or kNone if all are in use.
+    uint8_t acquire() {
+      if (used == kAll) {
+        return kNone;
+      }
+      uint8_t slot = 0;
+      while (used & (1u << slot)) {
+        slot++;
+      }
+      used |= 1u << slot;
+      return slot;
+    }
+
+    void release(uint8_t slot) {
+      if (slot < Count) {
+        used &= ~(1u << slot);
+      }
+    }
+
+    uint8_t *data(uint8_t slot) { return buffers[slot]; };
+    uint8_t available() const { return Count - __builtin_popcount(used); };
+
+  private:
+    static const uint32_t kAll = Count == 32 ? 0xFFFFFFFFu : (1u << Count) - 1;
+
+    uint8_t buffers[Count][Size];
+    uint32_t used = 0;
+};
+
+#endif  // BUFFER_POOL_H
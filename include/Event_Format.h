@@ -0,0 +1,87 @@
+// Event_Format.h
+#ifndef EVENT_FORMAT_H
+#define EVENT_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// On-card format of the event log written by EventLog (see Event_Log.h).
+// It needs nothing from Arduino, so tools/decode_events.cpp can share it on a
+// PC.
+//
+// A log file is a plain sequence of 16 byte records, little endian:
+//
+//   0  timestamp, ms since boot (u32)   4  event id (u16)   6  sequence (u16)
+//   8  argument 0 (u32)                 12 argument 1 (u32)
+//
+// Every file starts with an EVENT_LOG_START record, so a file can be read on
+// its own. The sequence counts every event logged since boot, so a gap in it
+// means events were lost before they reached the card; EVENT_DROPPED tells
+// how many when the ring buffer overflowed.
+namespace eventlog {
+
+const size_t kRecordSize = 16;
+const uint8_t kFormatVersion = 1;
+// Argument 0 of EVENT_LOG_START, "EVLG" when read as bytes.
+const uint32_t kLogMagic = 0x474C5645;
+
+struct Record {
+    uint32_t timestamp;
+    uint16_t id;
+    uint16_t sequence;
+    uint32_t args[2];
+};
+
+// Event ids are stored on the card, only ever add to the end of this list.
+enum EventId : uint16_t {
+    EVENT_LOG_START = 0,       // Format version, record size.
+    EVENT_BOOT,                // Free heap, largest free block.
+    EVENT_DROPPED,             // Events lost to a full ring buffer.
+    EVENT_SD_INIT_FAILED,
+    EVENT_STORE_MOUNT_FAILED,
+    EVENT_CAPTURE,             // Timings, protocol.
+    EVENT_CAPTURE_OVERFLOW,    // Timings kept, buffer size.
+    EVENT_STORAGE_FAILED,      // Storage operation, bytes.
+    EVENT_STORAGE_SLOW,        // Storage operation, ms on the card.
+    EVENT_SEND,                // Timings or bytes, protocol (-1 for raw).
+    EVENT_SEND_FAILED,         // 1 if the code was found.
+    EVENT_SCENE_FAILED,
+    EVENT_CLIENT_CONNECTED,    // Client IP, port.
+    EVENT_CLIENT_LOST,         // Client IP, port.
+    EVENT_COUNT
+};
+
+inline const char *eventName(uint16_t id) {
+  static const char *const names[EVENT_COUNT] = {
+    "LOG_START", "BOOT", "DROPPED", "SD_INIT_FAILED", "STORE_MOUNT_FAILED",
+    "CAPTURE", "CAPTURE_OVERFLOW", "STORAGE_FAILED", "STORAGE_SLOW", "SEND",
+    "SEND_FAILED", "SCENE_FAILED", "CLIENT_CONNECTED", "CLIENT_LOST"
+  };
+  return id < EVENT_COUNT ? names[id] : "UNKNOWN";
+}
+
+inline void encodeRecord(const Record &record, uint8_t *out) {
+  uint32_t words[4] = {
+    record.timestamp, record.id | ((uint32_t)record.sequence << 16),
+    record.args[0], record.args[1]
+  };
+  for (uint8_t i = 0; i < 16; i++) {
+    out[i] = words[i / 4] >> (8 * (i % 4));
+  }
+}
+
+inline void decodeRecord(const uint8_t *in, Record &record) {
+  uint32_t words[4] = {0, 0, 0, 0};
+  for (uint8_t i = 0; i < 16; i++) {
+    words[i / 4] |= (uint32_t)in[i] << (8 * (i % 4));
+  }
+  record.timestamp = words[0];
+  record.id = words[1];
+  record.sequence = words[1] >> 16;
+  record.args[0] = words[2];
+  record.args[1] = words[3];
+}
+
+}  // namespace eventlog
+
+#endif  // EVENT_FORMAT_H
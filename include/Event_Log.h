@@ -0,0 +1,70 @@
+// Event_Log.h
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <SD_Controller.h>
+#include <Event_Format.h>
+
+// Binary event log, kept on the SD card so a unit can be diagnosed after the
+// fact, without a serial cable attached.
+//
+// log() stores a 16 byte record (see Event_Format.h) in a RAM ring and
+// returns; it does no formatting and never touches the card, so it can be
+// called from any task in the hot path. One task calls flush() now and then,
+// with the card to itself, to append the waiting records in batches of up to
+// 4 KB. When the ring is full new events are dropped and counted, and the
+// count is logged as EVENT_DROPPED once there is room again.
+//
+// The log lives in kLogDirectory: 0.log is written to and, once it would grow
+// past kMaxFileSize, is renamed 1.log and so on, the oldest of kFileCount
+// files being deleted. Turn the files back into text on a PC with
+// tools/decode_events.cpp.
+class EventLog {
+  public:
+    static const uint16_t kRingRecords = 512;   // Power of two, 8 KB.
+    static const uint16_t kBatchRecords = 4096 / eventlog::kRecordSize;
+    static const uint32_t kMaxFileSize = 128 * 1024;
+    static const uint8_t kFileCount = 4;
+    // Records are written once a batch is full, or this long after the
+    // oldest of them was logged.
+    static const uint32_t kFlushIntervalMs = 10000;
+    static constexpr const char *kLogDirectory = "/events";
+
+    void log(uint16_t id, uint32_t arg0 = 0, uint32_t arg1 = 0);
+    // True if flush() has a full batch, or records that waited long enough.
+    bool flushDue();
+    // Appends every waiting record to the card. Records that could not be
+    // written stay in the ring for the next call.
+    bool flush(SDController &sd);
+    // Looks the current file up again before the next write, e.g. after the
+    // card was erased. Called by the task that flushes.
+    void forgetFile() { fileBytes = -1; };
+    // Events lost to a full ring since boot.
+    uint32_t dropped() const { return droppedTotal; };
+
+  private:
+    static void filePath(char *path, size_t size, uint8_t number);
+
+    void append(uint32_t timestamp, uint16_t id, uint32_t arg0, uint32_t arg1);
+    bool write(SDController &sd, const uint8_t *data, size_t length);
+    bool rotate(SDController &sd);
+
+    // Guards the ring and counters; held for a few dozen cycles at most.
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    uint8_t ring[kRingRecords * eventlog::kRecordSize];
+    // Free running, masked on access. Records from `head` up to `tail` wait
+    // for the card; only flush() moves `head`.
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    uint16_t sequence = 0;
+    uint32_t oldestAt = 0;          // millis() the oldest waiting record was logged.
+    uint32_t droppedPending = 0;    // Not yet reported with EVENT_DROPPED.
+    uint32_t droppedTotal = 0;
+    int32_t fileBytes = -1;         // Size of 0.log, -1 until looked up.
+};
+
+extern EventLog events;
+
+#endif  // EVENT_LOG_H
@@ -0,0 +1,44 @@
+// IR_BenchCorpus.h
+#ifndef IR_BENCH_CORPUS_H
+#define IR_BENCH_CORPUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <IR_Record.h>
+
+// Captures the IR benchmarks run against, on the device (IR_Benchmark.h) and
+// on the host (test/test_bench). They are built the way IRController stores a
+// capture: alternating mark and space durations in micro-seconds, ending with
+// a mark. Every duration gets a few percent of jitter so the captures look
+// like real receiver output.
+//
+// Needs nothing from Arduino.
+namespace irbench {
+
+// kCaptureBufferSize, the longest capture the firmware keeps.
+const uint16_t kMaxTimings = 1024;
+const uint16_t kCarrierFrequency = 38000;
+
+struct Capture {
+  const char *name;
+  uint16_t timings[kMaxTimings];
+  uint16_t length;
+};
+
+void makeNec(Capture &capture);
+// A held button: three identical frames, which trimRepeats() folds back up.
+void makeSamsung(Capture &capture);
+void makeKelvinator(Capture &capture);
+void makeDaikin(Capture &capture);
+// A pulse distance capture of exactly `length` timings, for benchmarks that
+// scale with the capture length.
+void makeLength(Capture &capture, const char *name, uint16_t length);
+// A copy of `base` with every timing moved by up to `percent` percent, as
+// another remote of the same kind would send it.
+void makeVariant(Capture &variant, const Capture &base, uint8_t percent, uint32_t seed);
+
+irrecord::IRCode rawCode(const Capture &capture);
+
+}  // namespace irbench
+
+#endif  // IR_BENCH_CORPUS_H
@@ -0,0 +1,31 @@
+// IR_Benchmark.h
+#ifndef IR_BENCHMARK_H
+#define IR_BENCHMARK_H
+
+#ifdef IR_BENCHMARK
+
+#include <Arduino.h>
+
+// Times the IR storage hot path (text export and parsing, record encoding
+// and decoding, compression, UDP framing, repeat trimming, library matching)
+// on the device, against captures of NEC, Samsung, Kelvinator and Daikin
+// remotes.
+//
+// Build the `lolin32_bench` environment, which runs this in place of the
+// firmware, and open the serial monitor. Results are printed as CSV, one line
+// per benchmark and capture:
+//
+//   # ir-bench,<format version>,<IRremoteESP8266 version>,<CPU MHz>
+//   bench,capture,entries,bytes,iterations,ns_per_op,heap_bytes,peak_stack
+//   text_write,nec,67,263,2000,41250,0,1412
+//   ...
+//
+// heap_bytes is the heap a benchmark still held when it finished; the hot
+// path is meant to keep it at 0. peak_stack is the deepest stack use of the
+// task the benchmark ran in, in bytes. The captures are the ones in
+// IR_BenchCorpus.h; test/test_bench runs the same benchmarks on a PC.
+void runIRBenchmarks(Print &out);
+
+#endif  // IR_BENCHMARK
+
+#endif  // IR_BENCHMARK_H
@@ -0,0 +1,66 @@
+// IR_Cache.h
+#ifndef IR_CACHE_H
+#define IR_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <IR_Record.h>
+
+// Bounded LRU cache of decoded IR codes, keyed by code name.
+//
+// Raw timings and protocol bytes live in a caller supplied arena, so the
+// cache never touches the heap. Entries are packed back to back and the arena
+// is compacted when an entry is evicted or invalidated, which keeps the whole
+// budget usable no matter in which order codes come and go.
+//
+// The pointers lookup() places in the code stay valid until the next call to
+// insert(), invalidate() or clear().
+class IRCodeCache {
+  public:
+    static const uint8_t kMaxEntries = 16;
+    static const uint8_t kMaxNameLength = 31;
+
+    IRCodeCache(uint16_t *arena, size_t budgetBytes);
+
+    bool lookup(const char *name, irrecord::IRCode &code);
+    bool insert(const char *name, const irrecord::IRCode &code);
+    void invalidate(const char *name);
+    void clear();
+
+    uint32_t hits() const { return hitCount; }
+    uint32_t misses() const { return missCount; }
+    uint32_t evictions() const { return evictionCount; }
+    size_t bytesUsed() const { return used * sizeof(uint16_t); }
+    size_t budget() const { return capacity * sizeof(uint16_t); }
+    uint8_t size() const { return count; }
+
+  private:
+    struct Entry {
+      char name[kMaxNameLength + 1];
+      uint32_t hash;
+      size_t offset;      // In words from the start of the arena.
+      size_t words;       // Arena words taken by the timings or bytes.
+      irrecord::IRCode code;
+      int8_t prev;        // Towards the most recently used entry.
+      int8_t next;        // Towards the least recently used entry.
+    };
+
+    int8_t find(const char *name, uint32_t hash) const;
+    void unlink(int8_t index);
+    void pushFront(int8_t index);
+    void remove(int8_t index);
+
+    uint16_t *arena;
+    size_t capacity;      // In words.
+    size_t used = 0;      // In words.
+    Entry entries[kMaxEntries];
+    bool inUse[kMaxEntries] = {};
+    int8_t head = -1;     // Most recently used.
+    int8_t tail = -1;     // Least recently used.
+    uint8_t count = 0;
+    uint32_t hitCount = 0;
+    uint32_t missCount = 0;
+    uint32_t evictionCount = 0;
+};
+
+#endif  // IR_CACHE_H
@@ -90,6 +90,14 @@ const uint8_t kTimeout = 15;
 // NOTE: Set this value very high to effectively turn off UNKNOWN detection.
 const uint16_t kMinUnknownSize = 12;
 
+// Holding a button down (see kTimeout above) captures the same frame 2-3+
+// times. When a raw capture is nothing but identical frames separated by
+// equal gaps of at least kMinRepeatGap micro-seconds, only one frame is stored
+// together with the repeat count and gap, and the repeats are rebuilt when
+// the code is sent. Frames are compared using kTolerancePercentage.
+const bool kTrimRepeats = true;
+const uint16_t kMinRepeatGap = 5000;  // in us. Longer than any data space.
+
 // How much percentage lee way do we give to incoming signals in order to match
 // it?
 // e.g. +/- 25% (default) to an expected value of 500 would mean matching a
@@ -100,10 +108,81 @@ const uint16_t kMinUnknownSize = 12;
 //       your remote's message some of the time, but not all of the time.
 const uint8_t kTolerancePercentage = kTolerance;  // kTolerance is normally 25%
 
-// Legacy (No longer supported!)
-//
-// Change to `true` if you miss/need the old "Raw Timing[]" display.
-#define LEGACY_TIMING_INFO false
+// Captures are taken off the receiver by a dedicated FreeRTOS task so they are
+// not lost while the main loop is busy with Wi-Fi or the status LED.
+// kCaptureQueueLength finished captures (~2 KB each) can wait for read(); it
+// must be a power of two. Further captures are dropped and counted.
+const size_t kCaptureQueueLength = 4;
+const uint8_t kCaptureTaskCore = 0;
+const uint8_t kCaptureTaskPriority = 2;
+const uint32_t kCaptureTaskStackSize = 4096;
+// How often the capture task checks the receiver for a finished message.
+// Must stay well below kTimeout so back to back messages are not merged.
+const uint8_t kCapturePollMs = 5;
+
+// Codes queued with IRController::sendAsync() are transmitted by their own
+// FreeRTOS task, so long A/C frames never stall the network loop. Each of the
+// two priority levels holds up to kSendQueueLength pending requests.
+const uint8_t kSendQueueLength = 8;
+const uint8_t kTransmitTaskCore = 0;
+const uint8_t kTransmitTaskPriority = 3;
+const uint32_t kTransmitTaskStackSize = 4096;
+
+// Saving captures, deleting codes and loading scenes is left to a storage
+// task, so a slow SD card (writes can stall for 100+ ms) never holds up the
+// network loop. Up to kStorageQueueLength requests wait in line, each with
+// room for the largest code record (~3.1 KB with kCaptureBufferSize 1024), so
+// the queue takes ~12.5 KB of static RAM. When the queue is full, captures
+// are saved synchronously instead.
+const uint8_t kStorageQueueLength = 4;
+const uint8_t kStorageTaskCore = 0;
+const uint8_t kStorageTaskPriority = 1;
+const uint32_t kStorageTaskStackSize = 4096;
+// The storage task also writes the event log (see Event_Log.h) to the card.
+// Between requests it checks every kEventFlushPollMs whether a batch is due.
+const uint16_t kEventFlushPollMs = 500;
+// Storage requests that keep the card busy for longer are logged.
+const uint32_t kSlowStorageMs = 250;
+// Erasing the card removes kEraseBatch files or directories at a time and
+// lets sends and captures at the card in between.
+const uint16_t kEraseBatch = 16;
+
+// RAM budget, in bytes, for the cache of recently sent codes. Codes served
+// from the cache skip the SD card entirely. A typical TV code takes ~140 bytes
+// and a long A/C code ~600 bytes. Set to 0 to disable the cache.
+const size_t kCodeCacheSize = 8 * 1024;
+
+// Captured codes are packed into a single log file on the SD card (see
+// SD_LogStore.h) instead of one file each. Its index takes 14 bytes of heap
+// per slot and holds up to three quarters of kCodeStoreSlots codes; it must be
+// a power of two. Codes saved by older firmware as separate files are still
+// found.
+const uint16_t kCodeStoreSlots = 1024;
+// Codes in the store are LZ compressed (see SD_Compress.h) when that makes
+// them smaller. Raw records are already delta coded, so this mostly pays off
+// for long captures without much jitter; unpacking costs well under a
+// micro-second per byte, far less than reading the bytes it saves. Firmware
+// older than this option cannot read a store with compressed codes in it.
+// A code that does not fit in the store gets a file of its own, which is
+// never compressed.
+const bool kCompressCodes = true;
+
+// Store captured codes in the human readable `raw_array:[...]` text format
+// instead of the compact binary record (see IR_Record.h). Text files are
+// several times larger and slower to load, but can be read and edited on a
+// PC, so they are kept as separate files rather than in the code store. Both
+// formats can be sent regardless of this setting.
+const bool kStoreCodesAsText = false;
+
+// Every stored code is fingerprinted in RAM at boot so a new capture can be
+// compared against the whole library without reading the SD card. Each code
+// takes ~110 bytes of heap; codes beyond kMatchIndexCapacity are not compared.
+// read() keeps the best kMatchResults stored codes that score at least
+// kMinMatchScore (0-100, 100 meaning a duplicate) against the capture.
+const uint16_t kMatchIndexCapacity = 512;
+const uint8_t kMatchResults = 3;
+const uint8_t kMinMatchScore = 60;
+
 // ==================== end of TUNEABLE PARAMETERS ====================
 
 #endif // IR_Config_H_
\ No newline at end of file
@@ -3,27 +3,225 @@
 #define IR_CONTROLLER_H
 
 #include <IR_Config.h>
+#include <IR_Record.h>
+#include <IR_Cache.h>
+#include <IR_Matcher.h>
+#include <SPSC_Queue.h>
+#include <SD_LogStore.h>
+#include <Event_Log.h>
+
+// A finished capture, copied off the receiver by the capture task.
+// `result` keeps the decoded protocol and value; its rawbuf is not valid,
+// the timings are in `timings` in sendRaw() format instead.
+struct IRCapture {
+    decode_results result;
+    uint16_t timings[kCaptureBufferSize];
+    uint16_t length;
+    uint32_t timestamp;
+};
+
+// Queued transmissions are served interactive first, then in FIFO order.
+enum SendPriority {
+    SEND_NORMAL = 0,       // Bulk replays, scenes.
+    SEND_INTERACTIVE = 1   // A user pressed a button, e.g. "power off".
+};
+
+// Outcome of a sendAsync() request, reported through nextCompletion().
+struct SendResult {
+    uint32_t ticket;
+    bool sent;
+};
+
+// Outcome of a request handed to the storage task by read(), remove(),
+// loadFileAsync() or eraseCard(). The storage task fills in `status` and `length` before it
+// sets `done`, so poll `done` first.
+enum StorageStatus : uint8_t {
+    STORAGE_PENDING,
+    STORAGE_OK,
+    STORAGE_FAILED,
+    STORAGE_SUPERSEDED   // A newer request for the same code ran instead.
+};
+
+struct StorageResult {
+    std::atomic<bool> done{false};
+    StorageStatus status = STORAGE_PENDING;
+    size_t length = 0;   // Bytes read by loadFileAsync(), entries eraseCard() removed.
+};
+
+// Where storage requests spend their time, to tell when the SD card is the
+// bottleneck. Times are counted in log2 buckets: bucket 0 holds requests
+// that took under 1 ms, bucket i those that took 2^(i-1) to 2^i ms and the
+// last bucket everything slower.
+struct StorageStats {
+    static const uint8_t kBuckets = 12;
+    uint32_t depth[kStorageQueueLength + 1];  // Requests waiting when one more came in.
+    uint32_t latency[kBuckets];               // From queued to done.
+    uint32_t service[kBuckets];               // Time spent on the card.
+    uint32_t coalesced;                       // Saves replaced before they ran.
+    uint32_t rejected;                        // Queue full.
+};
 
 class IRController {
     public:
-        IRController() {};
+        IRController() : store(sd), cache(cacheArena, sizeof(cacheArena)) {};
         void begin();
-        void read(const char* fileName);
-        void send(const char* fileName);
+        // Saves the capture waiting in the queue as `fileName`. The card is
+        // written by the storage task; `saved` reports when it is done.
+        void read(const char* fileName, StorageResult *saved = nullptr);
+        // Deletes a stored code on the storage task. False if it is busy.
+        bool remove(const char* fileName, StorageResult *result = nullptr);
+        bool send(const char* fileName);
+        uint32_t sendAsync(const char* fileName, SendPriority priority = SEND_NORMAL);
+        bool nextCompletion(SendResult &result);
+        // True while the loop has results coming from the tasks: sends not
+        // reported yet, storage requests not done or captures while reading.
+        bool hasPendingWork();
+        // Reads a whole file on the storage task. `buffer` must stay valid
+        // until `result.done`. False if the queue is full.
+        bool loadFileAsync(const char* path, uint8_t* buffer, size_t capacity, StorageResult &result);
+        // Deletes everything on the card, codes, scenes and the event log, on
+        // the storage task. The store is mounted again empty afterwards and
+        // no code is matched or served from RAM any more. False if the queue
+        // is full.
+        bool eraseCard(StorageResult &result);
+        const StorageStats &storageStats() const { return stats; };
+        // Starts capturing. Captures left over from before are dropped, so
+        // only IR received from now on reaches read(). Loop only.
         void start();
         void stop();
         bool isReading() { return reading; };
+        const IRCodeCache &codeCache() const { return cache; };
+        bool hasCapture() { return !captures.empty(); };
+        uint32_t droppedCaptures() const { return captures.dropped(); };
+        uint32_t overflowedCaptures() const { return overflowCount; };
+        // Stored codes the last capture saved by read() resembles, best
+        // first. A score of 100 means it duplicates that code.
+        const IRMatch *lastMatches() const { return matches; };
+        uint8_t lastMatchCount() const { return matchCount; };
+        const IRCodeIndex &codeIndex() const { return index; };
         bool codeReceived = false;
+        // Writes timings in the `raw_array:[...]` text format, returns the
+        // number of bytes written. See irrecord::writeText().
+        static size_t writeText(Print &out, const uint16_t *raw_array, uint16_t length);
 
     private:
-        void makeText(uint16_t *raw_array, uint16_t length, char* text);
-        uint16_t makeArrayFromText(uint16_t* &rawCode, char *text);
+        // A queued sendAsync() call.
+        struct SendRequest {
+            uint32_t ticket;
+            char name[IRCodeCache::kMaxNameLength + 1];
+        };
+
+        enum StorageOperation : uint8_t {
+            SAVE_RECORD,   // `data` holds an encoded record.
+            SAVE_TEXT,     // `data` holds raw timings, stored as text.
+            REMOVE_CODE,
+            READ_FILE,     // `name` is a path, read into `buffer`.
+            ERASE_CARD
+        };
+
+        static void captureTask(void *param);
+        static void transmitTask(void *param);
+        static void storageTask(void *param);
+        void pollReceiver();
+        void compactStore();
+        struct StorageRequest;
+        StorageRequest *reserveStorage(StorageOperation operation, const char* name, StorageResult *result);
+        void commitStorage(StorageRequest &request);
+        StorageRequest *findPending(const char* fileName);
+        void supersedePending(const char* fileName);
+        void dropPending(const char* fileName);
+        void supersede(StorageRequest &request);
+        void serveStorage();
+        bool runStorage(StorageRequest &request, size_t &length);
+        bool runErase(size_t &erased);
+        bool saveRecord(const char* fileName, const uint8_t* data, size_t length);
+        bool saveText(const char* fileName, const uint16_t* timings, uint16_t length);
+        bool removeCode(const char* fileName);
+        bool loadPending(const char* fileName, irrecord::IRCode &code, bool &found);
+        bool fetchCode(const char* fileName, irrecord::IRCode &code);
+        bool loadCode(const char* fileName, irrecord::IRCode &code);
+        bool decodeRecord(const char* fileName, size_t size, irrecord::IRCode &code);
+        bool transmit(const irrecord::IRCode &code);
+        bool isReplayable(const decode_results &capture);
+        static void makePath(char *path, const char* fileName);
+        static void indexFile(const char* fileName, void *param);
+
+        static constexpr size_t kMaxPathLength = 64;
+        // Binary records must fit whole; text files are streamed through.
+        static constexpr size_t kMaxCodeFileSize = irrecord::maxRecordSize(kCaptureBufferSize);
+
+        // A request for the storage task. Requests are filled in place in
+        // the queue, so a code is copied once on its way to the card.
+        struct StorageRequest {
+            StorageOperation operation;
+            bool started;      // Taken by the storage task, hands off.
+            bool superseded;   // Skipped, a newer request replaced it.
+            char name[kMaxPathLength];
+            uint8_t *buffer;   // READ_FILE destination.
+            size_t length;     // Bytes in `data`, or the size of `buffer`.
+            StorageResult *result;
+            uint32_t queuedAt;
+            alignas(uint16_t) uint8_t data[kMaxCodeFileSize];
+        };
 
         SDController sd;
+        SDLogStore store;
+
+        // Fixed buffers for the send path, so sending never touches the heap.
+        // fileBuffer, timingBuffer, the cache, the code store and the SD card
+        // are shared by the storage task and send() and guarded by storageMutex. The code
+        // being sent is copied to txTimings/txBytes, guarded by transmitMutex,
+        // so the storage is not locked while the IR LED is busy.
+        uint8_t fileBuffer[kMaxCodeFileSize];
+        uint16_t timingBuffer[kCaptureBufferSize];
+        uint16_t txTimings[kCaptureBufferSize];
+        uint8_t txBytes[kStateSizeMax];
+        SemaphoreHandle_t storageMutex = NULL;
+        SemaphoreHandle_t transmitMutex = NULL;
+
+        // Decoded copies of recently sent codes.
+        uint16_t cacheArena[(kCodeCacheSize + 1) / sizeof(uint16_t)];
+        IRCodeCache cache;
+
+        // Fingerprints of every stored code, used by the main loop only.
+        IRCodeIndex index;
+        IRMatch matches[kMatchResults];
+        uint8_t matchCount = 0;
+
+        // Finished captures waiting for read(). Filled by the capture task.
+        SPSCQueue<IRCapture, kCaptureQueueLength> captures;
+        uint32_t overflowCount = 0;
+
+        // Serialises the receiver between the capture task and send().
+        SemaphoreHandle_t receiverMutex = NULL;
+
+        // Pending sendAsync() requests, one queue per SendPriority, and the
+        // results handed back to the loop. sendAsync() turns requests away
+        // while kCompletionSlots results are outstanding, so there is always
+        // room for a result, even when the loop stops collecting them.
+        static const uint8_t kCompletionSlots = 32;
+        static_assert(kCompletionSlots >= 2 * kSendQueueLength + 1,
+                      "Every send in flight needs a completion slot");
+        QueueHandle_t sendQueues[2] = {NULL, NULL};
+        SemaphoreHandle_t pendingSends = NULL;
+        SPSCQueue<SendResult, kCompletionSlots> completions;
+        std::atomic<uint32_t> nextTicket{1};
+        std::atomic<uint32_t> sendsInFlight{0};   // Queued, on the air or not reported yet.
+
+        // Requests for the storage task, in order. Only the loop adds to the
+        // queue and only the storage task takes from it; storageQueueMutex
+        // guards the indices and lets send() serve codes that are still
+        // waiting to be saved.
+        StorageRequest storageQueue[kStorageQueueLength];
+        uint8_t storageHead = 0;
+        uint8_t storageCount = 0;
+        SemaphoreHandle_t storageQueueMutex = NULL;
+        SemaphoreHandle_t storageWork = NULL;
+        StorageStats stats = {};
 
         // Use turn on the save buffer feature for more complete capture coverage.
-        decode_results results;  // Somewhere to store the results
-        bool reading = false;
+        decode_results results;  // Somewhere to store the results, capture task only
+        volatile bool reading = false;
 };
 
 #endif  // IR_CONTROLLER_H
@@ -0,0 +1,93 @@
+// IR_Matcher.h
+#ifndef IR_MATCHER_H
+#define IR_MATCHER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <IR_Record.h>
+
+// One result of IRCodeIndex::findNearest().
+struct IRMatch {
+  char name[32];
+  uint8_t score;        // 0-100, 100 means the codes are the same.
+};
+
+// In-memory index of every stored code, answering "which stored codes does
+// this capture look like" without touching the SD card.
+//
+// Raw codes are reduced to a fingerprint of their first kFingerprintLength
+// timings, each quantised to a logarithmic bucket. One bucket is as wide as
+// the matching tolerance, so two timings within tolerance of each other land
+// in the same or a neighbouring bucket, and comparing fingerprints only needs
+// byte differences. Fingerprints are compared four buckets at a time with
+// SWAR arithmetic on 32-bit words.
+//
+// Protocol codes keep their first kFingerprintLength value or state bytes in
+// place of a fingerprint, and match codes of the same protocol by the share
+// of bits that agree. Another button of the same remote scores high; only
+// the same value scores 100.
+//
+// Names are found through an open addressing hash table, linear probing, so
+// replacing or removing a code costs the same whatever the number of codes.
+class IRCodeIndex {
+  public:
+    static const uint8_t kFingerprintLength = 64;
+    static const uint8_t kMaxNameLength = sizeof(IRMatch::name) - 1;
+
+    // Allocates room for `capacity` codes once, up to 16384. `tolerance` is
+    // in percent, as kTolerancePercentage; values below 10 are treated as 10.
+    bool begin(uint16_t capacity, uint8_t tolerance);
+    // Adds a code, replacing any code with the same name.
+    bool add(const char *name, const irrecord::IRCode &code);
+    void remove(const char *name);
+    void clear();
+    // Writes up to `k` best matches with a score of at least `minScore` to
+    // `matches`, best first, and returns how many were written. The code
+    // named `exclude`, if any, is skipped.
+    uint8_t findNearest(const irrecord::IRCode &code, IRMatch *matches, uint8_t k,
+                        uint8_t minScore = 1, const char *exclude = nullptr) const;
+    uint16_t size() const { return count; };
+    uint16_t capacity() const { return maxCodes; };
+
+  private:
+    static const uint8_t kWords = kFingerprintLength / 4;
+    static const uint16_t kNoCode = 0xFFFF;
+
+    // Fixed size facts about each code, kept apart from the fingerprints so
+    // the scan walks densely packed memory.
+    struct Info {
+      uint32_t nameHash;
+      uint32_t valueHash;   // CRC32 of the protocol bytes.
+      int16_t protocol;
+      uint16_t length;      // Timing entries of one frame, or protocol bytes.
+      uint16_t bits;        // Protocol bits that carry the value.
+    };
+
+    uint8_t bucket(uint16_t timing) const;
+    void fingerprint(const irrecord::IRCode &code, uint32_t *out, uint8_t padding) const;
+    void describe(const irrecord::IRCode &code, Info &info) const;
+    uint8_t rawScore(const Info &query, uint8_t queryPrinted, const uint32_t *queryPrint,
+                     const Info &info, const uint32_t *print) const;
+    uint8_t protocolScore(const Info &query, const uint32_t *queryPrint, const Info &info,
+                          const uint32_t *print) const;
+    int32_t find(const char *name, uint32_t hash) const;
+    void eraseSlot(uint16_t slot);
+    uint16_t home(uint32_t hash) const { return hash & slotMask; };
+
+    uint32_t *fingerprints = nullptr;   // kWords per code.
+    char (*names)[kMaxNameLength + 1] = nullptr;
+    Info *infos = nullptr;
+    uint16_t maxCodes = 0;
+    uint16_t count = 0;
+
+    // Code by name hash, kNoCode marks a free slot. At least twice as many
+    // slots as codes, so probe runs stay short.
+    uint16_t *slots = nullptr;
+    uint16_t slotMask = 0;
+
+    // thresholds[i] is the smallest timing in bucket i + 1.
+    uint32_t thresholds[120];
+    uint8_t thresholdCount = 0;
+};
+
+#endif  // IR_MATCHER_H
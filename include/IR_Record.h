@@ -0,0 +1,165 @@
+// IR_Record.h
+#ifndef IR_RECORD_H
+#define IR_RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Binary on-SD record for a captured IR code.
+//
+// All multi-byte fields are little endian.
+//
+//   offset  size  field
+//   0       2     magic "IR"
+//   2       1     format version (kRecordVersion)
+//   3       1     flags (kFlagProtocol, kFlagRepeats)
+//   4       2     carrier frequency in Hz, 0 for protocol records
+//   6       2     number of timing entries, or of protocol bytes
+//   8       2     payload length in bytes
+//   10      4     CRC32 of bytes [0, 10) followed by the payload
+//   14      ...   payload
+//
+// Raw records hold one varint per timing entry. With kFlagRepeats the
+// timings are a single frame that is sent 1 + `repeats` times with `gap`
+// micro-seconds of space in between, and the varints are preceded by the
+// repeat count (uint16_t) and the gap (uint32_t). Each entry is stored as the
+// zig-zag encoded difference to the entry two positions back, i.e. marks are
+// delta coded against marks and spaces against spaces, so the usual jitter
+// of a few dozen micro-seconds fits in a single byte.
+//
+// Protocol records are written when the library recognised the capture. The
+// payload is the protocol (decode_type_t) and bit count as two uint16_t,
+// followed by the value in little endian byte order (ceil(bits / 8) bytes)
+// or, for A/C protocols, the raw state bytes.
+namespace irrecord {
+
+const uint8_t kRecordMagic[2] = {'I', 'R'};
+const uint8_t kRecordVersion = 1;
+const size_t kRecordHeaderSize = 14;
+const uint8_t kFlagProtocol = 0x01;
+const uint8_t kFlagRepeats = 0x02;
+const int16_t kRawProtocol = -1;  // Matches decode_type_t UNKNOWN.
+
+// A code as stored on the card. Raw captures carry timings, recognised
+// protocols carry their value or state bytes. The pointers refer to buffers
+// owned by whoever filled the struct in.
+struct IRCode {
+  int16_t protocol = kRawProtocol;  // A decode_type_t.
+  uint16_t bits = 0;                // Protocol bits, unused for raw codes.
+  uint16_t frequency = 0;           // Carrier in Hz, raw codes only.
+  uint16_t length = 0;              // Timing entries, or protocol bytes.
+  uint16_t repeats = 0;             // Extra copies of a raw frame.
+  uint32_t gap = 0;                 // Space before each repeat, in us.
+  const uint16_t *timings = nullptr;
+  const uint8_t *bytes = nullptr;
+
+  bool isRaw() const { return protocol == kRawProtocol; }
+};
+
+// A uint16_t needs at most three varint bytes once zig-zag encoded, plus
+// room for the repeat count and gap.
+constexpr size_t maxRecordSize(uint16_t length) {
+  return kRecordHeaderSize + 6 + 3 * (size_t)length;
+}
+
+// Result codes returned by decode().
+enum RecordStatus {
+  RECORD_OK = 0,
+  RECORD_NOT_A_RECORD,   // Magic does not match, i.e. a legacy text file.
+  RECORD_BAD_VERSION,    // Written by a newer firmware.
+  RECORD_TRUNCATED,      // Fewer bytes than the header promises.
+  RECORD_BAD_CRC,        // Header or payload is corrupt.
+  RECORD_OVERFLOW,       // The caller's timing buffer is too small.
+  RECORD_MALFORMED       // Payload does not decode to the advertised count.
+};
+
+uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc = 0);
+
+// Returns true if the buffer starts with a record header.
+bool isRecord(const uint8_t *data, size_t length);
+
+// Encodes the code into `out`. Returns the number of bytes written, or 0 if
+// `capacity` is too small. maxRecordSize(code.length) always suffices.
+size_t encode(const IRCode &code, uint8_t *out, size_t capacity);
+
+// Decodes a record. Raw timings are written to the caller supplied buffer,
+// protocol bytes are left in place and `code.bytes` points into `data`.
+RecordStatus decode(const uint8_t *data, size_t length, uint16_t *timings,
+                    uint16_t capacity, IRCode &code);
+
+// Looks for a raw capture made of identical frames separated by equal gaps of
+// at least `minGap` us, e.g. a button that was held down. If found, `code`
+// is shrunk to the first frame plus a repeat count and gap. Timings match if
+// they are within `tolerance` percent of each other. Returns true if trimmed.
+bool trimRepeats(IRCode &code, uint8_t tolerance, uint16_t minGap);
+
+// Turns receiver output, durations in ticks of `tickMicros` with the gap
+// before the capture first (decode_results::rawbuf), into the timings a
+// capture is kept as. Durations above 65535us become 65535us mark/space
+// pairs, like resultToRawArray() does, but straight into `timings`. Returns
+// the number of timings written and sets `overflow` if the rest did not fit.
+uint16_t ticksToTimings(const volatile uint16_t *ticks, uint16_t count, uint16_t tickMicros,
+                        uint16_t *timings, uint16_t capacity, bool &overflow);
+
+// Result codes of the legacy `raw_array:[9000,4500,...]` text parser.
+enum ParseStatus {
+  PARSE_OK = 0,
+  PARSE_MORE,            // Input ended before the closing ']'. Feed more.
+  PARSE_NO_PREFIX,       // Input does not start with "raw_array:[".
+  PARSE_MALFORMED,       // Unexpected character or an empty element.
+  PARSE_RANGE,           // An element does not fit in a uint16_t.
+  PARSE_OVERFLOW,        // More elements than the caller's buffer holds.
+  PARSE_TRUNCATED        // finish() called before the closing ']'.
+};
+
+// Single pass parser for the legacy text format. It writes straight into a
+// caller supplied timing buffer and never allocates, and it can be fed the
+// text in arbitrary chunks, e.g. straight from an SD read buffer.
+//
+//   TextParser parser(timings, capacity);
+//   parser.feed(chunk, length);   // Repeat while it returns PARSE_MORE.
+//   status = parser.finish();
+class TextParser {
+  public:
+    TextParser(uint16_t *timings, uint16_t capacity);
+    ParseStatus feed(const char *text, size_t length);
+    ParseStatus finish();
+    uint16_t count() const { return entries; }
+    // Offset of the offending character when feed() fails.
+    size_t errorOffset() const { return offset; }
+
+  private:
+    enum State { PREFIX, NUMBER_START, NUMBER, SEPARATOR, DONE, FAILED };
+
+    ParseStatus fail(ParseStatus status);
+
+    uint16_t *timings;
+    uint16_t capacity;
+    uint16_t entries = 0;
+    uint32_t value = 0;
+    size_t offset = 0;
+    uint8_t matched = 0;
+    State state = PREFIX;
+    ParseStatus status = PARSE_MORE;
+};
+
+// Parses a complete text buffer. Equivalent to one feed() and finish().
+ParseStatus parseText(const char *text, size_t length, uint16_t *timings,
+                      uint16_t capacity, uint16_t &count);
+
+// Takes output handed over in pieces, e.g. by writeText(). Returns the
+// number of bytes it took.
+typedef size_t (*ByteSink)(const uint8_t *data, size_t length, void *context);
+
+// Writes timings in the legacy text format to `sink` and returns the number
+// of bytes it took. The text is formatted in a 64 byte chunk on the stack
+// and handed over whenever that fills up, so the work is linear in the
+// capture length.
+size_t writeText(const uint16_t *timings, uint16_t length, ByteSink sink, void *context);
+
+const char *toString(RecordStatus status);
+const char *toString(ParseStatus status);
+
+}  // namespace irrecord
+
+#endif  // IR_RECORD_H
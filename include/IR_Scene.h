@@ -0,0 +1,78 @@
+// IR_Scene.h
+#ifndef IR_SCENE_H
+#define IR_SCENE_H
+
+#include <IR_Controller.h>
+
+// Plays back scenes: chains of stored codes with pauses in between, run on
+// the device so the phone only sends one command.
+//
+// A scene is a text file in kSceneDirectory with one step per line:
+//
+//   # Movie night
+//   send tv_power
+//   wait 2000
+//   send soundbar_input
+//   wait 500
+//   send ac_cool_22
+//
+// Blank lines and lines starting with '#' are ignored. Codes are queued with
+// IRController::sendAsync(), and a wait starts once the preceding code has
+// actually been transmitted. Nothing blocks: the file is read by the storage
+// task, and tick() advances the scene and returns straight away.
+enum SceneState {
+    SCENE_IDLE,       // No scene loaded.
+    SCENE_LOADING,    // Waiting for the scene file.
+    SCENE_RUNNING,    // Waiting on a transmission or a pause.
+    SCENE_FINISHED,   // Last step done. Reported by exactly one tick().
+    SCENE_FAILED      // Scene missing or invalid. Reported by exactly one tick().
+};
+
+class SceneRunner {
+    public:
+        static const uint8_t kMaxSteps = 32;
+        static const size_t kMaxSceneFileSize = 1024;
+        static constexpr const char *kSceneDirectory = "/scenes/";
+        static const uint32_t kLoadPollMs = 5;
+
+        SceneRunner(IRController &controller) : ir(controller) {};
+        bool start(const char* name);
+        void abort();
+        bool isRunning() const { return state != SCENE_IDLE; };
+        const char *name() const { return sceneName; };
+        uint8_t failedSteps() const { return failures; };
+
+        // Advances the running scene. Call from the loop.
+        SceneState tick();
+        // Milli-seconds until tick() has work to do, 0 if it has some now.
+        // While the file loads it is worth asking again every kLoadPollMs.
+        uint32_t msUntilNextStep() const;
+        // Hands a transmit result to the scene. Returns true if it belonged
+        // to the scene and must not be reported elsewhere.
+        bool onSendComplete(const SendResult &result);
+
+    private:
+        struct Step {
+            bool isWait;
+            uint32_t waitMs;
+            char code[IRCodeCache::kMaxNameLength + 1];
+        };
+
+        bool parse(char *text, size_t length);
+
+        IRController &ir;
+        Step steps[kMaxSteps];
+        uint8_t stepCount = 0;
+        uint8_t nextStep = 0;
+        uint8_t failures = 0;
+        uint32_t pendingTicket = 0;   // Transmission the scene waits for.
+        uint32_t waitStart = 0;
+        uint32_t waitMs = 0;
+        SceneState state = SCENE_IDLE;
+        StorageResult loaded;
+        bool aborted = false;         // Drop the scene once it has loaded.
+        char sceneName[IRCodeCache::kMaxNameLength + 1] = "";
+        char fileBuffer[kMaxSceneFileSize];
+};
+
+#endif  // IR_SCENE_H
@@ -0,0 +1,87 @@
+// SD_Compress.h
+#ifndef SD_COMPRESS_H
+#define SD_COMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <IR_Record.h>
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+// Small LZ compressor for payloads written to the SD card.
+//
+// Raw IR captures are a handful of mark/space durations repeated hundreds of
+// times, and the records and text they are stored as repeat the same few
+// byte patterns just as often. The output is a single LZ4 block, so it can be
+// checked on a PC with any LZ4 library (LZ4_decompress_safe()):
+//
+//   token   literal count (high nibble), match length - 4 (low nibble),
+//           a nibble of 15 is continued by bytes of 255 and a final byte < 255
+//   ...     the literals
+//   2       match offset, little endian, 1 to 65535 bytes back
+//
+// and the block ends after the literals of a sequence without a match. The
+// compressor needs 512 bytes of stack and no heap. The decompressor keeps no
+// window of its own: matches are copied out of the output buffer, so it takes
+// the input in chunks of any size but needs room for the whole result.
+//
+// Needs nothing from Arduino, apart from the Print overloads.
+namespace sdcompress {
+
+// Match positions are kept in 16 bits.
+const size_t kMaxInputLength = 0xFFFF;
+
+// Compresses `data` to `sink` and returns the compressed size, or 0 if
+// `length` is above kMaxInputLength. The output depends on the input only, so
+// it can be sized with a counting sink first and then written for real.
+size_t compress(const uint8_t *data, size_t length, irrecord::ByteSink sink, void *context);
+
+#ifdef ARDUINO
+// The same, written to a Print such as an open File.
+inline size_t compress(const uint8_t *data, size_t length, Print &out) {
+  return compress(data, length, [](const uint8_t *chunk, size_t size, void *context) {
+    return ((Print *)context)->write(chunk, size);
+  }, &out);
+}
+
+// Counts what is written to it, e.g. to size compress() output.
+class CountingPrint : public Print {
+  public:
+    size_t write(uint8_t) override { count++; return 1; }
+    size_t write(const uint8_t *, size_t size) override { count += size; return size; }
+    size_t count = 0;
+};
+#endif  // ARDUINO
+
+// Decompresses a block fed to it in pieces, e.g. straight from SD reads.
+//
+//   Decompressor lz(buffer, capacity);
+//   lz.feed(chunk, length);   // Repeat while it returns true.
+//   ok = lz.finish();         // lz.length() bytes are in buffer.
+class Decompressor {
+  public:
+    Decompressor(uint8_t *out, size_t capacity) : out(out), capacity(capacity) {};
+    // False once the input is malformed or does not fit in the buffer.
+    bool feed(const uint8_t *data, size_t length);
+    // True if the input ended where the block may end.
+    bool finish() const { return state == OFFSET_LOW; };
+    size_t length() const { return produced; };
+
+  private:
+    enum State { TOKEN, LITERAL_LENGTH, LITERALS, OFFSET_LOW, OFFSET_HIGH, MATCH_LENGTH, FAILED };
+
+    bool copyMatch();
+
+    uint8_t *out;
+    size_t capacity;
+    size_t produced = 0;
+    size_t literals = 0;
+    size_t matchLength = 0;
+    uint16_t offset = 0;
+    State state = TOKEN;
+};
+
+}  // namespace sdcompress
+
+#endif  // SD_COMPRESS_H
@@ -3,20 +3,138 @@
 
 #include <SD.h>
 
+// Reads a file piece by piece into buffers the caller owns, so memory use
+// does not grow with the file. Get one from SDController::openReader():
+//
+//   SDReader reader = sd.openReader("/big.bin");
+//   size_t length;
+//   while ((length = reader.read(buffer, sizeof(buffer))) > 0) {
+//     consume(buffer, length);
+//   }
+//   reader.close();
+class SDReader {
+  public:
+    bool isOpen() const { return open; };
+    size_t size() const { return fileSize; };
+    size_t remaining() const { return fileSize - offset; };
+    // Fills up to `capacity` bytes and returns how many were read, 0 at the
+    // end of the file or on a read error.
+    size_t read(uint8_t* buffer, size_t capacity);
+    void close();
+
+  private:
+    friend class SDController;
+
+    File file;
+    bool open = false;
+    size_t fileSize = 0;
+    size_t offset = 0;
+};
+
+// State of an erase job, see SDController::beginErase().
+enum EraseStatus {
+    ERASE_IDLE,
+    ERASE_RUNNING,
+    ERASE_DONE,
+    ERASE_FAILED    // Something could not be removed, or its path was too long.
+};
+
+// Mirrors the card's directory tree in RAM so existence, size and listing
+// queries do not go over SPI. The index is built on first use and kept up to
+// date by every write, remove, rename and erase made through this class.
+// Paths longer than kMaxIndexedPath, or more than three quarters of
+// kIndexSlots entries, do not fit; the index then stops answering "missing"
+// on its own and asks the card instead. Files written behind its back, with
+// SD directly, are not seen.
 class SDController {
   public:
+    static const uint8_t kIndexSlots = 128;   // Power of two.
+    static const uint8_t kMaxIndexedPath = 47;
+    static const size_t kChunkSize = 512;
+    static const uint8_t kMaxErasePath = 127;
+
     bool init();
     bool createAndSaveFile(const char* fileName, const char* text);
-    char* readFile(const char* fileName);
+    bool createAndSaveFile(const char* fileName, const uint8_t* data, size_t length);
+    // Reads a whole file into `buffer`. Fails if it is larger than `capacity`.
+    bool readFile(const char* fileName, uint8_t* buffer, size_t capacity, size_t &length);
+    // Opens a file for streaming, check isOpen() on the result.
+    SDReader openReader(const char* fileName);
+    // Streams a file through a kChunkSize buffer owned by the controller.
+    // `visitor` may stop the read early by returning false. Returns true if
+    // the whole file was read and visited.
+    bool forEachChunk(const char* fileName,
+                      bool (*visitor)(const uint8_t* data, size_t length, void* context),
+                      void* context);
+    File openFile(const char* fileName, const char* mode = FILE_READ);
     bool fileExists(const char* fileName);
+    // Size of the file in bytes, or -1 if it does not exist.
+    int32_t fileSize(const char* fileName);
+    // Changes whenever the file is written through this controller, 0 if it
+    // does not exist.
+    uint32_t fileVersion(const char* fileName);
+    bool removeFile(const char* fileName);
+    bool renameFile(const char* from, const char* to);
+    // Creates a directory in an existing parent. True if it already exists.
+    bool makeDirectory(const char* path);
     bool isInitialized() { return initialized; };
-    bool eraseCard();
+    // Starts deleting `path` and everything below it, or only everything
+    // below it for "/". eraseStep() then removes up to `budget` files and
+    // directories per call, so the caller stays responsive however big the
+    // card is. The walk keeps one open directory and a path of at most
+    // kMaxErasePath characters, whatever the depth of the tree.
+    bool beginErase(const char *path = "/");
+    EraseStatus eraseStep(uint16_t budget);
+    EraseStatus eraseStatus() const { return eraseState; };
+    // Entries removed so far, and the number the directory index knew of
+    // when the job started, 0 if it was not complete.
+    uint32_t erasedEntries() const { return eraseCount; };
+    uint32_t eraseTotal() const { return eraseExpected; };
     bool isCardEmpty();
     void printDirectory(const char *dirname, uint8_t numTabs);
+    // Calls `callback` with the name of every file, not directory, directly
+    // inside `dirname`. Returns false if the directory cannot be opened. The
+    // callback must not write to the card.
+    bool listFiles(const char *dirname, void (*callback)(const char *name, void *context), void *context);
     
   private:
-    bool deleteDirectory(String path);
+    static const uint32_t kUnknownSize = UINT32_MAX;
+
+    struct IndexEntry {
+      uint32_t hash;
+      uint32_t size;        // kUnknownSize if written through openFile().
+      uint32_t version;
+      bool used;
+      bool isDirectory;
+      char path[kMaxIndexedPath + 1];
+    };
+
+    EraseStatus finishErase(bool erased);
+    bool indexReady();
+    void indexDirectory(const char *dirname);
+    int16_t indexFind(const char *path);
+    void indexAdd(const char *path, bool isDirectory, uint32_t size);
+    void indexRemove(const char *path);
+    void indexReset(bool built);
+
     bool initialized = false;
+    uint8_t chunk[kChunkSize];
+
+    // The erase job. erasePath is the directory being emptied; its parents
+    // are the stack the walk climbs back up.
+    char erasePath[kMaxErasePath + 1];
+    size_t eraseRootLength = 0;
+    File eraseDir;
+    EraseStatus eraseState = ERASE_IDLE;
+    uint32_t eraseCount = 0;
+    uint32_t eraseExpected = 0;
+
+    IndexEntry index[kIndexSlots];
+    uint8_t indexCount = 0;
+    bool indexBuilt = false;
+    // False once something did not fit; lookups that miss then ask the card.
+    bool indexComplete = true;
+    uint32_t modifications = 0;
 };
 
 #endif
@@ -0,0 +1,163 @@
+// SD_LogStore.h
+#ifndef SD_LOG_STORE_H
+#define SD_LOG_STORE_H
+
+#include <SD_Controller.h>
+
+// Append-only key/value store packed into a single file on the SD card.
+//
+// One file per code makes every lookup a FAT directory scan and every small
+// write a whole cluster. Instead, entries are appended to kLogPath through a
+// 512 byte block buffer, so the card only ever sees whole, aligned blocks,
+// and found again through a hash index in RAM that maps each name to the
+// offset of its newest entry. A lookup costs one probe and one read,
+// whatever the number of stored codes.
+//
+// Each entry is a 12 byte header, the name and the data:
+//
+//   0  magic 0xA5      1  type         2  name length   3  flags
+//   4  data length (u32 LE)            8  CRC32 of bytes 0-7, name and data
+//
+// put() can store the data LZ compressed (see SD_Compress.h), flagged with
+// kEntryCompressed, when that makes it smaller; get() unpacks it again.
+//
+// The index is saved to kCheckpointPath every kCheckpointInterval writes.
+// begin() loads it and replays only the entries written after it, or scans
+// the whole log if it is missing or stale. Writes stop being replayed at the
+// first torn or corrupt entry, so a power cut loses at most the last write.
+//
+// Overwritten and removed entries stay in the log until compaction copies
+// the live entries to kCompactPath and swaps it in. compactStep() does one
+// entry per call, so it can run in the background between other work.
+//
+// Not thread safe; the caller serialises access along with the SD bus.
+class SDLogStore {
+  public:
+    static const uint16_t kBlockSize = 512;
+    static const uint8_t kMaxNameLength = 31;
+    static const uint16_t kMaxDataLength = 0xFFFF - 12 - kMaxNameLength;
+    static const uint8_t kCheckpointInterval = 32;
+    // Compact once at least this many bytes are dead and they outweigh the
+    // live ones.
+    static const uint32_t kCompactThreshold = 16 * 1024;
+    static constexpr const char *kLogPath = "/codes.log";
+    static constexpr const char *kCompactPath = "/codes.new";
+    static constexpr const char *kCheckpointPath = "/codes.idx";
+
+    SDLogStore(SDController &sd) : sd(sd) {};
+    // True for the files the store keeps in the root directory.
+    static bool isStoreFile(const char *name);
+
+    // Opens or creates the store. `slots` must be a power of two, the store
+    // holds up to three quarters of it.
+    bool begin(uint16_t slots);
+    // Closes the log without a checkpoint, e.g. before the card is erased.
+    // begin() opens the store again.
+    void end();
+    bool isMounted() const { return mounted; };
+
+    bool contains(const char *name);
+    // Copies the data stored under `name` to `buffer`. Fails if it is missing,
+    // larger than `capacity` or corrupt.
+    bool get(const char *name, uint8_t *buffer, size_t capacity, size_t &length);
+    bool put(const char *name, const uint8_t *data, size_t length, bool compress = false);
+    bool remove(const char *name);
+    // Calls `callback` with the name of every stored entry. The callback may
+    // read from the store but not change it.
+    void list(void (*callback)(const char *name, void *context), void *context);
+
+    // Saves the index so the next begin() does not have to scan the log.
+    bool checkpoint();
+    bool needsCompaction() const;
+    // Copies one entry to the compacted log. Returns true while there is
+    // more compaction work to do.
+    bool compactStep();
+
+    uint16_t size() const { return count; };
+    uint32_t liveBytes() const { return live; };
+    uint32_t deadBytes() const { return logEnd - kHeaderEntrySize - live; };
+
+  private:
+    static const uint8_t kEntryHeaderSize = 12;
+    static const uint8_t kHeaderEntrySize = kEntryHeaderSize + 4;
+    // Offset 0 holds the header entry, never a stored one.
+    static const uint32_t kEmptySlot = 0;
+    static const uint8_t kEntryCompressed = 0x01;
+
+    enum EntryType : uint8_t {
+      ENTRY_PUT = 1,
+      ENTRY_DELETE = 2,
+      ENTRY_HEADER = 3   // First entry of a log, carries its generation.
+    };
+
+    struct EntryHeader {
+      uint8_t type;
+      uint8_t flags;
+      uint8_t nameLength;
+      uint32_t dataLength;
+      uint32_t crc;
+      uint32_t size() const { return kEntryHeaderSize + nameLength + dataLength; };
+    };
+
+    // Appends through a block buffer and only ever writes whole blocks at
+    // block aligned offsets. commit() writes out the partially filled last
+    // block, padded with zeros, and keeps it for the next append. As a Print
+    // it takes compressor output directly.
+    struct BlockWriter : public Print {
+      File file;
+      uint32_t blockOffset = 0;
+      uint16_t used = 0;
+      uint8_t block[kBlockSize];
+
+      uint32_t position() const { return blockOffset + used; };
+      bool start(File &target, uint32_t offset);
+      bool append(const uint8_t *data, size_t length);
+      bool commit();
+      size_t write(uint8_t value) override { return append(&value, 1) ? 1 : 0; };
+      size_t write(const uint8_t *data, size_t length) override { return append(data, length) ? length : 0; };
+    };
+
+    bool mount();
+    bool loadCheckpoint(uint32_t logSize);
+    uint32_t scan(uint32_t from, uint32_t logSize);
+    bool readHeader(File &file, uint32_t offset, EntryHeader &header, char *name);
+    bool verify(File &file, uint32_t offset, const EntryHeader &header);
+    bool appendEntry(BlockWriter &writer, uint8_t type, const char *name,
+                     const uint8_t *data, size_t length);
+    bool appendCompressed(const char *name, const uint8_t *data, size_t length);
+    bool getCompressed(const EntryHeader &header, const char *name, uint8_t *buffer,
+                       size_t capacity, size_t &length);
+    bool copyEntry(uint32_t from, const EntryHeader &header, const char *name);
+    void finishCompaction();
+    void wrote();
+
+    int32_t find(const char *name, uint32_t hash);
+    int32_t findOffset(uint32_t hash, uint32_t offset) const;
+    void insert(uint32_t hash, uint32_t offset, uint32_t size);
+    void erase(uint16_t slot);
+    uint16_t home(uint32_t hash) const { return hash & (slotCount - 1); };
+
+    SDController &sd;
+    bool mounted = false;
+    File log;
+    BlockWriter tail;
+    uint32_t generation = 0;
+    uint32_t logEnd = 0;
+    uint32_t live = 0;
+    uint8_t writesSinceCheckpoint = 0;
+
+    // Open addressing hash index, linear probing, one entry per slot.
+    uint32_t *hashes = nullptr;
+    uint32_t *offsets = nullptr;   // kEmptySlot marks a free slot.
+    uint16_t *sizes = nullptr;
+    uint32_t *moved = nullptr;     // Offset in the compacted log.
+    uint16_t slotCount = 0;
+    uint16_t count = 0;
+
+    bool compacting = false;
+    uint32_t compactRead = 0;
+    uint32_t compactStart = 0;     // End of the log when compaction began.
+    BlockWriter compactWriter;
+};
+
+#endif  // SD_LOG_STORE_H
@@ -0,0 +1,90 @@
+// SPSC_Queue.h
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Fixed capacity, lock-free queue for exactly one producer and one consumer,
+// e.g. a FreeRTOS task feeding the main loop.
+//
+// Slots are filled and drained in place so large items are never copied:
+//
+//   producer:  T *slot = queue.reserve();   consumer:  T *item = queue.front();
+//              if (slot) {                             if (item) {
+//                fill(*slot);                            use(*item);
+//                queue.commit();                         queue.pop();
+//              }                                       }
+//
+// Capacity must be a power of two. The head and tail counters run freely and
+// are masked on access, so all `Capacity` slots are usable.
+template <typename T, size_t Capacity>
+class SPSCQueue {
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0,
+                  "SPSCQueue capacity must be a power of two");
+
+  public:
+    // Producer side. Returns nullptr and counts a drop if the queue is full.
+    T *reserve() {
+      uint32_t tail = tailIndex.load(std::memory_order_relaxed);
+      if (tail - headIndex.load(std::memory_order_acquire) == Capacity) {
+        dropCount.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+      return &slots[tail & (Capacity - 1)];
+    }
+
+    // Producer side. Publishes the slot returned by the last reserve().
+    void commit() {
+      tailIndex.store(tailIndex.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_release);
+    }
+
+    bool push(const T &item) {
+      T *slot = reserve();
+      if (slot == nullptr) {
+        return false;
+      }
+      *slot = item;
+      commit();
+      return true;
+    }
+
+    // Consumer side. Returns the oldest item, or nullptr if the queue is empty.
+    T *front() {
+      uint32_t head = headIndex.load(std::memory_order_relaxed);
+      if (head == tailIndex.load(std::memory_order_acquire)) {
+        return nullptr;
+      }
+      return &slots[head & (Capacity - 1)];
+    }
+
+    // Consumer side. Releases the slot returned by front().
+    void pop() {
+      headIndex.store(headIndex.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_release);
+    }
+
+    // Consumer side. Drops every item committed so far; items the producer
+    // commits later are kept.
+    void clear() {
+      headIndex.store(tailIndex.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    size_t size() const {
+      return tailIndex.load(std::memory_order_acquire) -
+             headIndex.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+    static constexpr size_t capacity() { return Capacity; }
+    uint32_t dropped() const { return dropCount.load(std::memory_order_relaxed); }
+
+  private:
+    T slots[Capacity];
+    std::atomic<uint32_t> headIndex{0};
+    std::atomic<uint32_t> tailIndex{0};
+    std::atomic<uint32_t> dropCount{0};
+};
+
+#endif  // SPSC_QUEUE_H
@@ -0,0 +1,176 @@
+// Timer_Wheel.h
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Hierarchical timer wheel for up to `Capacity` timers, one per id, e.g. one
+// per entry of a fixed table.
+//
+// Deadlines are kept in ticks of `TickMs`. Timers due within kNearTicks sit
+// in the near wheel, one slot per tick; later ones sit in the far wheel, one
+// slot per kNearTicks, and drop into the near wheel when their turn comes.
+// Arming, moving and cancelling a timer is O(1), and expiring only visits the
+// slots the clock passes and the timers in them, however many are armed:
+//
+//   wheel.schedule(id, millis() + 60000);
+//   ...
+//   uint16_t id;
+//   while ((id = wheel.expire(millis())) != wheel.kNone) {
+//     handle(id);   // May schedule() it, or others, again.
+//   }
+//
+// Timers are kept in intrusive lists of ids, so the wheel takes 10 bytes per
+// timer plus 2 bytes per slot and never allocates. Deadlines further out than
+// kHorizonMs fire at the horizon; re-arm them if they are not due yet.
+template <uint16_t Capacity, uint16_t TickMs>
+class TimerWheel {
+    static_assert(Capacity < 0xFFFF, "TimerWheel ids must fit below kNone");
+
+  public:
+    static const uint16_t kNone = 0xFFFF;
+    static const uint16_t kNearTicks = 256;
+    static const uint16_t kFarSlots = 64;
+    static const uint32_t kHorizonMs = (uint32_t)(kNearTicks * (kFarSlots - 1) - 1) * TickMs;
+
+    TimerWheel() {
+      for (uint16_t i = 0; i < kLists; i++) {
+        heads[i] = kNone;
+      }
+      for (uint16_t i = 0; i < Capacity; i++) {
+        list[i] = kNone;
+      }
+    }
+
+    // Sets the clock, before the first schedule().
+    void start(uint32_t now) { clock = now; };
+
+    bool isScheduled(uint16_t id) const { return list[id] != kNone; };
+
+    // Arms the timer of `id` for `deadline` (ms), moving it if it was armed.
+    // Timers never fire early, and at most a tick late. Deadlines in the past
+    // count from the tick the clock is in, so they fire within a tick of the
+    // call. Times are compared as differences, so the clock may wrap.
+    void schedule(uint16_t id, uint32_t deadline) {
+      cancel(id);
+      int32_t delay = (int32_t)(deadline - clock);
+      uint32_t ticks = 0;
+      if (delay > 0) {
+        ticks = (uint32_t)delay > kHorizonMs ? kHorizonMs / TickMs : (delay + TickMs - 1) / TickMs;
+      }
+      due[id] = current + ticks;
+      insert(id);
+    }
+
+    void cancel(uint16_t id) {
+      uint16_t from = list[id];
+      if (from == kNone) {
+        return;
+      }
+      if (prev[id] == kNone) {
+        heads[from] = next[id];
+      } else {
+        next[prev[id]] = next[id];
+      }
+      if (next[id] != kNone) {
+        prev[next[id]] = prev[id];
+      }
+      list[id] = kNone;
+    }
+
+    // Advances the clock to `now` and returns one timer that is due, which
+    // is disarmed, or kNone once there are no more.
+    uint16_t expire(uint32_t now) {
+      for (;;) {
+        uint16_t id = heads[kExpiredList];
+        if (id != kNone) {
+          cancel(id);
+          return id;
+        }
+        if ((int32_t)(now - clock) < 0) {
+          return kNone;  // The current tick has not started yet.
+        }
+
+        moveAll(current & (kNearTicks - 1), kExpiredList);
+        current++;
+        clock += TickMs;
+        if ((current & (kNearTicks - 1)) == 0) {
+          // A new turn of the near wheel, bring in the timers due during it.
+          uint16_t slot = kNearTicks + ((current / kNearTicks) & (kFarSlots - 1));
+          uint16_t cascade;
+          while ((cascade = heads[slot]) != kNone) {
+            cancel(cascade);
+            insert(cascade);
+          }
+        }
+      }
+    }
+
+    // Time from `now` until expire() may have a timer to return: 0 if one is
+    // due, 0xFFFFFFFF if none is armed. Never late, but may be early: past
+    // the end of the near wheel's turn it wakes for the cascade.
+    uint32_t msUntilNext(uint32_t now) const {
+      if (heads[kExpiredList] != kNone) {
+        return 0;
+      }
+      // Until the turn ends the near wheel holds every timer due.
+      uint32_t turnEnd = kNearTicks - (current & (kNearTicks - 1));
+      uint32_t ticks = 0;
+      while (ticks < turnEnd && heads[(current + ticks) & (kNearTicks - 1)] == kNone) {
+        ticks++;
+      }
+      if (ticks == turnEnd) {
+        uint16_t list = 0;
+        while (list < kExpiredList && heads[list] == kNone) {
+          list++;
+        }
+        if (list == kExpiredList) {
+          return 0xFFFFFFFF;
+        }
+      }
+      int32_t delay = (int32_t)(clock + ticks * TickMs - now);
+      return delay > 0 ? delay : 0;
+    }
+
+  private:
+    // Near slots, then far slots, then timers that are due.
+    static const uint16_t kExpiredList = kNearTicks + kFarSlots;
+    static const uint16_t kLists = kExpiredList + 1;
+
+    void insert(uint16_t id) {
+      uint32_t ticks = due[id] - current;
+      uint16_t to = ticks < kNearTicks
+        ? (due[id] & (kNearTicks - 1))
+        : kNearTicks + ((due[id] / kNearTicks) & (kFarSlots - 1));
+      link(id, to);
+    }
+
+    void link(uint16_t id, uint16_t to) {
+      prev[id] = kNone;
+      next[id] = heads[to];
+      if (heads[to] != kNone) {
+        prev[heads[to]] = id;
+      }
+      heads[to] = id;
+      list[id] = to;
+    }
+
+    void moveAll(uint16_t from, uint16_t to) {
+      uint16_t id;
+      while ((id = heads[from]) != kNone) {
+        cancel(id);
+        link(id, to);
+      }
+    }
+
+    uint32_t current = 0;        // Next tick to expire.
+    uint32_t clock = 0;          // Time `current` starts at, in ms.
+    uint32_t due[Capacity];      // Deadline in ticks.
+    uint16_t next[Capacity];
+    uint16_t prev[Capacity];
+    uint16_t list[Capacity];     // List the timer is in, kNone if disarmed.
+    uint16_t heads[kLists];
+};
+
+#endif  // TIMER_WHEEL_H
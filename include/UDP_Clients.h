@@ -0,0 +1,144 @@
+// UDP_Clients.h
+#ifndef UDP_CLIENTS_H
+#define UDP_CLIENTS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <UDP_Reliable.h>
+
+// Where the heartbeat with a client stands, see WifiController::serviceClients().
+enum HeartbeatState : uint8_t {
+    HEARTBEAT_IDLE,           // The client was heard from recently, nothing to do.
+    HEARTBEAT_AWAITING_PONG   // An OP_PING is out, waiting for the client.
+};
+
+// Per client state of a session.
+struct ClientSession {
+    uint32_t ip;
+    uint16_t port;
+    uint16_t txSequence;        // Of our pings and notifications.
+    uint32_t lastHeard;         // millis() of the last frame from the client.
+    HeartbeatState heartbeat;
+    uint8_t missedPongs;
+    udpproto::ReceiveWindow commands;   // Sequence numbers of its commands.
+    udpproto::RttEstimator rtt;         // Times out its replies.
+};
+
+// Fixed capacity table of the clients connected over UDP, found by IP and
+// port in O(1).
+//
+// Sessions live in a fixed array and keep their id while connected, so other
+// tables (e.g. a TimerWheel) can be indexed by it. An open addressing index,
+// twice the capacity, maps IP:port to the id; removals shift the probe run
+// back, so lookups never meet tombstones. The ids in use are also kept
+// densely, for visiting every client without scanning free slots.
+template <uint16_t Capacity>
+class ClientTable {
+    static_assert(Capacity != 0 && Capacity <= 0x4000, "ClientTable capacity out of range");
+
+  public:
+    static const uint16_t kNoClient = 0xFFFF;
+
+    ClientTable() {
+      for (uint16_t i = 0; i < kBuckets; i++) {
+        buckets[i] = kNoClient;
+      }
+      for (uint16_t i = 0; i < Capacity; i++) {
+        members[i] = i;
+        position[i] = i;
+      }
+    }
+
+    uint16_t size() const { return count; };
+    bool isFull() const { return count == Capacity; };
+
+    // The id of the client at ip:port, kNoClient if it is not registered.
+    uint16_t find(uint32_t ip, uint16_t port) const {
+      for (uint16_t bucket = hash(ip, port); buckets[bucket] != kNoClient; bucket = (bucket + 1) & kMask) {
+        const ClientSession &session = sessions[buckets[bucket]];
+        if (session.ip == ip && session.port == port) {
+          return buckets[bucket];
+        }
+      }
+      return kNoClient;
+    }
+
+    // Registers ip:port with a fresh session and returns its id, the id it
+    // already had if registered, or kNoClient if the table is full.
+    uint16_t add(uint32_t ip, uint16_t port) {
+      uint16_t id = find(ip, port);
+      if (id != kNoClient) {
+        return id;
+      }
+      if (count == Capacity) {
+        return kNoClient;
+      }
+
+      id = members[count++];
+      ClientSession &session = sessions[id];
+      session = ClientSession();
+      session.ip = ip;
+      session.port = port;
+      uint16_t bucket = hash(ip, port);
+      while (buckets[bucket] != kNoClient) {
+        bucket = (bucket + 1) & kMask;
+      }
+      buckets[bucket] = id;
+      return id;
+    }
+
+    void remove(uint16_t id) {
+      const ClientSession &session = sessions[id];
+      uint16_t hole = hash(session.ip, session.port);
+      while (buckets[hole] != id) {
+        if (buckets[hole] == kNoClient) {
+          return;  // Not registered.
+        }
+        hole = (hole + 1) & kMask;
+      }
+
+      // Shift later members of the probe run back into the hole.
+      for (uint16_t next = (hole + 1) & kMask; buckets[next] != kNoClient; next = (next + 1) & kMask) {
+        const ClientSession &moved = sessions[buckets[next]];
+        uint16_t home = hash(moved.ip, moved.port);
+        if (((next - home) & kMask) >= ((next - hole) & kMask)) {
+          buckets[hole] = buckets[next];
+          hole = next;
+        }
+      }
+      buckets[hole] = kNoClient;
+
+      // Swap the id out of the dense list.
+      uint16_t last = members[--count];
+      uint16_t at = position[id];
+      members[at] = last;
+      position[last] = at;
+      members[count] = id;
+      position[id] = count;
+    }
+
+    ClientSession &operator[](uint16_t id) { return sessions[id]; };
+    // The ids in use are client(0) to client(size() - 1), in no order.
+    uint16_t client(uint16_t index) const { return members[index]; };
+
+  private:
+    // Smallest power of two at least twice the capacity.
+    static constexpr uint16_t bucketCount(uint16_t size) {
+      return size >= 2 * Capacity ? size : bucketCount(size * 2);
+    }
+    static const uint16_t kBuckets = bucketCount(1);
+    static const uint16_t kMask = kBuckets - 1;
+
+    static uint16_t hash(uint32_t ip, uint16_t port) {
+      uint32_t key = (ip ^ ((uint32_t)port << 16) ^ port) * 2654435761u;
+      return (key >> 16) & kMask;
+    }
+
+    ClientSession sessions[Capacity];
+    uint16_t buckets[kBuckets];
+    uint16_t members[Capacity];     // Ids in use first, then free ones.
+    uint16_t position[Capacity];    // Where each id is in members.
+    uint16_t count = 0;
+};
+
+#endif  // UDP_CLIENTS_H
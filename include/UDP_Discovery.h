@@ -0,0 +1,153 @@
+// UDP_Discovery.h
+#ifndef UDP_DISCOVERY_H
+#define UDP_DISCOVERY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <UDP_Protocol.h>
+
+namespace udpproto {
+
+// Sends one datagram; `ip` is stored like IPAddress does, first octet in the
+// low byte. Lets the discovery logic run over a socket on the device and over
+// a stand-in on the host.
+typedef bool (*DatagramSender)(uint32_t ip, uint16_t port, const uint8_t *data, size_t length, void *context);
+
+// How clients find the device.
+//
+// A client looking for devices broadcasts an OP_DISCOVER frame; each device
+// answers it right away with an OP_ANNOUNCE frame carrying its IP address as
+// text, with the query's sequence number. Each source address is answered at
+// most once every kMinIntervalMs, and no more than kTrackedSources sources in
+// that time, so a flood of queries cannot make the device flood the network
+// in turn. On top of that the device
+// announces itself unsolicited to the broadcast address: right away, again
+// after kMinIntervalMs, then twice as long after every announcement up to
+// kMaxIntervalMs, so idle devices do not keep a busy network busier.
+// restart() starts over, e.g. when the network changed and clients may have
+// lost track of the device.
+//
+//   discovery.setAddress(localIP, broadcastIP);   // Restarts if they changed.
+//   discovery.poll(millis());                     // Announces when due.
+template <uint32_t kMinIntervalMs, uint32_t kMaxIntervalMs>
+class DiscoveryResponder {
+    static_assert(kMinIntervalMs != 0 && kMinIntervalMs <= kMaxIntervalMs, "Bad discovery intervals");
+
+  public:
+    static const uint8_t kTrackedSources = 8;
+
+    DiscoveryResponder(DatagramSender sender, void *context, uint16_t port)
+      : send(sender), sendContext(context), announcePort(port) {};
+
+    // Sets the device's address and that of its network, restarting the
+    // announcements if either changed.
+    void setAddress(uint32_t ip, uint32_t broadcast) {
+      if (ip != localIp || broadcast != broadcastIp) {
+        localIp = ip;
+        broadcastIp = broadcast;
+        restart();
+      }
+    }
+
+    // Announces on the next poll() and backs off from kMinIntervalMs again.
+    void restart() {
+      interval = kMinIntervalMs;
+      announceNow = true;
+    }
+
+    // Sends an unsolicited announcement if one is due. True if it was sent; a
+    // failed one is tried again after kMinIntervalMs.
+    bool poll(uint32_t now) {
+      if (localIp == 0 || (!announceNow && now - lastAnnounced < interval)) {
+        return false;
+      }
+      lastAnnounced = now;
+      if (!announce(broadcastIp, announcePort, sequence + 1)) {
+        interval = kMinIntervalMs;
+        announceNow = false;
+        return false;
+      }
+      sequence++;
+      if (!announceNow) {
+        interval = interval > kMaxIntervalMs / 2 ? kMaxIntervalMs : interval * 2;
+      }
+      announceNow = false;
+      return true;
+    }
+
+    // Answers an OP_DISCOVER frame from ip:port, unless its source or too
+    // many others were answered within kMinIntervalMs. True if it was.
+    bool answer(const Frame &query, uint32_t ip, uint16_t port, uint32_t now) {
+      if (localIp == 0) {
+        return false;
+      }
+      // The source's entry, or else the one answered longest ago.
+      uint8_t slot = 0;
+      for (uint8_t i = 0; i < kTrackedSources; i++) {
+        if (answered[i].ip == ip) {
+          slot = i;
+          break;
+        }
+        if (age(i, now) > age(slot, now)) {
+          slot = i;
+        }
+      }
+      if (age(slot, now) < kMinIntervalMs) {
+        return false;
+      }
+      answered[slot].ip = ip;
+      answered[slot].at = now;
+      return announce(ip, port, query.sequence);
+    }
+
+    // Time until poll() announces, 0 if it is due, 0xFFFFFFFF if it has no
+    // address to announce.
+    uint32_t msUntilNext(uint32_t now) const {
+      if (localIp == 0) {
+        return 0xFFFFFFFF;
+      }
+      if (announceNow) {
+        return 0;
+      }
+      uint32_t elapsed = now - lastAnnounced;
+      return elapsed >= interval ? 0 : interval - elapsed;
+    }
+
+    uint32_t currentInterval() const { return interval; };
+
+  private:
+    struct Answered {
+      uint32_t ip;       // 0 if the entry is unused.
+      uint32_t at;
+    };
+
+    uint32_t age(uint8_t slot, uint32_t now) const {
+      return answered[slot].ip == 0 ? 0xFFFFFFFF : now - answered[slot].at;
+    }
+
+    bool announce(uint32_t ip, uint16_t port, uint16_t frameSequence) {
+      char text[16];
+      int length = snprintf(text, sizeof(text), "%u.%u.%u.%u", (unsigned)(localIp & 0xFF),
+                            (unsigned)((localIp >> 8) & 0xFF), (unsigned)((localIp >> 16) & 0xFF),
+                            (unsigned)(localIp >> 24));
+      uint8_t frame[kFrameHeaderSize + sizeof(text)];
+      size_t size = encodeFrame(frame, sizeof(frame), OP_ANNOUNCE, frameSequence, (const uint8_t *)text, length);
+      return size != 0 && send(ip, port, frame, size, sendContext);
+    }
+
+    DatagramSender send;
+    void *sendContext;
+    uint16_t announcePort;
+    uint32_t localIp = 0;
+    uint32_t broadcastIp = 0;
+    uint32_t interval = kMinIntervalMs;
+    uint32_t lastAnnounced = 0;
+    uint16_t sequence = 0;       // Of the unsolicited announcements.
+    bool announceNow = true;
+    Answered answered[kTrackedSources] = {};
+};
+
+}  // namespace udpproto
+
+#endif  // UDP_DISCOVERY_H
@@ -0,0 +1,129 @@
+// UDP_Protocol.h
+#ifndef UDP_PROTOCOL_H
+#define UDP_PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Binary frames exchanged with the client over UDP, one frame per datagram.
+//
+// All multi-byte fields are little endian.
+//
+//   offset  size  field
+//   0       2     magic "SN"
+//   2       1     protocol version (kProtocolVersion)
+//   3       1     opcode (Opcode)
+//   4       2     sequence number
+//   6       2     payload length in bytes
+//   8       4     CRC-32 of bytes 0-7 followed by the payload
+//   12      n     payload
+//
+// Frames are checked where they lie, in the receive buffer, and handed on as
+// a Frame that points into it; nothing is copied or allocated. Every
+// command with a code or scene name fits in a single kMaxFrameSize datagram.
+//
+// The client numbers its requests one after the other; replies carry the
+// sequence number of the request they answer. Both are acknowledged and sent
+// again until they are, see UDP_Reliable.h. Notifications carry the device's
+// own, incrementing sequence number.
+//
+// Needs nothing from Arduino: a PC client can build this file together with
+// src/UDP_Protocol.cpp and src/IR_Record.cpp (for the CRC).
+namespace udpproto {
+
+const uint8_t kFrameMagic[2] = {'S', 'N'};
+const uint8_t kProtocolVersion = 2;
+const size_t kFrameHeaderSize = 12;
+// Stays clear of IP fragmentation on any network.
+const size_t kMaxFrameSize = 512;
+const size_t kMaxPayloadSize = kMaxFrameSize - kFrameHeaderSize;
+
+// Opcodes are part of the protocol, only ever add new ones.
+enum Opcode : uint8_t {
+    // Session, either direction unless noted.
+    OP_HELLO = 0x01,       // Client: pass phrase.
+    OP_WELCOME = 0x02,     // Device: answer to a matching OP_HELLO.
+    OP_PING = 0x03,
+    OP_PONG = 0x04,        // Answer to OP_PING, same sequence number.
+    OP_ACK = 0x05,         // Device: commands up to this sequence number arrived.
+                           // Client: the reply with this sequence number arrived.
+    OP_DISCOVER = 0x06,    // Client, to the broadcast address: any devices here?
+    OP_ANNOUNCE = 0x07,    // Device: its IP address, see UDP_Discovery.h.
+
+    // Commands from the client. Names are sent without a terminator.
+    OP_SEND = 0x10,        // Code name, queued behind pending replays.
+    OP_SEND_NOW = 0x11,    // Code name, queued ahead of pending replays.
+    OP_SCENE = 0x12,       // Scene name.
+    OP_LEARN = 0x13,       // Code name to store the next capture as.
+    OP_DELETE = 0x14,      // Code name.
+    OP_STORAGE = 0x15,     // No payload.
+    OP_ERASE = 0x16,       // No payload. Deletes everything on the SD card.
+
+    // From the device, the payload is text.
+    OP_REPLY = 0x20,       // Answer to a command.
+    OP_NOTIFY = 0x21,      // Something finished, e.g. "SENT 12".
+
+    kOpcodeLimit = 0x40    // Opcodes are below this.
+};
+
+enum FrameStatus : uint8_t {
+    FRAME_OK,
+    FRAME_TOO_SHORT,       // Shorter than its header says.
+    FRAME_BAD_MAGIC,
+    FRAME_BAD_VERSION,
+    FRAME_BAD_LENGTH,      // Longer than its header says, or too large.
+    FRAME_BAD_CRC,
+    FRAME_UNHANDLED,       // Valid, but no handler for its opcode.
+    kFrameStatusCount
+};
+
+// A checked frame. `payload` points into the buffer it was parsed from and
+// is only valid as long as that buffer is.
+struct Frame {
+    uint8_t opcode;
+    uint16_t sequence;
+    const uint8_t *payload;
+    uint16_t length;
+    uint16_t origin;       // Not on the wire, set by the receiver, e.g. to the sender's client id.
+};
+
+// Checks the datagram in `data` and, if it holds exactly one valid frame,
+// points `frame` at it.
+FrameStatus parseFrame(const uint8_t *data, size_t length, Frame &frame);
+
+// Writes a frame to `out` and returns its size, 0 if it does not fit in
+// `capacity` or kMaxFrameSize.
+size_t encodeFrame(uint8_t *out, size_t capacity, uint8_t opcode, uint16_t sequence,
+                   const uint8_t *payload, size_t length);
+
+// Copies the payload to `out` as a terminated string. False if it does not
+// fit or holds a NUL.
+bool payloadText(const Frame &frame, char *out, size_t capacity);
+
+typedef void (*FrameHandler)(const Frame &frame, void *context);
+
+// Calls the handler registered for a frame's opcode. A table indexed by
+// opcode, so routing costs the same whatever the number of handlers.
+class FrameDispatcher {
+  public:
+    void on(uint8_t opcode, FrameHandler handler, void *context = nullptr);
+    // FRAME_UNHANDLED if nothing is registered for the opcode.
+    FrameStatus dispatch(const Frame &frame);
+    // Parses a datagram in place and dispatches it.
+    FrameStatus dispatch(const uint8_t *data, size_t length);
+    // Datagrams seen by dispatch(), by outcome.
+    uint32_t count(FrameStatus status) const { return counts[status]; };
+
+  private:
+    struct Route {
+      FrameHandler handler = nullptr;
+      void *context = nullptr;
+    };
+
+    Route routes[kOpcodeLimit];
+    uint32_t counts[kFrameStatusCount] = {};
+};
+
+}  // namespace udpproto
+
+#endif  // UDP_PROTOCOL_H
@@ -0,0 +1,249 @@
+// UDP_Reliable.h
+#ifndef UDP_RELIABLE_H
+#define UDP_RELIABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Reliable delivery of commands and replies on top of the frames of
+// UDP_Protocol.h.
+//
+// A client numbers its commands one after the other, the first one right
+// after the sequence number of its OP_HELLO. Only the first hello from an
+// address and port sets the numbering, a repeated or late one is welcomed
+// but changes nothing; a client that starts over uses a new port. The device answers every command
+// frame, new or repeated, with an OP_ACK carrying a cumulative
+// acknowledgement: every command up to and including its sequence number has
+// arrived. The client sends a command again until it is covered, each time
+// after the timeout of its RttEstimator. A repeat of a command that already
+// arrived is acknowledged again but not run again (see ReceiveWindow), so
+// every command runs exactly once.
+//
+// Replies carry the sequence number of the command they answer. The client
+// answers each one with an OP_ACK carrying that number, and the device sends
+// it again until it does (see RetransmitQueue). Notifications and session
+// frames are sent once.
+//
+// Needs nothing from Arduino, like UDP_Protocol.h, so a PC client can use the
+// same RttEstimator and ReceiveWindow.
+namespace udpproto {
+
+// Retransmission timeout from measured round trip times, as in RFC 6298
+// (Jacobson/Karels): a smoothed RTT and its mean deviation, kept in fixed
+// point as 8 * SRTT and 4 * RTTVAR.
+class RttEstimator {
+  public:
+    static const uint32_t kInitialRtoMs = 1000;
+    // Below RFC 6298's one second: home Wi-Fi answers within milliseconds.
+    static const uint32_t kMinRtoMs = 200;
+    static const uint32_t kMaxRtoMs = 8000;
+
+    // Adds the round trip time of a frame that was only sent once (Karn).
+    void sample(uint32_t rttMs) {
+      if (rttMs > kMaxRtoMs) {
+        rttMs = kMaxRtoMs;
+      }
+      if (!measured) {
+        srtt8 = rttMs << 3;
+        rttvar4 = rttMs << 1;
+        measured = true;
+      } else {
+        int32_t error = (int32_t)rttMs - (int32_t)(srtt8 >> 3);
+        srtt8 += error;
+        if (error < 0) {
+          error = -error;
+        }
+        rttvar4 += error - (int32_t)(rttvar4 >> 2);
+      }
+      uint32_t rto = (srtt8 >> 3) + (rttvar4 > 1 ? rttvar4 : 1);
+      timeoutMs = rto < kMinRtoMs ? kMinRtoMs : rto > kMaxRtoMs ? kMaxRtoMs : rto;
+    }
+
+    // How long to wait for an acknowledgement before sending again.
+    uint32_t timeout() const { return timeoutMs; };
+    uint32_t smoothedRtt() const { return srtt8 >> 3; };
+
+  private:
+    uint32_t srtt8 = 0;
+    uint32_t rttvar4 = 0;
+    uint32_t timeoutMs = kInitialRtoMs;
+    bool measured = false;
+};
+
+enum Arrival : uint8_t {
+    ARRIVAL_NEW,           // First time seen, to be run.
+    ARRIVAL_DUPLICATE,     // Seen before, acknowledge again but do not run.
+    ARRIVAL_AHEAD          // Too far ahead of the gap, drop it unacknowledged.
+};
+
+// Tells new sequence numbers from repeats. Everything before next() has
+// arrived; of the kSpan numbers from next() on, a bitmap tells which have.
+class ReceiveWindow {
+  public:
+    static const uint16_t kSpan = 32;
+
+    // Starts over, expecting `last` + 1 next.
+    void reset(uint16_t last) {
+      expected = last + 1;
+      seen = 0;
+    }
+
+    Arrival accept(uint16_t sequence) {
+      uint16_t offset = sequence - expected;
+      if (offset >= 0x8000) {
+        return ARRIVAL_DUPLICATE;  // Before the window, arrived long ago.
+      }
+      if (offset >= kSpan) {
+        return ARRIVAL_AHEAD;
+      }
+      uint32_t bit = 1u << offset;
+      if (seen & bit) {
+        return ARRIVAL_DUPLICATE;
+      }
+      seen |= bit;
+      while (seen & 1) {
+        seen >>= 1;
+        expected++;
+      }
+      return ARRIVAL_NEW;
+    }
+
+    uint16_t next() const { return expected; };
+    // Every sequence number up to this one has arrived.
+    uint16_t cumulative() const { return expected - 1; };
+
+  private:
+    uint16_t expected = 0;
+    uint32_t seen = 0;       // Bit i: next() + i has arrived.
+};
+
+// Copies of frames sent to peers that have not acknowledged them yet, in
+// `Slots` fixed slots of up to `FrameSize` bytes shared by all peers.
+//
+//   if (!queue.add(peer, sequence, frame, size, now, rtt.timeout())) ...
+//   ...
+//   uint8_t slot;
+//   while ((slot = queue.due(now)) != queue.kNone) {
+//     send(queue[slot].peer, queue[slot].frame, queue[slot].length);
+//     queue.retransmitted(slot, now);
+//   }
+//
+// Each retransmission doubles the timeout of the frame. Slots are searched
+// linearly, there are only a few.
+template <uint8_t Slots, size_t FrameSize>
+class RetransmitQueue {
+    static_assert(Slots != 0 && Slots < 0xFF, "RetransmitQueue slots out of range");
+
+  public:
+    static const uint8_t kNone = 0xFF;
+
+    struct Entry {
+      uint16_t peer;
+      uint16_t sequence;
+      uint32_t sentAt;       // Of the last transmission.
+      uint32_t timeout;
+      uint8_t transmissions; // 0 if the slot is free.
+      uint16_t length;
+      uint8_t frame[FrameSize];
+    };
+
+    // Keeps a copy of a frame that was just sent, until `peer` acknowledges
+    // `sequence`. False if the frame is too large or every slot is taken.
+    bool add(uint16_t peer, uint16_t sequence, const uint8_t *frame, size_t length, uint32_t now,
+             uint32_t timeout) {
+      if (length > FrameSize) {
+        return false;
+      }
+      for (uint8_t slot = 0; slot < Slots; slot++) {
+        Entry &entry = entries[slot];
+        if (entry.transmissions == 0) {
+          entry.peer = peer;
+          entry.sequence = sequence;
+          entry.sentAt = now;
+          entry.timeout = timeout;
+          entry.transmissions = 1;
+          entry.length = length;
+          memcpy(entry.frame, frame, length);
+          count++;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Forgets the frame `peer` acknowledged. Returns its round trip time, or
+    // -1 if it is unknown or was sent more than once, so the time is
+    // ambiguous (Karn's algorithm).
+    int32_t acknowledge(uint16_t peer, uint16_t sequence, uint32_t now) {
+      for (uint8_t slot = 0; slot < Slots; slot++) {
+        Entry &entry = entries[slot];
+        if (entry.transmissions != 0 && entry.peer == peer && entry.sequence == sequence) {
+          int32_t rtt = entry.transmissions == 1 ? (int32_t)(now - entry.sentAt) : -1;
+          remove(slot);
+          return rtt;
+        }
+      }
+      return -1;
+    }
+
+    // A frame whose timeout ran out, or kNone.
+    uint8_t due(uint32_t now) const {
+      for (uint8_t slot = 0; slot < Slots; slot++) {
+        const Entry &entry = entries[slot];
+        if (entry.transmissions != 0 && now - entry.sentAt >= entry.timeout) {
+          return slot;
+        }
+      }
+      return kNone;
+    }
+
+    // Time from `now` until due() returns a frame, 0xFFFFFFFF if none is kept.
+    uint32_t msUntilNext(uint32_t now) const {
+      uint32_t next = 0xFFFFFFFF;
+      for (uint8_t slot = 0; slot < Slots; slot++) {
+        const Entry &entry = entries[slot];
+        if (entry.transmissions != 0) {
+          uint32_t elapsed = now - entry.sentAt;
+          uint32_t left = elapsed >= entry.timeout ? 0 : entry.timeout - elapsed;
+          next = left < next ? left : next;
+        }
+      }
+      return next;
+    }
+
+    // Restarts the timer of a frame that was just sent again.
+    void retransmitted(uint8_t slot, uint32_t now) {
+      Entry &entry = entries[slot];
+      entry.sentAt = now;
+      entry.timeout = entry.timeout * 2 < RttEstimator::kMaxRtoMs ? entry.timeout * 2 : RttEstimator::kMaxRtoMs;
+      entry.transmissions++;
+    }
+
+    void remove(uint8_t slot) {
+      if (entries[slot].transmissions != 0) {
+        entries[slot].transmissions = 0;
+        count--;
+      }
+    }
+
+    // Drops every frame for `peer`, e.g. once it is gone.
+    void forget(uint16_t peer) {
+      for (uint8_t slot = 0; slot < Slots; slot++) {
+        if (entries[slot].peer == peer) {
+          remove(slot);
+        }
+      }
+    }
+
+    const Entry &operator[](uint8_t slot) const { return entries[slot]; };
+    uint8_t size() const { return count; };
+
+  private:
+    Entry entries[Slots] = {};
+    uint8_t count = 0;
+};
+
+}  // namespace udpproto
+
+#endif  // UDP_RELIABLE_H
@@ -12,18 +12,39 @@ static constexpr int INIT_ADDRESS    = PASS_ADDRESS + PASS_LENGTH; // address to
 static constexpr int LOCAL_PORT      = 8181;
 static constexpr char PASS_PHRASE[]  = "abc\0";
 
-/**
- * UdpClient struct
+// Clients: up to MAX_CLIENTS clients can be connected at once, each of them
+// checked on its own by the heartbeat below. Their timers advance in ticks of
+// HEARTBEAT_TICK_MS.
+static constexpr uint16_t MAX_CLIENTS                = 256;
+static constexpr uint16_t HEARTBEAT_TICK_MS          = 250;
 
- * Structure to store the IP address and port number of a UDP client.
+// Discovery: the device answers OP_DISCOVER queries and announces itself to
+// the broadcast address, again after DISCOVERY_MIN_INTERVAL_MS and then twice
+// as long each time, up to DISCOVERY_MAX_INTERVAL_MS. A network change starts
+// over. Nothing is announced while the client table is full.
+static constexpr uint32_t DISCOVERY_MIN_INTERVAL_MS  = 1000;
+static constexpr uint32_t DISCOVERY_MAX_INTERVAL_MS  = 120000;
 
- * The ip field holds the IP address of the client and the port field holds the port number 
- * that the client is connected to.
- **/
-struct UdpClient {
-    IPAddress ip;
-    int port;
-};
+// Receiving: datagrams are read straight into one of RX_BUFFERS buffers and
+// handed on from there, so up to RX_BUFFERS commands can wait for their
+// handler. Further datagrams wait in the socket until a buffer is released.
+static constexpr uint8_t RX_BUFFERS                  = 4;
+
+// Replies: each one is kept in one of RETRANSMIT_SLOTS slots of up to
+// RETAINED_FRAME_SIZE bytes and sent again until the client acknowledges it,
+// at most MAX_RETRANSMITS times (see UDP_Reliable.h). Without a free slot a
+// reply is only sent once.
+static constexpr uint8_t RETRANSMIT_SLOTS            = 8;
+static constexpr size_t RETAINED_FRAME_SIZE          = 256;
+static constexpr uint8_t MAX_RETRANSMITS             = 4;
+
+// Heartbeat: once a client has been silent for HEARTBEAT_INTERVAL_MS, an
+// OP_PING is sent and an OP_PONG is expected within PONG_TIMEOUT_MS. Any frame
+// from the client counts as an answer. After MAX_MISSED_PONGS unanswered pings
+// in a row the client is considered gone.
+static constexpr unsigned long HEARTBEAT_INTERVAL_MS = 60000;
+static constexpr unsigned long PONG_TIMEOUT_MS       = 1000;
+static constexpr uint8_t MAX_MISSED_PONGS            = 3;
 
 /**
  * WiFiCredentials struct
@@ -12,33 +12,56 @@
 
 #include <Arduino.h>
 #include <EEPROM.h>
+#include <lwip/sockets.h>
 #include <WIFI_Config.h>
 #include <LED_Status.h>
+#include <UDP_Protocol.h>
+#include <UDP_Clients.h>
+#include <Timer_Wheel.h>
+#include <Buffer_Pool.h>
+#include <UDP_Reliable.h>
+#include <UDP_Discovery.h>
+
+// A command frame as handed out by WifiController::receiveFrame(). The frame
+// points into a receive buffer, which stays reserved until the frame is
+// handed back with WifiController::release().
+struct ReceivedFrame {
+    udpproto::Frame frame;  // `origin` is the id of the client it came from.
+    uint8_t buffer;
+};
 
 /**
  * WifiController class
 
  * This class provides a wrapper around the WiFi library to handle
- * connecting to a Wi-Fi network, sending and receiving messages via
- * UDP, and managing the status of the connection.
+ * connecting to a Wi-Fi network, sending and receiving frames (see
+ * UDP_Protocol.h) via UDP, and managing the status of the connection.
 
  * The class also provides methods for saving and loading Wi-Fi
  * credentials, checking if a Wi-Fi connection is established, and
- * checking if a client is connected to the device.
+ * keeping track of the clients connected to the device.
 
  * A reference to a StatusLED object is passed to the class to provide
  * visual feedback on the status of the Wi-Fi connection.
  **/
 class WifiController {
     public:
-        WifiController(StatusLED &sLED) : led(sLED) {};
+        WifiController(StatusLED &sLED) : discovery(sendTo, this, LOCAL_PORT), led(sLED) {};
         void init();
         bool connect();
         void checkIncomingClients();
+        void serviceClients();
         bool isWiFiConnected();
-        bool isClientConnected();
-        int sendMessage(String& message);
-        int receiveMessage(String& message);
+        bool waitForTraffic(uint32_t timeoutMs);
+        uint16_t clientCount() const { return clients.size(); };
+        bool receiveFrame(ReceivedFrame& received);
+        void release(const ReceivedFrame& received);
+        bool sendFrame(uint16_t id, uint8_t opcode, uint16_t sequence, const uint8_t* payload = nullptr, size_t length = 0);
+        bool reply(const udpproto::Frame& request, const char* text);
+        bool notify(const char* text);
+        uint32_t droppedFrames() const { return badFrames; };
+        uint32_t duplicateFrames() const { return duplicates; };
+        uint32_t undeliveredFrames() const { return undelivered; };
         bool hasCredentials();
         void set_initialized(bool state);
         void saveCredentials(WiFiCredentials credentials);
@@ -48,13 +71,39 @@ class WifiController {
         void setupUDP();
         void clearCredentials();
         bool get_initialized();
-        void broadcastIP(unsigned long timer);
+        static bool sendTo(uint32_t ip, uint16_t port, const uint8_t* data, size_t length, void* context);
+        void receivePackets();
+        bool receiveDatagram(const uint8_t* buffer, int length, udpproto::Frame& frame);
+        bool acceptFrame(udpproto::Frame& frame);
+        bool registerClient(const udpproto::Frame& frame);
+        void dropClient(uint16_t id);
+        void onClientTimer(uint16_t id, unsigned long now);
+        bool sendPing(uint16_t id);
+        bool sendReliable(uint16_t id, uint8_t opcode, uint16_t sequence, const uint8_t* payload, size_t length);
+        bool sendDatagram(uint16_t id, const uint8_t* data, size_t size);
+        bool sendPacket(uint32_t ip, uint16_t port, const uint8_t* data, size_t size);
+        void retransmitFrames(unsigned long now);
         String WiFiStatusCodeToString(wl_status_t status);
 
-        unsigned long lastPingTime;
-        bool connected = false;
-        UdpClient client;
-        WiFiUDP udp;
+        ClientTable<MAX_CLIENTS> clients;
+        // One timer per client, indexed by its id: the next heartbeat while
+        // idle, the pong timeout while a ping is out.
+        TimerWheel<MAX_CLIENTS, HEARTBEAT_TICK_MS> clientTimers;
+        uint32_t badFrames = 0;
+        uint32_t duplicates = 0;    // Repeated commands, acknowledged but not run.
+        uint32_t undelivered = 0;   // Replies sent without being acknowledged.
+        udpproto::RetransmitQueue<RETRANSMIT_SLOTS, RETAINED_FRAME_SIZE> retransmits;
+        // One byte more than a frame, to tell datagrams that are too large.
+        BufferPool<RX_BUFFERS, udpproto::kMaxFrameSize + 1> rxPool;
+        // Command frames received but not yet handed out, oldest first.
+        ReceivedFrame pending[RX_BUFFERS];
+        uint8_t pendingHead = 0;
+        uint8_t pendingCount = 0;
+        uint8_t txBuffer[udpproto::kMaxFrameSize];
+        udpproto::DiscoveryResponder<DISCOVERY_MIN_INTERVAL_MS, DISCOVERY_MAX_INTERVAL_MS> discovery;
+        int sock = -1;              // Non-blocking lwIP UDP socket on LOCAL_PORT.
+        uint32_t remoteIp = 0;      // Sender of the datagram being handled.
+        uint16_t remotePort = 0;
         StatusLED &led;
 };
 
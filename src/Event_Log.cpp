@@ -0,0 +1,146 @@
+// Event_Log.cpp
+#include <Event_Log.h>
+
+EventLog events;
+
+void EventLog::log(uint16_t id, uint32_t arg0, uint32_t arg1) {
+  uint32_t now = millis();
+  portENTER_CRITICAL(&lock);
+  if (tail - head == kRingRecords) {
+    // The lost event still takes a sequence number, so the gap shows.
+    sequence++;
+    droppedPending++;
+    droppedTotal++;
+  } else {
+    append(now, id, arg0, arg1);
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+void EventLog::append(uint32_t timestamp, uint16_t id, uint32_t arg0, uint32_t arg1) {
+  // Called with `lock` held and a free slot.
+  if (tail == head) {
+    oldestAt = timestamp;
+  }
+  eventlog::Record record = { timestamp, id, sequence++, { arg0, arg1 } };
+  eventlog::encodeRecord(record, &ring[(tail & (kRingRecords - 1)) * eventlog::kRecordSize]);
+  tail++;
+}
+
+bool EventLog::flushDue() {
+  portENTER_CRITICAL(&lock);
+  uint32_t waiting = tail - head;
+  uint32_t since = oldestAt;
+  bool dropped = droppedPending != 0;
+  portEXIT_CRITICAL(&lock);
+  return waiting >= kBatchRecords || dropped ||
+         (waiting != 0 && millis() - since >= kFlushIntervalMs);
+}
+
+bool EventLog::flush(SDController &sd) {
+  if (!sd.isInitialized()) {
+    return false;
+  }
+
+  // Report drops first, as soon as the ring has room for the report.
+  uint32_t now = millis();
+  portENTER_CRITICAL(&lock);
+  if (droppedPending != 0 && tail - head < kRingRecords) {
+    append(now, eventlog::EVENT_DROPPED, droppedPending, droppedTotal);
+    droppedPending = 0;
+  }
+  uint32_t end = tail;
+  portEXIT_CRITICAL(&lock);
+
+  // The records up to `end` are not touched by log() until `head` passes
+  // them, so they are written straight out of the ring, at most a batch and
+  // never across the end of the ring at a time.
+  uint32_t start = head;
+  while (start != end) {
+    uint32_t offset = start & (kRingRecords - 1);
+    uint32_t count = end - start;
+    if (count > kBatchRecords) {
+      count = kBatchRecords;
+    }
+    if (count > kRingRecords - offset) {
+      count = kRingRecords - offset;
+    }
+    if (!write(sd, &ring[offset * eventlog::kRecordSize], count * eventlog::kRecordSize)) {
+      return false;
+    }
+    start += count;
+
+    portENTER_CRITICAL(&lock);
+    head = start;
+    oldestAt = millis();
+    portEXIT_CRITICAL(&lock);
+  }
+  return true;
+}
+
+void EventLog::filePath(char *path, size_t size, uint8_t number) {
+  snprintf(path, size, "%s/%u.log", kLogDirectory, number);
+}
+
+bool EventLog::write(SDController &sd, const uint8_t *data, size_t length) {
+  char path[24];
+  filePath(path, sizeof(path), 0);
+  if (fileBytes < 0) {
+    if (!sd.makeDirectory(kLogDirectory)) {
+      return false;
+    }
+    fileBytes = sd.fileSize(path);
+    if (fileBytes < 0) {
+      fileBytes = 0;
+    }
+  }
+  if (fileBytes != 0 && fileBytes + length > kMaxFileSize) {
+    if (!rotate(sd)) {
+      return false;
+    }
+    fileBytes = 0;
+  }
+
+  File file = sd.openFile(path, FILE_APPEND);
+  if (!file) {
+    return false;
+  }
+  size_t expected = length;
+  size_t written = 0;
+  if (fileBytes == 0) {
+    uint8_t start[eventlog::kRecordSize];
+    uint32_t now = millis();
+    eventlog::Record record = {
+      now, eventlog::EVENT_LOG_START, 0,
+      { eventlog::kLogMagic, eventlog::kFormatVersion | (eventlog::kRecordSize << 8) }
+    };
+    eventlog::encodeRecord(record, start);
+    expected += sizeof(start);
+    written += file.write(start, sizeof(start));
+  }
+  written += file.write(data, length);
+  file.close();
+
+  fileBytes += written;
+  if (written != expected) {
+    // A torn record would misalign the rest of the file, so start a new one.
+    fileBytes = kMaxFileSize;
+    return false;
+  }
+  return true;
+}
+
+bool EventLog::rotate(SDController &sd) {
+  char from[24];
+  char to[24];
+  filePath(to, sizeof(to), kFileCount - 1);
+  sd.removeFile(to);
+  for (uint8_t number = kFileCount - 1; number > 0; number--) {
+    filePath(from, sizeof(from), number - 1);
+    filePath(to, sizeof(to), number);
+    if (sd.fileExists(from) && !sd.renameFile(from, to)) {
+      return false;
+    }
+  }
+  return true;
+}
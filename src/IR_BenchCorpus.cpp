@@ -0,0 +1,137 @@
+// IR_BenchCorpus.cpp
+#include <IR_BenchCorpus.h>
+
+namespace irbench {
+
+// Appends pulses to a capture, up to `limit` timings.
+class CaptureBuilder {
+  public:
+    CaptureBuilder(Capture &capture, const char *name, uint32_t seed, uint16_t limit = kMaxTimings)
+      : capture(capture), seed(seed), limit(limit) {
+      capture.name = name;
+      capture.length = 0;
+    }
+
+    void pulse(uint16_t mark, uint16_t space) {
+      append(mark);
+      append(space);
+    }
+
+    // Sends `count` bits of `data`, least significant bit first.
+    void bits(const uint8_t *data, uint16_t count, uint16_t mark, uint16_t one, uint16_t zero) {
+      for (uint16_t i = 0; i < count; i++) {
+        pulse(mark, (data[i / 8] >> (i % 8)) & 1 ? one : zero);
+      }
+    }
+
+    void mark(uint16_t duration) { append(duration); }
+
+    bool full() const { return capture.length == limit; }
+
+  private:
+    void append(uint16_t duration) {
+      seed = seed * 1103515245 + 12345;
+      int32_t jitter = (int32_t)((seed >> 16) % 9) - 4;  // -4% to +4%
+      if (capture.length < limit) {
+        capture.timings[capture.length++] = duration + duration * jitter / 100;
+      }
+    }
+
+    Capture &capture;
+    uint32_t seed;
+    uint16_t limit;
+};
+
+// A long remote payload that is not all zeros.
+static void fillPayload(uint8_t *payload, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    payload[i] = i * 37 + 0x11;
+  }
+}
+
+void makeNec(Capture &capture) {
+  static const uint8_t payload[] = {0x04, 0xFB, 0x08, 0xF7};
+  CaptureBuilder builder(capture, "nec", 1);
+  builder.pulse(9000, 4500);
+  builder.bits(payload, 32, 560, 1690, 560);
+  builder.mark(560);
+}
+
+void makeSamsung(Capture &capture) {
+  static const uint8_t payload[] = {0x07, 0x07, 0x02, 0xFD};
+  CaptureBuilder builder(capture, "samsung_x3", 2);
+  for (uint8_t frame = 0; frame < 3; frame++) {
+    if (frame != 0) {
+      builder.mark(560);
+      builder.mark(47000);
+    }
+    builder.pulse(4480, 4480);
+    builder.bits(payload, 32, 560, 1680, 560);
+  }
+  builder.mark(560);
+}
+
+void makeKelvinator(Capture &capture) {
+  static const uint8_t command[] = {0x02};
+  uint8_t payload[16];
+  fillPayload(payload, sizeof(payload));
+  CaptureBuilder builder(capture, "kelvinator", 3);
+  for (uint8_t half = 0; half < 2; half++) {
+    if (half != 0) {
+      builder.pulse(680, 39950);
+    }
+    builder.pulse(9010, 4505);
+    builder.bits(payload + 8 * half, 32, 680, 1530, 510);
+    builder.bits(command, 3, 680, 1530, 510);
+    builder.pulse(680, 19975);
+    builder.bits(payload + 8 * half + 4, 32, 680, 1530, 510);
+  }
+  builder.mark(680);
+}
+
+void makeDaikin(Capture &capture) {
+  static const uint8_t leader[] = {0x00};
+  uint8_t payload[35];
+  fillPayload(payload, sizeof(payload));
+  CaptureBuilder builder(capture, "daikin", 4);
+  builder.bits(leader, 5, 428, 1280, 428);
+  builder.pulse(428, 29428);
+  builder.pulse(3650, 1623);
+  builder.bits(payload, 64, 428, 1280, 428);
+  builder.pulse(428, 29428);
+  builder.pulse(3650, 1623);
+  builder.bits(payload + 8, 64, 428, 1280, 428);
+  builder.pulse(428, 29428);
+  builder.pulse(3650, 1623);
+  builder.bits(payload + 16, 152, 428, 1280, 428);
+  builder.mark(428);
+}
+
+void makeLength(Capture &capture, const char *name, uint16_t length) {
+  uint8_t payload[64];
+  fillPayload(payload, sizeof(payload));
+  CaptureBuilder builder(capture, name, length, length < kMaxTimings ? length : kMaxTimings);
+  builder.pulse(9000, 4500);
+  while (!builder.full()) {
+    builder.bits(payload, 8 * sizeof(payload), 560, 1690, 560);
+  }
+}
+
+void makeVariant(Capture &variant, const Capture &base, uint8_t percent, uint32_t seed) {
+  variant = base;
+  for (uint16_t i = 0; i < variant.length; i++) {
+    seed = seed * 1103515245 + 12345;
+    int32_t change = (int32_t)((seed >> 16) % (2 * percent + 1)) - percent;
+    variant.timings[i] += variant.timings[i] * change / 100;
+  }
+}
+
+irrecord::IRCode rawCode(const Capture &capture) {
+  irrecord::IRCode code;
+  code.frequency = kCarrierFrequency;
+  code.timings = capture.timings;
+  code.length = capture.length;
+  return code;
+}
+
+}  // namespace irbench
@@ -0,0 +1,244 @@
+// IR_Benchmark.cpp
+#include <IR_Benchmark.h>
+
+#ifdef IR_BENCHMARK
+
+#include <IR_Controller.h>
+#include <IR_BenchCorpus.h>
+#include <IR_Matcher.h>
+#include <SD_Compress.h>
+#include <UDP_Protocol.h>
+#include <esp_timer.h>
+
+// Bump when the CSV columns change, so old results are not compared blindly.
+static const uint8_t kBenchFormatVersion = 2;
+static const uint32_t kBenchStackSize = 8192;
+// Each benchmark repeats its operation for roughly this long.
+static const uint32_t kBenchTargetMicros = 200000;
+static const uint32_t kBenchMaxIterations = 100000;
+// Library size for the nearest-match benchmark.
+static const uint16_t kBenchIndexSize = 512;
+
+static_assert(irbench::kMaxTimings == kCaptureBufferSize, "Corpus and capture buffer differ");
+
+// Throws text away, counting it.
+class NullPrint : public Print {
+  public:
+    size_t write(uint8_t) override { return 1; }
+    size_t write(const uint8_t *, size_t size) override { return size; }
+};
+
+// Collects text into a fixed buffer.
+class BufferPrint : public Print {
+  public:
+    BufferPrint(char *buffer, size_t capacity) : buffer(buffer), capacity(capacity) {}
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *data, size_t size) override {
+      if (size > capacity - used) {
+        size = capacity - used;
+      }
+      memcpy(buffer + used, data, size);
+      used += size;
+      return size;
+    }
+    size_t length() const { return used; }
+
+  private:
+    char *buffer;
+    size_t capacity;
+    size_t used = 0;
+};
+
+// The corpus and scratch buffers are static, so they do not count against
+// the benchmark task's stack.
+static irbench::Capture corpus[4];
+static const irbench::Capture *current;
+static char textBuffer[8 * kCaptureBufferSize];
+static size_t textLength;
+static uint8_t recordBuffer[irrecord::maxRecordSize(kCaptureBufferSize)];
+static size_t recordLength;
+static uint8_t packedBuffer[sizeof(recordBuffer) + sizeof(recordBuffer) / 255 + 16];
+static size_t packedLength;
+static uint8_t unpackedBuffer[sizeof(recordBuffer)];
+static uint8_t frameBuffer[udpproto::kMaxFrameSize];
+static size_t frameLength;
+static uint16_t decoded[kCaptureBufferSize];
+static IRCodeIndex benchIndex;
+static volatile uint32_t benchSink;  // Keeps results alive.
+
+static void benchTextWrite() {
+  NullPrint sink;
+  benchSink = IRController::writeText(sink, current->timings, current->length);
+}
+
+static void benchTextParse() {
+  uint16_t count;
+  irrecord::parseText(textBuffer, textLength, decoded, kCaptureBufferSize, count);
+  benchSink = count;
+}
+
+static void benchRecordEncode() {
+  benchSink = irrecord::encode(irbench::rawCode(*current), recordBuffer, sizeof(recordBuffer));
+}
+
+static void benchRecordDecode() {
+  irrecord::IRCode code;
+  benchSink = irrecord::decode(recordBuffer, recordLength, decoded, kCaptureBufferSize, code);
+}
+
+static void benchCompress() {
+  BufferPrint packed((char *)packedBuffer, sizeof(packedBuffer));
+  benchSink = sdcompress::compress(recordBuffer, recordLength, packed);
+}
+
+static void benchDecompress() {
+  sdcompress::Decompressor lz(unpackedBuffer, sizeof(unpackedBuffer));
+  lz.feed(packedBuffer, packedLength);
+  benchSink = lz.finish() ? lz.length() : 0;
+}
+
+static void benchFrameEncode() {
+  benchSink = udpproto::encodeFrame(frameBuffer, sizeof(frameBuffer), udpproto::OP_SEND, 1,
+                                    recordBuffer, recordLength);
+}
+
+static void benchFrameParse() {
+  udpproto::Frame frame;
+  benchSink = udpproto::parseFrame(frameBuffer, frameLength, frame);
+}
+
+static void benchTrimRepeats() {
+  irrecord::IRCode code = irbench::rawCode(*current);
+  benchSink = irrecord::trimRepeats(code, kTolerancePercentage, kMinRepeatGap);
+}
+
+static void benchIndexMatch() {
+  IRMatch matches[kMatchResults];
+  benchSink = benchIndex.findNearest(irbench::rawCode(*current), matches, kMatchResults,
+                                     kMinMatchScore);
+}
+
+struct BenchJob {
+  const char *name;
+  void (*run)();
+  size_t bytes;
+  uint32_t iterations;
+  uint32_t nsPerOp;
+  int32_t heapBytes;
+  uint32_t peakStack;
+  SemaphoreHandle_t done;
+};
+
+static void benchTask(void *param) {
+  BenchJob &job = *(BenchJob *)param;
+  uint32_t heapBefore = ESP.getFreeHeap();
+
+  // Size the run from one warm up call.
+  int64_t start = esp_timer_get_time();
+  job.run();
+  int64_t single = esp_timer_get_time() - start;
+  job.iterations = single > 0 ? kBenchTargetMicros / single : kBenchMaxIterations;
+  job.iterations = constrain(job.iterations, (uint32_t)1, kBenchMaxIterations);
+
+  start = esp_timer_get_time();
+  for (uint32_t i = 0; i < job.iterations; i++) {
+    job.run();
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+  job.nsPerOp = elapsed * 1000 / job.iterations;
+
+  job.heapBytes = (int32_t)(heapBefore - ESP.getFreeHeap());
+  // The ESP32 port reports stack sizes in bytes.
+  job.peakStack = kBenchStackSize - uxTaskGetStackHighWaterMark(NULL);
+  xSemaphoreGive(job.done);
+  vTaskDelete(NULL);
+}
+
+// Runs one benchmark against `current` in a fresh task and prints its row.
+// `bytes` is the size of what the operation produces, e.g. the record.
+static void runBenchmark(Print &out, const char *name, void (*run)(), size_t bytes,
+                         SemaphoreHandle_t done) {
+  BenchJob job = {name, run, bytes, 0, 0, 0, 0, done};
+  if (xTaskCreatePinnedToCore(benchTask, "IRBench", kBenchStackSize, &job, 1, NULL, 1) != pdPASS) {
+    out.printf("%s,%s,%u,%u,0,0,0,0\n", name, current->name, current->length, (unsigned)bytes);
+    return;
+  }
+  xSemaphoreTake(done, portMAX_DELAY);
+  out.printf(
+    "%s,%s,%u,%u,%u,%u,%d,%u\n", name, current->name, current->length, (unsigned)bytes,
+    job.iterations, job.nsPerOp, job.heapBytes, job.peakStack
+  );
+}
+
+// Fills the matcher with jittered copies of the corpus, as a library of
+// similar remotes would look.
+static void fillIndex() {
+  static irbench::Capture variant;
+  char name[IRCodeIndex::kMaxNameLength + 1];
+  benchIndex.begin(kBenchIndexSize, kTolerancePercentage);
+  for (uint16_t i = 0; i < kBenchIndexSize; i++) {
+    const irbench::Capture &base = corpus[i % 4];
+    irbench::makeVariant(variant, base, 10, i * 2654435761u);
+    snprintf(name, sizeof(name), "%s_%u", base.name, i);
+    benchIndex.add(name, irbench::rawCode(variant));
+  }
+}
+
+void runIRBenchmarks(Print &out) {
+  irbench::makeNec(corpus[0]);
+  irbench::makeSamsung(corpus[1]);
+  irbench::makeKelvinator(corpus[2]);
+  irbench::makeDaikin(corpus[3]);
+  fillIndex();
+
+  SemaphoreHandle_t done = xSemaphoreCreateBinary();
+  out.printf(
+    "# ir-bench,%u,%s,%u\n", kBenchFormatVersion, _IRREMOTEESP8266_VERSION_STR,
+    getCpuFrequencyMhz()
+  );
+  out.println("bench,capture,entries,bytes,iterations,ns_per_op,heap_bytes,peak_stack");
+  for (const irbench::Capture &capture : corpus) {
+    current = &capture;
+    // The parse and decode benchmarks read what the write and encode ones
+    // produced.
+    BufferPrint text(textBuffer, sizeof(textBuffer));
+    IRController::writeText(text, capture.timings, capture.length);
+    textLength = text.length();
+    recordLength = irrecord::encode(irbench::rawCode(capture), recordBuffer, sizeof(recordBuffer));
+    BufferPrint packed((char *)packedBuffer, sizeof(packedBuffer));
+    packedLength = sdcompress::compress(recordBuffer, recordLength, packed);
+    // A record too large for one datagram gives an empty frame; its rows
+    // then time the rejection.
+    frameLength = udpproto::encodeFrame(frameBuffer, sizeof(frameBuffer), udpproto::OP_SEND, 1,
+                                        recordBuffer, recordLength);
+
+    runBenchmark(out, "text_write", benchTextWrite, textLength, done);
+    runBenchmark(out, "text_parse", benchTextParse, textLength, done);
+    runBenchmark(out, "record_encode", benchRecordEncode, recordLength, done);
+    runBenchmark(out, "record_decode", benchRecordDecode, recordLength, done);
+    // Compare lz_decompress with the time the card takes to read the bytes
+    // compression saves (record_encode bytes - lz_compress bytes).
+    runBenchmark(out, "lz_compress", benchCompress, packedLength, done);
+    runBenchmark(out, "lz_decompress", benchDecompress, recordLength, done);
+    // The UDP frame check is dominated by the CRC, so the record stands in
+    // for a payload of its size.
+    runBenchmark(out, "frame_encode", benchFrameEncode, frameLength, done);
+    runBenchmark(out, "frame_parse", benchFrameParse, frameLength, done);
+    runBenchmark(out, "trim_repeats", benchTrimRepeats, 0, done);
+    runBenchmark(out, "index_match", benchIndexMatch, 0, done);
+  }
+  out.println("# ir-bench done");
+  vSemaphoreDelete(done);
+}
+
+// Benchmark builds run this in place of src/main.cpp, see platformio.ini.
+void setup() {
+  Serial.begin(kBaudRate);
+  runIRBenchmarks(Serial);
+}
+
+void loop() {
+  delay(1000);
+}
+
+#endif  // IR_BENCHMARK
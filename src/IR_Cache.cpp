@@ -0,0 +1,141 @@
+// IR_Cache.cpp
+#include <IR_Cache.h>
+#include <string.h>
+
+// FNV-1a, only used to skip most strcmp() calls during lookups.
+static uint32_t hashName(const char *name) {
+  uint32_t hash = 2166136261u;
+  while (*name) {
+    hash = (hash ^ (uint8_t)*name++) * 16777619u;
+  }
+  return hash;
+}
+
+IRCodeCache::IRCodeCache(uint16_t *arena, size_t budgetBytes)
+    : arena(arena), capacity(budgetBytes / sizeof(uint16_t)) {}
+
+bool IRCodeCache::lookup(const char *name, irrecord::IRCode &code) {
+  int8_t index = find(name, hashName(name));
+  if (index < 0) {
+    missCount++;
+    return false;
+  }
+
+  hitCount++;
+  unlink(index);
+  pushFront(index);
+
+  code = entries[index].code;
+  if (code.isRaw()) {
+    code.timings = arena + entries[index].offset;
+  } else {
+    code.bytes = (const uint8_t *)(arena + entries[index].offset);
+  }
+  return true;
+}
+
+bool IRCodeCache::insert(const char *name, const irrecord::IRCode &code) {
+  uint32_t hash = hashName(name);
+  invalidate(name);
+
+  // Protocol bytes are rounded up to whole arena words.
+  size_t words = code.isRaw() ? code.length : (code.length + 1) / 2;
+  if (strlen(name) > kMaxNameLength || words > capacity) {
+    return false;
+  }
+
+  // Make room by dropping the least recently used codes.
+  while (count == kMaxEntries || used + words > capacity) {
+    remove(tail);
+    evictionCount++;
+  }
+
+  int8_t index = 0;
+  while (inUse[index]) {
+    index++;
+  }
+
+  Entry &entry = entries[index];
+  strcpy(entry.name, name);
+  entry.hash = hash;
+  entry.offset = used;
+  entry.words = words;
+  entry.code = code;
+  if (code.isRaw()) {
+    memcpy(arena + used, code.timings, code.length * sizeof(uint16_t));
+  } else {
+    memcpy(arena + used, code.bytes, code.length);
+  }
+  used += words;
+
+  inUse[index] = true;
+  count++;
+  pushFront(index);
+  return true;
+}
+
+void IRCodeCache::invalidate(const char *name) {
+  int8_t index = find(name, hashName(name));
+  if (index >= 0) {
+    remove(index);
+  }
+}
+
+void IRCodeCache::clear() {
+  memset(inUse, 0, sizeof(inUse));
+  head = tail = -1;
+  count = 0;
+  used = 0;
+}
+
+int8_t IRCodeCache::find(const char *name, uint32_t hash) const {
+  for (int8_t i = 0; i < kMaxEntries; i++) {
+    if (inUse[i] && entries[i].hash == hash && strcmp(entries[i].name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void IRCodeCache::unlink(int8_t index) {
+  Entry &entry = entries[index];
+  if (entry.prev >= 0) {
+    entries[entry.prev].next = entry.next;
+  } else {
+    head = entry.next;
+  }
+  if (entry.next >= 0) {
+    entries[entry.next].prev = entry.prev;
+  } else {
+    tail = entry.prev;
+  }
+}
+
+void IRCodeCache::pushFront(int8_t index) {
+  entries[index].prev = -1;
+  entries[index].next = head;
+  if (head >= 0) {
+    entries[head].prev = index;
+  }
+  head = index;
+  if (tail < 0) {
+    tail = index;
+  }
+}
+
+void IRCodeCache::remove(int8_t index) {
+  unlink(index);
+  inUse[index] = false;
+  count--;
+
+  // Close the gap so free space is always one block at the end.
+  size_t offset = entries[index].offset;
+  size_t words = entries[index].words;
+  memmove(arena + offset, arena + offset + words, (used - offset - words) * sizeof(uint16_t));
+  used -= words;
+  for (int8_t i = 0; i < kMaxEntries; i++) {
+    if (inUse[i] && entries[i].offset > offset) {
+      entries[i].offset -= words;
+    }
+  }
+}
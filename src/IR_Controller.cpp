@@ -23,31 +23,167 @@ void IRController::begin() {
   irrecv.setTolerance(kTolerancePercentage);  // Override the default tolerance.
 
   if(!sd.init()) {
+    events.log(eventlog::EVENT_SD_INIT_FAILED);
 #ifdef EASYDEBUG
     Serial.println("SD Card faild to initialize...!");
 #endif
+  } else if (!store.begin(kCodeStoreSlots)) {
+    events.log(eventlog::EVENT_STORE_MOUNT_FAILED);
+#ifdef EASYDEBUG
+    Serial.println("Code store failed to mount, saving one file per code.");
+#endif
+  }
+
+  storageMutex = xSemaphoreCreateMutex();
+  transmitMutex = xSemaphoreCreateMutex();
+  receiverMutex = xSemaphoreCreateMutex();
+
+  // Fingerprint the stored codes once, so captures can be matched against
+  // the library without going back to the card.
+  if (index.begin(kMatchIndexCapacity, kTolerancePercentage)) {
+    xSemaphoreTake(storageMutex, portMAX_DELAY);
+    sd.listFiles("/", indexFile, this);
+    // Listed last, so stored codes win over stray files of the same name.
+    store.list(indexFile, this);
+    xSemaphoreGive(storageMutex);
+  }
+#ifdef EASYDEBUG
+  Serial.printf("Code index: %u/%u codes\n", index.size(), index.capacity());
+#endif
+
+  // Drain the receiver in the background so captures are not lost while the
+  // main loop is blocked.
+  xTaskCreatePinnedToCore(
+    captureTask, "IRCapture", kCaptureTaskStackSize, this,
+    kCaptureTaskPriority, NULL, kCaptureTaskCore
+  );
+
+  // Serve sendAsync() requests.
+  sendQueues[SEND_NORMAL] = xQueueCreate(kSendQueueLength, sizeof(SendRequest));
+  sendQueues[SEND_INTERACTIVE] = xQueueCreate(kSendQueueLength, sizeof(SendRequest));
+  pendingSends = xSemaphoreCreateCounting(2 * kSendQueueLength, 0);
+  xTaskCreatePinnedToCore(
+    transmitTask, "IRTransmit", kTransmitTaskStackSize, this,
+    kTransmitTaskPriority, NULL, kTransmitTaskCore
+  );
+
+  // Save captures, load scenes and write the event log off the loop.
+  storageQueueMutex = xSemaphoreCreateMutex();
+  storageWork = xSemaphoreCreateCounting(kStorageQueueLength, 0);
+  xTaskCreatePinnedToCore(
+    storageTask, "IRStorage", kStorageTaskStackSize, this,
+    kStorageTaskPriority, NULL, kStorageTaskCore
+  );
+}
+
+void IRController::storageTask(void *param) {
+  IRController *controller = (IRController *)param;
+  for (;;) {
+    if (xSemaphoreTake(controller->storageWork, pdMS_TO_TICKS(kEventFlushPollMs)) == pdTRUE) {
+      controller->serveStorage();
+    }
+    if (events.flushDue()) {
+      xSemaphoreTake(controller->storageMutex, portMAX_DELAY);
+      events.flush(controller->sd);
+      xSemaphoreGive(controller->storageMutex);
+    }
+  }
+}
+
+void IRController::transmitTask(void *param) {
+  IRController *controller = (IRController *)param;
+  SendRequest request;
+  for (;;) {
+    xSemaphoreTake(controller->pendingSends, portMAX_DELAY);
+
+    // Interactive requests always go ahead of queued bulk replays.
+    if (xQueueReceive(controller->sendQueues[SEND_INTERACTIVE], &request, 0) != pdTRUE &&
+        xQueueReceive(controller->sendQueues[SEND_NORMAL], &request, 0) != pdTRUE) {
+      continue;
+    }
+
+    // sendAsync() keeps a slot free for every result, the wait is only a
+    // backstop: a result must never be lost, a scene waits for it.
+    SendResult result = { request.ticket, controller->send(request.name) };
+    while (!controller->completions.push(result)) {
+      vTaskDelay(1);
+    }
+  }
+}
+
+void IRController::captureTask(void *param) {
+  IRController *controller = (IRController *)param;
+  for (;;) {
+    controller->pollReceiver();
+    controller->compactStore();
+    vTaskDelay(pdMS_TO_TICKS(kCapturePollMs));
+  }
+}
+
+void IRController::compactStore() {
+  // Reclaim space from replaced codes one entry at a time, while nothing is
+  // being captured, so the storage is never held for long.
+  if (reading) {
+    return;
   }
+  xSemaphoreTake(storageMutex, portMAX_DELAY);
+  store.compactStep();
+  xSemaphoreGive(storageMutex);
 }
 
-void IRController::read(const char* fileName) {
-  // Check if the IR code has been received.
-  if (irrecv.decode(&results)) {
-    // Convert the results into an array suitable for sendRaw().
-    // resultToRawArray() allocates the memory we need for the array.
-    uint16_t *raw_array = resultToRawArray(&results);
-    // Find out how many elements are in the array.
-    uint16_t length = getCorrectedRawLength(&results);
+void IRController::pollReceiver() {
+  if (!reading) {
+    return;
+  }
+
+  xSemaphoreTake(receiverMutex, portMAX_DELAY);
+  bool received = irrecv.decode(&results);
+  xSemaphoreGive(receiverMutex);
+  if (!received) {
+    return;
+  }
 
-    char text[3072];
-    makeText(raw_array, length, text);
+  IRCapture *capture = captures.reserve();
+  if (capture == nullptr) {
+    return;  // read() is not keeping up, the drop is counted by the queue.
+  }
+
+  // Converted straight into the queue slot, no heap copy as with
+  // resultToRawArray().
+  bool overflow;
+  uint16_t length = irrecord::ticksToTimings(results.rawbuf, results.rawlen, kRawTick,
+                                             capture->timings, kCaptureBufferSize, overflow);
+  overflow = overflow || results.overflow;
+  if (overflow) {
+    overflowCount++;
+    events.log(eventlog::EVENT_CAPTURE_OVERFLOW, length, kCaptureBufferSize);
+  }
+
+  capture->result = results;
+  capture->result.rawbuf = nullptr;
+  capture->result.rawlen = 0;
+  capture->result.overflow = overflow;
+  capture->length = length;
+  capture->timestamp = millis();
+  captures.commit();
+}
+
+void IRController::read(const char* fileName, StorageResult *saved) {
+  // Check if the capture task has a finished IR code for us.
+  IRCapture *capture = captures.front();
+  if (capture != nullptr) {
+    const decode_results &result = capture->result;
+    uint16_t *raw_array = capture->timings;
+    uint16_t length = capture->length;
+    events.log(eventlog::EVENT_CAPTURE, length, result.decode_type);
 
 #ifdef EASYDEBUG
     // Display a crude timestamp.
-    uint32_t now = millis();
+    uint32_t now = capture->timestamp;
     Serial.printf(D_STR_TIMESTAMP " : %06u.%03u\n", now / 1000, now % 1000);
 
     // Check if we got an IR message that was to big for our capture buffer.
-    if (results.overflow)
+    if (result.overflow)
         Serial.printf(D_WARN_BUFFERFULL "\n", kCaptureBufferSize);
 
     // Display the library version the message was captured with.
@@ -58,79 +194,169 @@ void IRController::read(const char* fileName) {
         Serial.printf(D_STR_TOLERANCE " : %d%%\n", kTolerancePercentage);
 
     // Display the basic output of what we found.
-    Serial.print(resultToHumanReadableBasic(&results));
+    Serial.print(resultToHumanReadableBasic(&result));
 
     // Display any extra A/C info if we have it.
-    String description = IRAcUtils::resultAcToString(&results);
+    String description = IRAcUtils::resultAcToString(&result);
     if (description.length())
         Serial.println(D_STR_MESGDESC ": " + description);
 
     yield(); // Feed the WDT as the text output can take a while to print.
 
-#if LEGACY_TIMING_INFO
-    // Output legacy RAW timing info of the result.
-    Serial.println(resultToTimingInfo(&results));
-    yield();  // Feed the WDT (again)
-#endif  // LEGACY_TIMING_INFO
-
     Serial.print("Test output : ");
-    Serial.println(text);
-
-    // Output the results as source code
-    Serial.println(resultToSourceCode(&results));
+    writeText(Serial, raw_array, length);
+    Serial.println();
 
     Serial.println();    // Blank line between entries
 #endif
 
-    sd.createAndSaveFile(("/" + std::string(fileName)).c_str(), text);
+    // Describe the code the way it will be stored. Recognised protocols are
+    // stored by value, they replay exactly and take a few bytes. Everything
+    // else, and every code in text mode, is kept as raw timings.
+    irrecord::IRCode code;
+    uint8_t value[sizeof(result.value)];
+    if (!kStoreCodesAsText && isReplayable(result)) {
+      code.protocol = result.decode_type;
+      code.bits = result.bits;
+      if (hasACState(result.decode_type)) {
+        code.bytes = result.state;
+        code.length = result.bits / 8;
+      } else {
+        for (uint8_t i = 0; i < sizeof(value); i++) {
+          value[i] = result.value >> (8 * i);
+        }
+        code.bytes = value;
+        code.length = (result.bits + 7) / 8;
+      }
+    } else {
+      code.frequency = kFrequency;
+      code.timings = raw_array;
+      code.length = length;
+      if (!kStoreCodesAsText && kTrimRepeats &&
+          irrecord::trimRepeats(code, kTolerancePercentage, kMinRepeatGap)) {
+#ifdef EASYDEBUG
+        Serial.printf(
+          "Repeated frames : %d entries, %d repeats, %u us gap\n",
+          code.length, code.repeats, code.gap
+        );
+#endif
+      }
+    }
+
+    // Compare against the library before this capture replaces anything.
+    matchCount = index.findNearest(code, matches, kMatchResults, kMinMatchScore, fileName);
+#ifdef EASYDEBUG
+    for (uint8_t i = 0; i < matchCount; i++) {
+      Serial.printf("Resembles : %s (%d%%)\n", matches[i].name, matches[i].score);
+    }
+#endif
+
+    // Hand the code to the storage task so a slow card does not hold up the
+    // loop. Text is formatted on the storage task, from a copy of the timings.
+    StorageOperation operation = kStoreCodesAsText ? SAVE_TEXT : SAVE_RECORD;
+    StorageRequest *request = reserveStorage(operation, fileName, saved);
+    if (request != nullptr) {
+      if (kStoreCodesAsText) {
+        request->length = length * sizeof(uint16_t);
+        memcpy(request->data, raw_array, request->length);
+      } else {
+        request->length = irrecord::encode(code, request->data, sizeof(request->data));
+      }
+      commitStorage(*request);
+    } else {
+      // The storage task is backed up, save it here rather than lose it, and
+      // make sure an older save or delete still in the queue does not undo it.
+      if (storageQueueMutex != NULL) {
+        xSemaphoreTake(storageQueueMutex, portMAX_DELAY);
+        dropPending(fileName);
+        xSemaphoreGive(storageQueueMutex);
+      }
+      xSemaphoreTake(storageMutex, portMAX_DELAY);
+      bool stored = kStoreCodesAsText
+        ? saveText(fileName, raw_array, length)
+        : saveRecord(fileName, fileBuffer, irrecord::encode(code, fileBuffer, sizeof(fileBuffer)));
+      cache.invalidate(fileName);
+      xSemaphoreGive(storageMutex);
+      if (!stored) {
+        events.log(eventlog::EVENT_STORAGE_FAILED, operation, length);
+      }
+      if (saved != nullptr) {
+        saved->status = stored ? STORAGE_OK : STORAGE_FAILED;
+        saved->done = true;
+      }
+    }
+    index.add(fileName, code);
     codeReceived = true;
+
+    // Hand the slot back to the capture task.
+    captures.pop();
     yield();             // Feed the WDT (again)
   }
 }
 
-void IRController::send(const char* fileName) {
-  char* text = sd.readFile(("/" + std::string(fileName)).c_str());
-
-  // Convert the results into an array suitable for sendRaw().
-  // resultToRawArray() allocates the memory we need for the array.
-  uint16_t *raw_array;
-
-  // Find out how many elements are in the array.
-  uint16_t length;
-  length = makeArrayFromText(raw_array, text);
+bool IRController::send(const char* fileName) {
+  // One transmission at a time, the code is staged in txTimings/txBytes.
+  xSemaphoreTake(transmitMutex, portMAX_DELAY);
+  irrecord::IRCode code;
+  if (!fetchCode(fileName, code)) {
+    xSemaphoreGive(transmitMutex);
+    events.log(eventlog::EVENT_SEND_FAILED, 0);
+    return false;
+  }
 
 #ifdef EASYDEBUG
-  Serial.print("Send Test output : ");
-  for (int i = 0; i < length; i++) {
-    Serial.print(raw_array[i]);
+  if (code.isRaw()) {
+    Serial.print("Send Test output : ");
+    writeText(Serial, code.timings, code.length);
+    Serial.println();
+  } else {
+    Serial.printf(
+      "Send protocol : %s, %d bits\n",
+      typeToString((decode_type_t)code.protocol).c_str(), code.bits
+    );
   }
-  Serial.println();
 #endif
 
-  // Send it out via the IR LED circuit.
-  irsend.sendRaw(raw_array, length, kFrequency);
+  // Send it out via the IR LED circuit. The capture task is held off while
+  // we transmit so it does not capture our own message.
+  xSemaphoreTake(receiverMutex, portMAX_DELAY);
+  bool sent = transmit(code);
 
   // Resume capturing IR messages. It was not restarted until after we sent
   // the message so we didn't capture our own message.
   if(isReading())
     irrecv.resume();
-
-  // Deallocate the memory allocated by resultToRawArray().
-  free(raw_array);
+  xSemaphoreGive(receiverMutex);
+  xSemaphoreGive(transmitMutex);
+  if (sent) {
+    events.log(eventlog::EVENT_SEND, code.length, code.isRaw() ? UINT32_MAX : code.protocol);
+  } else {
+    events.log(eventlog::EVENT_SEND_FAILED, 1);
+  }
 
 #ifdef EASYDEBUG
   // Display a crude timestamp & notification.
   uint32_t now = millis();
   Serial.printf(
     "%06u.%03u: A message that was %d entries long was retransmitted.\n",
-    now / 1000, now % 1000, length
+    now / 1000, now % 1000, code.length
+  );
+  Serial.printf(
+    "Code cache: %u hits, %u misses, %u evictions, %u/%u bytes\n",
+    cache.hits(), cache.misses(), cache.evictions(),
+    (unsigned)cache.bytesUsed(), (unsigned)cache.budget()
   );
 #endif
 
   yield();  // Or delay(milliseconds); This ensures the ESP doesn't WDT reset.
+  return sent;
 }
 
 void IRController::start() {
+  // Captures still queued from before, e.g. repeat frames of a held button,
+  // must not be taken for the code being learned. The loop is the consumer,
+  // and the capture task adds nothing while `reading` is false.
+  captures.clear();
   irrecv.enableIRIn();  // Start the receiver
   reading = true;
 }
@@ -140,34 +366,490 @@ void IRController::stop() {
   reading = false;
 }
 
-void IRController::makeText(uint16_t *raw_array, uint16_t length, char* text) {
-  // Create the text array
-  sprintf(text, "raw_array:[");
-  for (int i = 0; i < length; i++) {
-    sprintf(text + strlen(text), "%d", raw_array[i]);
-    if (i != length - 1) {
-      sprintf(text + strlen(text), ",");
+static size_t printTo(const uint8_t *data, size_t length, void *context) {
+  return ((Print *)context)->write(data, length);
+}
+
+size_t IRController::writeText(Print &out, const uint16_t *raw_array, uint16_t length) {
+  return irrecord::writeText(raw_array, length, printTo, &out);
+}
+
+uint32_t IRController::sendAsync(const char* fileName, SendPriority priority) {
+  if (pendingSends == NULL || strlen(fileName) > IRCodeCache::kMaxNameLength ||
+      sendsInFlight >= kCompletionSlots) {
+    return 0;
+  }
+
+  SendRequest request;
+  do {
+    request.ticket = nextTicket++;
+  } while (request.ticket == 0);  // 0 is reserved for rejected requests.
+  strcpy(request.name, fileName);
+
+  sendsInFlight++;
+  if (xQueueSendToBack(sendQueues[priority], &request, 0) != pdTRUE) {
+    sendsInFlight--;
+    return 0;
+  }
+  xSemaphoreGive(pendingSends);
+  return request.ticket;
+}
+
+bool IRController::nextCompletion(SendResult &result) {
+  SendResult *next = completions.front();
+  if (next == nullptr) {
+    return false;
+  }
+  result = *next;
+  completions.pop();
+  sendsInFlight--;
+  return true;
+}
+
+bool IRController::hasPendingWork() {
+  // storageCount only shrinks behind the loop's back, a stale value costs
+  // one more poll.
+  return sendsInFlight != 0 || completions.front() != nullptr || storageCount != 0 || reading;
+}
+
+bool IRController::remove(const char* fileName, StorageResult *result) {
+  StorageRequest *request = reserveStorage(REMOVE_CODE, fileName, result);
+  if (request == nullptr) {
+    return false;
+  }
+  index.remove(fileName);
+  commitStorage(*request);
+  return true;
+}
+
+bool IRController::loadFileAsync(const char* path, uint8_t* buffer, size_t capacity, StorageResult &result) {
+  StorageRequest *request = reserveStorage(READ_FILE, path, &result);
+  if (request == nullptr) {
+    return false;
+  }
+  request->buffer = buffer;
+  request->length = capacity;
+  commitStorage(*request);
+  return true;
+}
+
+bool IRController::eraseCard(StorageResult &result) {
+  StorageRequest *request = reserveStorage(ERASE_CARD, "/", &result);
+  if (request == nullptr) {
+    return false;
+  }
+  // Codes saved by requests already waiting go with the rest of the card,
+  // later ones are added back as they are read.
+  index.clear();
+  commitStorage(*request);
+  return true;
+}
+
+IRController::StorageRequest *IRController::reserveStorage(StorageOperation operation, const char* name, StorageResult *result) {
+  if (storageWork == NULL || strlen(name) >= kMaxPathLength) {
+    return nullptr;
+  }
+
+  // The loop is the only producer, so the slot past the last request stays
+  // free until commitStorage() hands it over.
+  xSemaphoreTake(storageQueueMutex, portMAX_DELAY);
+  stats.depth[storageCount]++;
+  bool full = storageCount == kStorageQueueLength;
+  StorageRequest &request = storageQueue[(storageHead + storageCount) % kStorageQueueLength];
+  xSemaphoreGive(storageQueueMutex);
+  if (full) {
+    stats.rejected++;
+    return nullptr;
+  }
+
+  request.operation = operation;
+  request.started = false;
+  request.superseded = false;
+  strcpy(request.name, name);
+  request.buffer = nullptr;
+  request.length = 0;
+  request.result = result;
+  if (result != nullptr) {
+    result->status = STORAGE_PENDING;
+    result->length = 0;
+    result->done = false;
+  }
+  return &request;
+}
+
+void IRController::commitStorage(StorageRequest &request) {
+  request.queuedAt = millis();
+  xSemaphoreTake(storageQueueMutex, portMAX_DELAY);
+  if (request.operation != READ_FILE && request.operation != ERASE_CARD) {
+    supersedePending(request.name);
+  }
+  storageCount++;
+  xSemaphoreGive(storageQueueMutex);
+  xSemaphoreGive(storageWork);
+}
+
+void IRController::supersedePending(const char* fileName) {
+  // Back to back saves of the same code, e.g. learning a button again, only
+  // write the last one. A delete also makes a waiting save pointless.
+  // Called with storageQueueMutex held.
+  StorageRequest *previous = findPending(fileName);
+  if (previous == nullptr || previous->started ||
+      (previous->operation != SAVE_RECORD && previous->operation != SAVE_TEXT)) {
+    return;
+  }
+  supersede(*previous);
+}
+
+void IRController::dropPending(const char* fileName) {
+  // A code saved right away is newer than every request still waiting for
+  // it, deletes included. Requests run in order, so once the newest one has
+  // started the older ones are done. Called with storageQueueMutex held.
+  StorageRequest *previous;
+  while ((previous = findPending(fileName)) != nullptr && !previous->started) {
+    supersede(*previous);
+  }
+}
+
+void IRController::supersede(StorageRequest &request) {
+  request.superseded = true;
+  stats.coalesced++;
+  if (request.result != nullptr) {
+    request.result->status = STORAGE_SUPERSEDED;
+    request.result->done = true;
+  }
+}
+
+IRController::StorageRequest *IRController::findPending(const char* fileName) {
+  // Newest first, so the request that will decide the code's fate wins.
+  // Called with storageQueueMutex held.
+  for (uint8_t i = storageCount; i > 0; i--) {
+    StorageRequest &request = storageQueue[(storageHead + i - 1) % kStorageQueueLength];
+    if (request.operation != READ_FILE && request.operation != ERASE_CARD && !request.superseded &&
+        strcmp(request.name, fileName) == 0) {
+      return &request;
+    }
+  }
+  return nullptr;
+}
+
+// Log2 bucket of a duration, see StorageStats.
+static uint8_t timeBucket(uint32_t ms) {
+  uint8_t bucket = 0;
+  while (ms != 0 && bucket < StorageStats::kBuckets - 1) {
+    ms >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+void IRController::serveStorage() {
+  xSemaphoreTake(storageQueueMutex, portMAX_DELAY);
+  StorageRequest &request = storageQueue[storageHead];
+  request.started = true;
+  xSemaphoreGive(storageQueueMutex);
+
+  // Superseded requests were already reported to their caller.
+  if (!request.superseded) {
+    uint32_t start = millis();
+    size_t length = 0;
+    bool done;
+    if (request.operation == ERASE_CARD) {
+      done = runErase(length);
+    } else {
+      xSemaphoreTake(storageMutex, portMAX_DELAY);
+      done = runStorage(request, length);
+      xSemaphoreGive(storageMutex);
+    }
+
+    uint32_t now = millis();
+    stats.service[timeBucket(now - start)]++;
+    stats.latency[timeBucket(now - request.queuedAt)]++;
+    if (!done) {
+      events.log(eventlog::EVENT_STORAGE_FAILED, request.operation, request.length);
+    } else if (now - start >= kSlowStorageMs) {
+      events.log(eventlog::EVENT_STORAGE_SLOW, request.operation, now - start);
+    }
+#ifdef EASYDEBUG
+    if (!done) {
+      Serial.printf("Storage request for %s failed.\n", request.name);
+    }
+#endif
+    if (request.result != nullptr) {
+      request.result->status = done ? STORAGE_OK : STORAGE_FAILED;
+      request.result->length = length;
+      request.result->done = true;
+    }
+  }
+
+  // Only now is the code on the card, until then send() reads it from here.
+  xSemaphoreTake(storageQueueMutex, portMAX_DELAY);
+  storageHead = (storageHead + 1) % kStorageQueueLength;
+  storageCount--;
+  xSemaphoreGive(storageQueueMutex);
+}
+
+bool IRController::runStorage(StorageRequest &request, size_t &length) {
+  // Called by the storage task with storageMutex held.
+  bool done = false;
+  switch (request.operation) {
+    case SAVE_RECORD:
+      done = saveRecord(request.name, request.data, request.length);
+      break;
+    case SAVE_TEXT:
+      done = saveText(request.name, (const uint16_t *)request.data, request.length / sizeof(uint16_t));
+      break;
+    case REMOVE_CODE:
+      done = removeCode(request.name);
+      break;
+    case READ_FILE:
+      return sd.readFile(request.name, request.buffer, request.length, length);
+    case ERASE_CARD:  // Not run under storageMutex, see runErase().
+      return false;
+  }
+  // Drop any cached copy of a code that was replaced or removed.
+  cache.invalidate(request.name);
+  return done;
+}
+
+bool IRController::runErase(size_t &erased) {
+  // Called by the storage task. storageMutex is given back after every
+  // batch, so sends and compaction only ever wait for one; the code store is
+  // closed first, as it keeps the log open.
+  xSemaphoreTake(storageMutex, portMAX_DELAY);
+  store.end();
+  EraseStatus status = sd.beginErase("/") ? ERASE_RUNNING : ERASE_FAILED;
+  xSemaphoreGive(storageMutex);
+  while (status == ERASE_RUNNING) {
+    vTaskDelay(1);  // Let the other tasks at the card, and the idle task feed the watchdog.
+    xSemaphoreTake(storageMutex, portMAX_DELAY);
+    status = sd.eraseStep(kEraseBatch);
+    xSemaphoreGive(storageMutex);
+  }
+
+  // Forget everything that mirrored the card, whether or not it is all gone.
+  xSemaphoreTake(storageMutex, portMAX_DELAY);
+  erased = sd.erasedEntries();
+  cache.clear();
+  events.forgetFile();
+  bool mounted = store.begin(kCodeStoreSlots);
+  xSemaphoreGive(storageMutex);
+  if (!mounted) {
+    events.log(eventlog::EVENT_STORE_MOUNT_FAILED);
+  }
+  return status == ERASE_DONE;
+}
+
+bool IRController::saveRecord(const char* fileName, const uint8_t* data, size_t length) {
+  char path[kMaxPathLength];
+  makePath(path, fileName);
+  if (!store.put(fileName, data, length, kCompressCodes)) {
+    return sd.createAndSaveFile(path, data, length);
+  }
+  if (sd.fileExists(path)) {
+    sd.removeFile(path);  // Would otherwise come back if the store is lost.
+  }
+  return true;
+}
+
+bool IRController::saveText(const char* fileName, const uint16_t* timings, uint16_t length) {
+  // Stream the text straight into the file, no intermediate buffer.
+  char path[kMaxPathLength];
+  makePath(path, fileName);
+  File file = sd.openFile(path, FILE_WRITE);
+  if (!file) {
+    return false;
+  }
+  writeText(file, timings, length);
+  file.close();
+  return true;
+}
+
+bool IRController::removeCode(const char* fileName) {
+  char path[kMaxPathLength];
+  makePath(path, fileName);
+  bool removed = store.contains(fileName) && store.remove(fileName);
+  if (sd.fileExists(path)) {
+    removed = sd.removeFile(path) || removed;
+  }
+  return removed;
+}
+
+bool IRController::fetchCode(const char* fileName, irrecord::IRCode &code) {
+  // Serve the code from RAM if it was sent recently, otherwise decode the
+  // stored code into timingBuffer and remember it.
+  xSemaphoreTake(storageMutex, portMAX_DELAY);
+  bool found;
+  if (!loadPending(fileName, code, found)) {
+    found = cache.lookup(fileName, code);
+    if (!found && loadCode(fileName, code)) {
+      cache.insert(fileName, code);
+      found = true;
     }
   }
-  sprintf(text + strlen(text), "]\0 ");
+
+  // Stage a private copy so the storage is not locked during the transmit.
+  if (found && code.isRaw()) {
+    memcpy(txTimings, code.timings, code.length * sizeof(uint16_t));
+    code.timings = txTimings;
+  } else if (found) {
+    memcpy(txBytes, code.bytes, code.length);
+    code.bytes = txBytes;
+  }
+  xSemaphoreGive(storageMutex);
+  return found;
 }
 
-uint16_t IRController::makeArrayFromText(uint16_t* &rawCode, char *text) {
-  // Convert the text array back to raw_array and length
-  char* raw_array_start = strstr(text, "raw_array:[") + strlen("raw_array:[");
-  char* raw_array_end = strstr(raw_array_start, "]");
-  *raw_array_end = '\0';  // Terminate the string at the end of the raw_array
+bool IRController::loadPending(const char* fileName, irrecord::IRCode &code, bool &found) {
+  // A code the storage task has not saved or removed yet is newer than the
+  // card and the cache. Called with storageMutex held.
+  found = false;
+  if (storageQueueMutex == NULL) {
+    return false;
+  }
+  xSemaphoreTake(storageQueueMutex, portMAX_DELAY);
+  StorageRequest *request = findPending(fileName);
+  StorageOperation operation = request != nullptr ? request->operation : REMOVE_CODE;
+  size_t size = 0;
+  if (operation == SAVE_RECORD) {
+    size = request->length;
+    memcpy(fileBuffer, request->data, size);
+  } else if (operation == SAVE_TEXT) {
+    size = request->length / sizeof(uint16_t);
+    memcpy(timingBuffer, request->data, request->length);
+  }
+  xSemaphoreGive(storageQueueMutex);
+
+  if (request == nullptr) {
+    return false;
+  }
+  if (operation == SAVE_RECORD) {
+    found = decodeRecord(fileName, size, code);
+  } else if (operation == SAVE_TEXT) {
+    code = irrecord::IRCode();
+    code.frequency = kFrequency;
+    code.timings = timingBuffer;
+    code.length = size;
+    found = code.length != 0;
+  }
+  return true;
+}
 
-  // Allocate memory for the rawCode
-  rawCode = (uint16_t *)malloc(sizeof(uint16_t) * (raw_array_end - raw_array_start + 1));
+bool IRController::loadCode(const char* fileName, irrecord::IRCode &code) {
+  size_t size;
+  if (store.get(fileName, fileBuffer, sizeof(fileBuffer), size)) {
+    return decodeRecord(fileName, size, code);
+  }
+
+  // Codes saved by older firmware, or as text, have a file of their own.
+  char path[kMaxPathLength];
+  makePath(path, fileName);
+  SDReader reader = sd.openReader(path);
+  size = reader.read(fileBuffer, sizeof(fileBuffer));
+  if (irrecord::isRecord(fileBuffer, size)) {
+    bool complete = reader.remaining() == 0;
+    reader.close();
+    if (!complete) {
+#ifdef EASYDEBUG
+      Serial.printf("Stored code %s is too large.\n", fileName);
+#endif
+      return false;
+    }
+    return decodeRecord(fileName, size, code);
+  }
+
+  // Text is parsed as it streams in, a chunk at a time through fileBuffer,
+  // so it may be larger than the buffer.
+  irrecord::TextParser parser(timingBuffer, kCaptureBufferSize);
+  irrecord::ParseStatus status = irrecord::PARSE_MORE;
+  while (status == irrecord::PARSE_MORE && size > 0) {
+    status = parser.feed((const char *)fileBuffer, size);
+    size = reader.read(fileBuffer, sizeof(fileBuffer));
+  }
+  bool opened = reader.isOpen();
+  reader.close();
+  status = parser.finish();
+  if (!opened || status != irrecord::PARSE_OK) {
+#ifdef EASYDEBUG
+    if (!opened) {
+      Serial.printf("Stored code %s is missing.\n", fileName);
+    } else {
+      Serial.printf(
+        "Stored code %s is invalid: %s at offset %u\n",
+        fileName, irrecord::toString(status), (unsigned)parser.errorOffset()
+      );
+    }
+#endif
+    return false;
+  }
+  code = irrecord::IRCode();
+  code.frequency = kFrequency;
+  code.timings = timingBuffer;
+  code.length = parser.count();
+  return code.length != 0;
+}
+
+bool IRController::decodeRecord(const char* fileName, size_t size, irrecord::IRCode &code) {
+  irrecord::RecordStatus status = irrecord::decode(
+    fileBuffer, size, timingBuffer, kCaptureBufferSize, code
+  );
+  if (status == irrecord::RECORD_OK && !code.isRaw() && code.length > kStateSizeMax) {
+    status = irrecord::RECORD_OVERFLOW;
+  }
+  if (status != irrecord::RECORD_OK) {
+#ifdef EASYDEBUG
+    Serial.printf("Stored code %s is invalid: %s\n", fileName, irrecord::toString(status));
+#endif
+    return false;
+  }
+  return code.length != 0;
+}
+
+bool IRController::transmit(const irrecord::IRCode &code) {
+  if (code.isRaw()) {
+    irsend.sendRaw(code.timings, code.length, code.frequency);
+    // Rebuild frames that were trimmed when the code was captured.
+    for (uint16_t i = 0; i < code.repeats; i++) {
+      irsend.space(code.gap);
+      irsend.sendRaw(code.timings, code.length, code.frequency);
+    }
+    return true;
+  }
+
+  decode_type_t protocol = (decode_type_t)code.protocol;
+  if (hasACState(protocol)) {
+    return irsend.send(protocol, code.bytes, code.length);
+  }
+
+  uint64_t value = 0;
+  for (uint16_t i = 0; i < code.length && i < sizeof(value); i++) {
+    value |= (uint64_t)code.bytes[i] << (8 * i);
+  }
+  return irsend.send(protocol, value, code.bits);
+}
+
+bool IRController::isReplayable(const decode_results &capture) {
+  // Repeat codes and overflowed captures do not carry the full message, so
+  // they are kept as raw timings.
+  if (capture.decode_type == UNKNOWN || capture.decode_type == UNUSED ||
+      capture.repeat || capture.overflow) {
+    return false;
+  }
+  if (hasACState(capture.decode_type)) {
+    return capture.bits % 8 == 0 && capture.bits / 8 <= kStateSizeMax;
+  }
+  return capture.bits <= 64;
+}
+
+void IRController::makePath(char *path, const char* fileName) {
+  snprintf(path, kMaxPathLength, "/%s", fileName);
+}
 
-  // Split the string into elements and convert them to integers
-  char* element = strtok(raw_array_start, ",");
-  int i = 0;
-  for (i; element != NULL; i++) {
-    rawCode[i] = atoi(element);
-    element = strtok(NULL, ",");
+void IRController::indexFile(const char* fileName, void *param) {
+  // Called by SDController::listFiles() and SDLogStore::list() with
+  // storageMutex held.
+  IRController *controller = (IRController *)param;
+  irrecord::IRCode code;
+  if (!SDLogStore::isStoreFile(fileName) && controller->loadCode(fileName, code)) {
+    controller->index.add(fileName, code);
   }
-  
-  return i;
 }
@@ -0,0 +1,267 @@
+// IR_Matcher.cpp
+#include <IR_Matcher.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bucket values start at 2 so the query padding (0) is never within one
+// bucket of a real timing, and stay below 128 so the SWAR compare below
+// cannot carry between bytes.
+static const uint8_t kFirstBucket = 2;
+static const uint8_t kQueryPadding = 0x00;
+static const uint8_t kIndexPadding = 0x7F;
+
+static uint32_t hashName(const char *name) {
+  return irrecord::crc32((const uint8_t *)name, strlen(name));
+}
+
+// Sets the low bit of each byte where `a` and `b` differ by at most one.
+static inline uint32_t closeBytes(uint32_t a, uint32_t b) {
+  const uint32_t high = 0x80808080;
+  const uint32_t low = 0x01010101;
+  // Per byte a - b + 1 (mod 256), without borrows or carries crossing bytes.
+  uint32_t difference = ((a | high) - (b & ~high)) ^ ((a ^ ~b) & high);
+  difference = ((difference & ~high) + low) ^ (difference & high);
+  // Close bytes are now 0, 1 or 2. Flag each byte below 3.
+  uint32_t below = ~((difference | high) - 3 * low) & ~difference & high;
+  return below >> 7;
+}
+
+bool IRCodeIndex::begin(uint16_t capacity, uint8_t tolerance) {
+  free(fingerprints);
+  free(names);
+  free(infos);
+  free(slots);
+  uint32_t slotCount = 2;
+  while (slotCount < 2 * (uint32_t)capacity) {
+    slotCount *= 2;
+  }
+  fingerprints = (uint32_t *)malloc(capacity * kWords * sizeof(uint32_t));
+  names = (char (*)[kMaxNameLength + 1])malloc(capacity * sizeof(*names));
+  infos = (Info *)malloc(capacity * sizeof(Info));
+  slots = capacity <= 16384 ? (uint16_t *)malloc(slotCount * sizeof(uint16_t)) : nullptr;
+  count = 0;
+  if (fingerprints == nullptr || names == nullptr || infos == nullptr || slots == nullptr) {
+    maxCodes = 0;
+    slotMask = 0;
+    return false;
+  }
+  maxCodes = capacity;
+  slotMask = slotCount - 1;
+  clear();
+
+  // Bucket i + 1 starts at ratio^(i + 1), so values within the tolerance of
+  // each other are never more than one bucket apart.
+  double ratio = 1.0 + (tolerance < 10 ? 10 : tolerance) / 100.0;
+  double threshold = ratio;
+  thresholdCount = 0;
+  while (threshold <= UINT16_MAX && thresholdCount < sizeof(thresholds) / sizeof(thresholds[0])) {
+    thresholds[thresholdCount++] = (uint32_t)ceil(threshold);
+    threshold *= ratio;
+  }
+  return true;
+}
+
+void IRCodeIndex::clear() {
+  count = 0;
+  if (slots != nullptr) {
+    memset(slots, 0xFF, (slotMask + 1) * sizeof(uint16_t));
+  }
+}
+
+bool IRCodeIndex::add(const char *name, const irrecord::IRCode &code) {
+  if (strlen(name) > kMaxNameLength || maxCodes == 0) {
+    return false;
+  }
+
+  uint32_t hash = hashName(name);
+  int32_t slot = find(name, hash);
+  uint16_t index;
+  if (slot >= 0) {
+    index = slots[slot];
+  } else {
+    if (count == maxCodes) {
+      return false;
+    }
+    index = count++;
+    uint16_t empty = home(hash);
+    while (slots[empty] != kNoCode) {
+      empty = (empty + 1) & slotMask;
+    }
+    slots[empty] = index;
+  }
+
+  strcpy(names[index], name);
+  describe(code, infos[index]);
+  infos[index].nameHash = hash;
+  fingerprint(code, fingerprints + index * kWords, kIndexPadding);
+  return true;
+}
+
+void IRCodeIndex::remove(const char *name) {
+  int32_t slot = find(name, hashName(name));
+  if (slot < 0) {
+    return;
+  }
+  uint16_t index = slots[slot];
+  eraseSlot(slot);
+
+  // Move the last code into the hole, and point its slot there.
+  count--;
+  if (index != count) {
+    uint16_t moved = home(infos[count].nameHash);
+    while (slots[moved] != count) {
+      moved = (moved + 1) & slotMask;
+    }
+    slots[moved] = index;
+    memcpy(names[index], names[count], sizeof(names[index]));
+    infos[index] = infos[count];
+    memcpy(fingerprints + index * kWords, fingerprints + count * kWords, kWords * sizeof(uint32_t));
+  }
+}
+
+uint8_t IRCodeIndex::findNearest(const irrecord::IRCode &code, IRMatch *matches, uint8_t k,
+                                 uint8_t minScore, const char *exclude) const {
+  Info query;
+  describe(code, query);
+  uint32_t queryPrint[kWords];
+  fingerprint(code, queryPrint, kQueryPadding);
+  uint32_t excludeHash = exclude != nullptr ? hashName(exclude) : 0;
+
+  uint8_t queryPrinted = code.length < kFingerprintLength ? code.length : kFingerprintLength;
+  uint8_t found = 0;
+  const uint32_t *print = fingerprints;
+  for (uint16_t i = 0; i < count; i++, print += kWords) {
+    const Info &info = infos[i];
+    if (info.protocol != query.protocol) {
+      continue;
+    }
+
+    uint8_t score = code.isRaw() ? rawScore(query, queryPrinted, queryPrint, info, print)
+                                 : protocolScore(query, queryPrint, info, print);
+    if (score < minScore || (found == k && (k == 0 || score <= matches[k - 1].score))) {
+      continue;
+    }
+    if (exclude != nullptr && info.nameHash == excludeHash && strcmp(names[i], exclude) == 0) {
+      continue;
+    }
+
+    // Insert into the sorted top-k list.
+    uint8_t slot = found < k ? found++ : k - 1;
+    while (slot > 0 && matches[slot - 1].score < score) {
+      matches[slot] = matches[slot - 1];
+      slot--;
+    }
+    strcpy(matches[slot].name, names[i]);
+    matches[slot].score = score;
+  }
+  return found;
+}
+
+uint8_t IRCodeIndex::rawScore(const Info &query, uint8_t queryPrinted, const uint32_t *queryPrint,
+                              const Info &info, const uint32_t *print) const {
+  // Sum the flags per byte lane and add the lanes up once at the end; a
+  // lane counts to kWords at most, so nothing carries into the next one.
+  uint32_t lanes = 0;
+  for (uint8_t w = 0; w < kWords; w++) {
+    lanes += closeBytes(queryPrint[w], print[w]);
+  }
+  uint8_t close = (lanes * 0x01010101) >> 24;
+  // Share of fingerprint positions within tolerance, scaled down by how
+  // much the frame lengths differ.
+  uint8_t printed = info.length < kFingerprintLength ? info.length : kFingerprintLength;
+  uint8_t longest = printed > queryPrinted ? printed : queryPrinted;
+  uint32_t shorter = info.length < query.length ? info.length : query.length;
+  uint32_t longer = info.length > query.length ? info.length : query.length;
+  return longest == 0 ? 0 : (uint32_t)close * 100 * shorter / (longest * longer);
+}
+
+uint8_t IRCodeIndex::protocolScore(const Info &query, const uint32_t *queryPrint, const Info &info,
+                                   const uint32_t *print) const {
+  bool same = info.valueHash == query.valueHash && info.length == query.length &&
+              info.bits == query.bits;
+  uint32_t shorter = info.bits < query.bits ? info.bits : query.bits;
+  uint32_t longer = info.bits > query.bits ? info.bits : query.bits;
+  if (same || longer == 0) {
+    return same ? 100 : 0;
+  }
+
+  // Share of the value bits that agree, scaled down by how much the bit
+  // counts differ. Bytes past either value are zero in both.
+  uint32_t compared = longer < kFingerprintLength * 8 ? longer : kFingerprintLength * 8;
+  uint32_t differing = 0;
+  for (uint8_t w = 0; w < kWords; w++) {
+    differing += __builtin_popcount(queryPrint[w] ^ print[w]);
+  }
+  differing = differing < compared ? differing : compared;
+  uint32_t score = (compared - differing) * 100 * shorter / (compared * longer);
+  // Only the same value is a duplicate, whatever lies past the fingerprint.
+  return score < 99 ? score : 99;
+}
+
+uint8_t IRCodeIndex::bucket(uint16_t timing) const {
+  uint8_t low = 0;
+  uint8_t high = thresholdCount;
+  while (low < high) {
+    uint8_t middle = (low + high) / 2;
+    if (thresholds[middle] <= timing) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return kFirstBucket + low;
+}
+
+void IRCodeIndex::fingerprint(const irrecord::IRCode &code, uint32_t *out, uint8_t padding) const {
+  uint8_t *bytes = (uint8_t *)out;
+  if (!code.isRaw()) {
+    // The value itself, zero padded the same way in the index and queries.
+    uint8_t length = code.length < kFingerprintLength ? code.length : kFingerprintLength;
+    memset(bytes, 0, kFingerprintLength);
+    if (code.bytes != nullptr) {
+      memcpy(bytes, code.bytes, length);
+    }
+    return;
+  }
+  for (uint8_t i = 0; i < kFingerprintLength; i++) {
+    bytes[i] = i < code.length ? bucket(code.timings[i]) : padding;
+  }
+}
+
+void IRCodeIndex::describe(const irrecord::IRCode &code, Info &info) const {
+  info.protocol = code.protocol;
+  info.length = code.length;
+  info.valueHash = code.isRaw() ? 0 : irrecord::crc32(code.bytes, code.length);
+  // Value protocols keep `bits` in a wider integer, state protocols fill
+  // every byte.
+  uint32_t bytesBits = (uint32_t)code.length * 8;
+  info.bits = code.isRaw() ? 0 : (code.bits != 0 && code.bits < bytesBits) ? code.bits : bytesBits;
+}
+
+// Slot of the code called `name`, or -1.
+int32_t IRCodeIndex::find(const char *name, uint32_t hash) const {
+  if (maxCodes == 0) {
+    return -1;
+  }
+  for (uint16_t slot = home(hash); slots[slot] != kNoCode; slot = (slot + 1) & slotMask) {
+    uint16_t index = slots[slot];
+    if (infos[index].nameHash == hash && strcmp(names[index], name) == 0) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+void IRCodeIndex::eraseSlot(uint16_t slot) {
+  // Shift later members of the probe run back into the hole, so lookups
+  // never need tombstones.
+  uint16_t hole = slot;
+  for (uint16_t next = (hole + 1) & slotMask; slots[next] != kNoCode; next = (next + 1) & slotMask) {
+    if (((next - home(infos[slots[next]].nameHash)) & slotMask) >= ((next - hole) & slotMask)) {
+      slots[hole] = slots[next];
+      hole = next;
+    }
+  }
+  slots[hole] = kNoCode;
+}
@@ -0,0 +1,393 @@
+// IR_Record.cpp
+#include <IR_Record.h>
+#include <string.h>
+
+namespace irrecord {
+
+static void putU16(uint8_t *out, uint16_t value) {
+  out[0] = value & 0xFF;
+  out[1] = value >> 8;
+}
+
+static void putU32(uint8_t *out, uint32_t value) {
+  putU16(out, value & 0xFFFF);
+  putU16(out + 2, value >> 16);
+}
+
+static uint16_t getU16(const uint8_t *in) {
+  return in[0] | (in[1] << 8);
+}
+
+static uint32_t getU32(const uint8_t *in) {
+  return getU16(in) | ((uint32_t)getU16(in + 2) << 16);
+}
+
+uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc) {
+  // Nibble driven table keeps the flash footprint at 64 bytes.
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+    crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+bool isRecord(const uint8_t *data, size_t length) {
+  return length >= kRecordHeaderSize &&
+         data[0] == kRecordMagic[0] && data[1] == kRecordMagic[1];
+}
+
+static size_t encodeTimings(const uint16_t *timings, uint16_t length, uint8_t *payload) {
+  size_t size = 0;
+  for (uint16_t i = 0; i < length; i++) {
+    int32_t delta = (int32_t)timings[i] - (i >= 2 ? timings[i - 2] : 0);
+    uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    while (zigzag >= 0x80) {
+      payload[size++] = (zigzag & 0x7F) | 0x80;
+      zigzag >>= 7;
+    }
+    payload[size++] = zigzag;
+  }
+  return size;
+}
+
+static RecordStatus decodeTimings(const uint8_t *payload, size_t size, uint16_t entries,
+                                  uint16_t *timings) {
+  size_t pos = 0;
+  for (uint16_t i = 0; i < entries; i++) {
+    uint32_t zigzag = 0;
+    uint8_t shift = 0;
+    uint8_t byte;
+    do {
+      if (pos >= size || shift > 14) {
+        return RECORD_MALFORMED;
+      }
+      byte = payload[pos++];
+      zigzag |= (uint32_t)(byte & 0x7F) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+
+    int32_t delta = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+    int32_t value = delta + (i >= 2 ? timings[i - 2] : 0);
+    if (value < 0 || value > 0xFFFF) {
+      return RECORD_MALFORMED;
+    }
+    timings[i] = value;
+  }
+  return pos == size ? RECORD_OK : RECORD_MALFORMED;
+}
+
+size_t encode(const IRCode &code, uint8_t *out, size_t capacity) {
+  uint8_t *payload = out + kRecordHeaderSize;
+  size_t size;
+  uint8_t flags = 0;
+  if (code.isRaw()) {
+    if (capacity < maxRecordSize(code.length)) {
+      return 0;
+    }
+    size = 0;
+    if (code.repeats != 0) {
+      flags |= kFlagRepeats;
+      putU16(payload, code.repeats);
+      putU32(payload + 2, code.gap);
+      size = 6;
+    }
+    size += encodeTimings(code.timings, code.length, payload + size);
+  } else {
+    flags |= kFlagProtocol;
+    size = 4 + code.length;
+    if (capacity < kRecordHeaderSize + size) {
+      return 0;
+    }
+    putU16(payload, code.protocol);
+    putU16(payload + 2, code.bits);
+    memcpy(payload + 4, code.bytes, code.length);
+  }
+
+  out[0] = kRecordMagic[0];
+  out[1] = kRecordMagic[1];
+  out[2] = kRecordVersion;
+  out[3] = flags;
+  putU16(out + 4, code.isRaw() ? code.frequency : 0);
+  putU16(out + 6, code.length);
+  putU16(out + 8, size);
+  uint32_t crc = crc32(out, 10);
+  putU32(out + 10, crc32(payload, size, crc));
+
+  return kRecordHeaderSize + size;
+}
+
+RecordStatus decode(const uint8_t *data, size_t length, uint16_t *timings,
+                    uint16_t capacity, IRCode &code) {
+  code = IRCode();
+  if (!isRecord(data, length)) {
+    return RECORD_NOT_A_RECORD;
+  }
+  uint8_t flags = data[3];
+  if (data[2] != kRecordVersion || (flags & ~(kFlagProtocol | kFlagRepeats)) != 0) {
+    return RECORD_BAD_VERSION;
+  }
+
+  uint16_t entries = getU16(data + 6);
+  uint16_t size = getU16(data + 8);
+  if (length < kRecordHeaderSize + size) {
+    return RECORD_TRUNCATED;
+  }
+
+  const uint8_t *payload = data + kRecordHeaderSize;
+  uint32_t crc = crc32(data, 10);
+  if (crc32(payload, size, crc) != getU32(data + 10)) {
+    return RECORD_BAD_CRC;
+  }
+
+  if (flags & kFlagProtocol) {
+    if (size != 4 + entries) {
+      return RECORD_MALFORMED;
+    }
+    code.protocol = (int16_t)getU16(payload);
+    code.bits = getU16(payload + 2);
+    code.bytes = payload + 4;
+  } else {
+    if (entries > capacity) {
+      return RECORD_OVERFLOW;
+    }
+    if (flags & kFlagRepeats) {
+      if (size < 6) {
+        return RECORD_MALFORMED;
+      }
+      code.repeats = getU16(payload);
+      code.gap = getU32(payload + 2);
+      payload += 6;
+      size -= 6;
+    }
+    RecordStatus status = decodeTimings(payload, size, entries, timings);
+    if (status != RECORD_OK) {
+      return status;
+    }
+    code.frequency = getU16(data + 4);
+    code.timings = timings;
+  }
+
+  code.length = entries;
+  return RECORD_OK;
+}
+
+static bool withinTolerance(uint16_t a, uint16_t b, uint8_t tolerance) {
+  uint32_t larger = a > b ? a : b;
+  uint32_t difference = a > b ? a - b : b - a;
+  return difference * 100 <= larger * tolerance;
+}
+
+bool trimRepeats(IRCode &code, uint8_t tolerance, uint16_t minGap) {
+  if (!code.isRaw() || code.repeats != 0) {
+    return false;
+  }
+
+  // Frames end in a mark, so a candidate gap is a long space at an odd index
+  // and the frame before it is `gap` entries long. Try each in turn, the
+  // first long space may just be part of the protocol.
+  const uint16_t *timings = code.timings;
+  uint16_t length = code.length;
+  for (uint16_t gap = 1; 2 * gap + 1 <= length; gap += 2) {
+    uint16_t period = gap + 1;
+    if (timings[gap] < minGap || (length + 1) % period != 0) {
+      continue;
+    }
+
+    bool periodic = true;
+    for (uint16_t i = period; i < length && periodic; i++) {
+      periodic = withinTolerance(timings[i], timings[i % period], tolerance);
+    }
+    if (periodic) {
+      code.length = gap;
+      code.repeats = (length + 1) / period - 1;
+      code.gap = timings[gap];
+      return true;
+    }
+  }
+  return false;
+}
+
+uint16_t ticksToTimings(const volatile uint16_t *ticks, uint16_t count, uint16_t tickMicros,
+                        uint16_t *timings, uint16_t capacity, bool &overflow) {
+  uint16_t length = 0;
+  overflow = false;
+  for (uint16_t i = 1; i < count; i++) {
+    uint32_t usecs = (uint32_t)ticks[i] * tickMicros;
+    while (usecs > UINT16_MAX && length + 2 < capacity) {
+      timings[length++] = UINT16_MAX;
+      timings[length++] = 0;
+      usecs -= UINT16_MAX;
+    }
+    // Out of room, either for the entry or for the rest of a split gap,
+    // which would otherwise be stored truncated to 16 bits.
+    if (length == capacity || usecs > UINT16_MAX) {
+      overflow = true;
+      break;
+    }
+    timings[length++] = usecs;
+  }
+  return length;
+}
+
+static const char kTextPrefix[] = "raw_array:[";
+
+TextParser::TextParser(uint16_t *timings, uint16_t capacity)
+    : timings(timings), capacity(capacity) {}
+
+ParseStatus TextParser::fail(ParseStatus error) {
+  state = FAILED;
+  status = error;
+  return status;
+}
+
+ParseStatus TextParser::feed(const char *text, size_t length) {
+  for (size_t i = 0; i < length && state != DONE && state != FAILED;
+       i++, offset++) {
+    char c = text[i];
+    switch (state) {
+      case PREFIX:
+        if (c != kTextPrefix[matched]) {
+          return fail(PARSE_NO_PREFIX);
+        }
+        if (++matched == sizeof(kTextPrefix) - 1) {
+          state = NUMBER_START;
+        }
+        break;
+
+      case NUMBER_START:
+        if (c == ']' && entries == 0) {
+          state = DONE;
+        } else if (c >= '0' && c <= '9') {
+          if (entries == capacity) {
+            return fail(PARSE_OVERFLOW);
+          }
+          value = c - '0';
+          state = NUMBER;
+        } else if (c != ' ') {
+          return fail(PARSE_MALFORMED);
+        }
+        break;
+
+      case NUMBER:
+        if (c >= '0' && c <= '9') {
+          value = value * 10 + (c - '0');
+          if (value > 0xFFFF) {
+            return fail(PARSE_RANGE);
+          }
+          break;
+        }
+        timings[entries++] = value;
+        state = SEPARATOR;
+        // The character that ended the number is the separator.
+        // fall through
+
+      case SEPARATOR:
+        if (c == ',') {
+          state = NUMBER_START;
+        } else if (c == ']') {
+          state = DONE;
+        } else if (c != ' ') {
+          return fail(PARSE_MALFORMED);
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  if (state == DONE) {
+    status = PARSE_OK;
+  }
+  return status;
+}
+
+ParseStatus TextParser::finish() {
+  if (state != DONE && state != FAILED) {
+    return fail(state == PREFIX ? PARSE_NO_PREFIX : PARSE_TRUNCATED);
+  }
+  return status;
+}
+
+ParseStatus parseText(const char *text, size_t length, uint16_t *timings,
+                      uint16_t capacity, uint16_t &count) {
+  TextParser parser(timings, capacity);
+  parser.feed(text, length);
+  ParseStatus status = parser.finish();
+  count = status == PARSE_OK ? parser.count() : 0;
+  return status;
+}
+
+// Writes `value` as decimal digits into `out` and returns the digit count.
+static uint8_t formatUint(uint16_t value, char *out) {
+  char digits[5];
+  uint8_t count = 0;
+  do {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+
+  for (uint8_t i = 0; i < count; i++) {
+    out[i] = digits[count - 1 - i];
+  }
+  return count;
+}
+
+size_t writeText(const uint16_t *timings, uint16_t length, ByteSink sink, void *context) {
+  char chunk[64];
+  size_t used = sizeof(kTextPrefix) - 1;
+  size_t written = 0;
+  memcpy(chunk, kTextPrefix, used);
+
+  for (uint16_t i = 0; i < length; i++) {
+    // Room for a separator, five digits and the closing bracket.
+    if (sizeof(chunk) - used < 7) {
+      written += sink((const uint8_t *)chunk, used, context);
+      used = 0;
+    }
+    if (i != 0) {
+      chunk[used++] = ',';
+    }
+    used += formatUint(timings[i], chunk + used);
+  }
+  chunk[used++] = ']';
+
+  written += sink((const uint8_t *)chunk, used, context);
+  return written;
+}
+
+const char *toString(RecordStatus status) {
+  switch (status) {
+    case RECORD_OK:           return "ok";
+    case RECORD_NOT_A_RECORD: return "not a record";
+    case RECORD_BAD_VERSION:  return "unsupported version";
+    case RECORD_TRUNCATED:    return "truncated";
+    case RECORD_BAD_CRC:      return "CRC mismatch";
+    case RECORD_OVERFLOW:     return "too many entries";
+    case RECORD_MALFORMED:    return "malformed payload";
+  }
+  return "unknown";
+}
+
+const char *toString(ParseStatus status) {
+  switch (status) {
+    case PARSE_OK:        return "ok";
+    case PARSE_MORE:      return "incomplete";
+    case PARSE_NO_PREFIX: return "missing raw_array prefix";
+    case PARSE_MALFORMED: return "malformed element";
+    case PARSE_RANGE:     return "element out of range";
+    case PARSE_OVERFLOW:  return "too many entries";
+    case PARSE_TRUNCATED: return "truncated";
+  }
+  return "unknown";
+}
+
+}  // namespace irrecord
@@ -0,0 +1,162 @@
+// IR_Scene.cpp
+#include <IR_Scene.h>
+
+bool SceneRunner::start(const char* name) {
+  if (isRunning() || strlen(name) > IRCodeCache::kMaxNameLength) {
+    return false;
+  }
+
+  char path[64];
+  snprintf(path, sizeof(path), "%s%s", kSceneDirectory, name);
+  // Keep a byte spare, parse() terminates the last line in place.
+  if (!ir.loadFileAsync(path, (uint8_t *)fileBuffer, sizeof(fileBuffer) - 1, loaded)) {
+    return false;
+  }
+
+  strcpy(sceneName, name);
+  aborted = false;
+  state = SCENE_LOADING;
+  return true;
+}
+
+void SceneRunner::abort() {
+  // Codes already handed to the transmit queue still go out. A scene file
+  // still being read has to arrive before fileBuffer can be reused.
+  if (state == SCENE_LOADING) {
+    aborted = true;
+  } else {
+    state = SCENE_IDLE;
+  }
+  pendingTicket = 0;
+}
+
+SceneState SceneRunner::tick() {
+  if (state == SCENE_LOADING) {
+    if (!loaded.done) {
+      return SCENE_LOADING;
+    }
+    if (aborted) {
+      state = SCENE_IDLE;
+      return SCENE_IDLE;
+    }
+    if (loaded.status != STORAGE_OK || !parse(fileBuffer, loaded.length)) {
+#ifdef EASYDEBUG
+      Serial.printf("Scene %s is missing or invalid.\n", sceneName);
+#endif
+      state = SCENE_IDLE;
+      return SCENE_FAILED;
+    }
+    nextStep = 0;
+    failures = 0;
+    pendingTicket = 0;
+    waitMs = 0;
+    state = SCENE_RUNNING;
+  }
+
+  while (state == SCENE_RUNNING) {
+    // Wait for the last code to leave the IR LED before timing the pause.
+    if (pendingTicket != 0) {
+      return SCENE_RUNNING;
+    }
+    if (waitMs != 0) {
+      if (millis() - waitStart < waitMs) {
+        return SCENE_RUNNING;
+      }
+      waitMs = 0;
+    }
+
+    if (nextStep == stepCount) {
+      state = SCENE_IDLE;
+      return SCENE_FINISHED;
+    }
+
+    const Step &step = steps[nextStep];
+    if (step.isWait) {
+      waitStart = millis();
+      waitMs = step.waitMs;
+    } else {
+      pendingTicket = ir.sendAsync(step.code, SEND_NORMAL);
+      if (pendingTicket == 0) {
+        return SCENE_RUNNING;  // Transmit queue is full, retry next tick.
+      }
+    }
+    nextStep++;
+  }
+  return state;
+}
+
+uint32_t SceneRunner::msUntilNextStep() const {
+  if (state == SCENE_LOADING) {
+    return kLoadPollMs;
+  }
+  if (state != SCENE_RUNNING || pendingTicket != 0) {
+    return UINT32_MAX;  // Idle, or woken by a transmit result instead.
+  }
+  if (waitMs == 0) {
+    return 0;
+  }
+  uint32_t elapsed = millis() - waitStart;
+  return elapsed >= waitMs ? 0 : waitMs - elapsed;
+}
+
+bool SceneRunner::onSendComplete(const SendResult &result) {
+  if (state != SCENE_RUNNING || result.ticket != pendingTicket) {
+    return false;
+  }
+  if (!result.sent) {
+    failures++;
+  }
+  pendingTicket = 0;
+  return true;
+}
+
+bool SceneRunner::parse(char *text, size_t length) {
+  stepCount = 0;
+  size_t pos = 0;
+  while (pos < length) {
+    // Cut out the next line and trim it.
+    size_t end = pos;
+    while (end < length && text[end] != '\n') {
+      end++;
+    }
+    char *line = text + pos;
+    size_t lineLength = end - pos;
+    pos = end + 1;
+    while (lineLength > 0 && isspace((unsigned char)*line)) {
+      line++;
+      lineLength--;
+    }
+    while (lineLength > 0 && isspace((unsigned char)line[lineLength - 1])) {
+      lineLength--;
+    }
+    if (lineLength == 0 || line[0] == '#') {
+      continue;
+    }
+    line[lineLength] = '\0';
+
+    if (stepCount == kMaxSteps) {
+      return false;
+    }
+    Step &step = steps[stepCount];
+    if (strncmp(line, "send ", 5) == 0) {
+      const char *code = line + 5;
+      if (*code == '\0' || strlen(code) > IRCodeCache::kMaxNameLength) {
+        return false;
+      }
+      step.isWait = false;
+      strcpy(step.code, code);
+    } else if (strncmp(line, "wait ", 5) == 0) {
+      char *digitsEnd;
+      unsigned long ms = strtoul(line + 5, &digitsEnd, 10);
+      if (digitsEnd == line + 5 || *digitsEnd != '\0') {
+        return false;
+      }
+      step.isWait = true;
+      step.waitMs = ms;
+    } else {
+      return false;
+    }
+    stepCount++;
+  }
+  return stepCount != 0;
+}
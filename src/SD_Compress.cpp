@@ -0,0 +1,231 @@
+// SD_Compress.cpp
+#include <SD_Compress.h>
+#include <string.h>
+
+namespace sdcompress {
+
+static const uint8_t kMinMatch = 4;
+// LZ4 block rules: the last five bytes are always literals and no match
+// starts in the last twelve, so fast LZ4 decoders never read past the end.
+static const uint8_t kLastLiterals = 5;
+static const uint8_t kMatchLimit = 12;
+static const uint8_t kHashBits = 8;
+
+static uint32_t read32(const uint8_t *data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint8_t hash4(const uint8_t *data) {
+  return (read32(data) * 2654435761u) >> (32 - kHashBits);
+}
+
+// Collects output into a small chunk, so the sink sees few, larger writes.
+class Emitter {
+  public:
+    Emitter(irrecord::ByteSink sink, void *context) : sink(sink), context(context) {}
+
+    void put(uint8_t value) {
+      if (used == sizeof(chunk)) {
+        flush();
+      }
+      chunk[used++] = value;
+    }
+
+    void put(const uint8_t *data, size_t length) {
+      if (length == 0) {
+        return;
+      }
+      if (length > sizeof(chunk) - used) {
+        flush();
+      }
+      if (length > sizeof(chunk)) {
+        total += sink(data, length, context);
+        return;
+      }
+      memcpy(chunk + used, data, length);
+      used += length;
+    }
+
+    // Writes a length field's continuation bytes.
+    void putLength(size_t length) {
+      while (length >= 255) {
+        put(255);
+        length -= 255;
+      }
+      put(length);
+    }
+
+    void flush() {
+      total += sink(chunk, used, context);
+      used = 0;
+    }
+
+    size_t total = 0;
+
+  private:
+    irrecord::ByteSink sink;
+    void *context;
+    uint8_t chunk[64];
+    size_t used = 0;
+};
+
+static void emitSequence(Emitter &emitter, const uint8_t *literals, size_t literalCount,
+                         uint16_t offset, size_t matchLength) {
+  size_t matchCode = matchLength != 0 ? matchLength - kMinMatch : 0;
+  uint8_t token = (literalCount < 15 ? literalCount : 15) << 4;
+  token |= matchCode < 15 ? matchCode : 15;
+  emitter.put(token);
+  if (literalCount >= 15) {
+    emitter.putLength(literalCount - 15);
+  }
+  emitter.put(literals, literalCount);
+  if (matchLength == 0) {
+    return;  // Last sequence.
+  }
+  emitter.put(offset);
+  emitter.put(offset >> 8);
+  if (matchCode >= 15) {
+    emitter.putLength(matchCode - 15);
+  }
+}
+
+size_t compress(const uint8_t *data, size_t length, irrecord::ByteSink sink, void *context) {
+  if (length > kMaxInputLength) {
+    return 0;
+  }
+
+  // Last position each 4 byte prefix was seen at. Stale or colliding entries
+  // are weeded out by comparing the bytes.
+  uint16_t table[1 << kHashBits];
+  memset(table, 0, sizeof(table));
+
+  Emitter emitter(sink, context);
+  size_t anchor = 0;   // First byte not yet emitted.
+  size_t pos = 0;
+  size_t matchEnd = length > kLastLiterals ? length - kLastLiterals : 0;
+  while (length >= kMatchLimit && pos + kMatchLimit <= length) {
+    uint8_t hash = hash4(data + pos);
+    size_t candidate = table[hash];
+    table[hash] = pos;
+    if (candidate >= pos || read32(data + candidate) != read32(data + pos)) {
+      pos++;
+      continue;
+    }
+
+    // Grow the match both ways, backwards into the pending literals.
+    size_t start = pos;
+    while (start > anchor && candidate > 0 && data[start - 1] == data[candidate - 1]) {
+      start--;
+      candidate--;
+    }
+    size_t end = pos + kMinMatch;
+    while (end < matchEnd && data[end] == data[candidate + (end - start)]) {
+      end++;
+    }
+
+    emitSequence(emitter, data + anchor, start - anchor, start - candidate, end - start);
+    // Remember the positions inside the match too; IR payloads repeat in
+    // short strides, so they are often the best candidates.
+    for (size_t i = pos + 1; i < end && i + kMatchLimit <= length; i++) {
+      table[hash4(data + i)] = i;
+    }
+    anchor = end;
+    pos = end;
+  }
+
+  emitSequence(emitter, data + anchor, length - anchor, 0, 0);
+  emitter.flush();
+  return emitter.total;
+}
+
+bool Decompressor::copyMatch() {
+  if (offset == 0 || offset > produced || matchLength > capacity - produced) {
+    state = FAILED;
+    return false;
+  }
+  uint8_t *to = out + produced;
+  const uint8_t *from = to - offset;
+  if (offset >= matchLength) {
+    memcpy(to, from, matchLength);
+  } else {
+    // Overlapping copy, e.g. a run of one repeated byte.
+    for (size_t i = 0; i < matchLength; i++) {
+      to[i] = from[i];
+    }
+  }
+  produced += matchLength;
+  state = TOKEN;
+  return true;
+}
+
+bool Decompressor::feed(const uint8_t *data, size_t length) {
+  const uint8_t *end = data + length;
+  while (data < end) {
+    switch (state) {
+      case TOKEN:
+        literals = *data >> 4;
+        matchLength = *data & 0x0F;
+        data++;
+        state = literals == 15 ? LITERAL_LENGTH : (literals != 0 ? LITERALS : OFFSET_LOW);
+        break;
+
+      case LITERAL_LENGTH:
+        literals += *data;
+        if (*data++ != 255) {
+          state = LITERALS;
+        }
+        break;
+
+      case LITERALS: {
+        size_t count = (size_t)(end - data) < literals ? (size_t)(end - data) : literals;
+        if (count > capacity - produced) {
+          state = FAILED;
+          return false;
+        }
+        memcpy(out + produced, data, count);
+        produced += count;
+        data += count;
+        literals -= count;
+        if (literals == 0) {
+          state = OFFSET_LOW;
+        }
+        break;
+      }
+
+      case OFFSET_LOW:
+        offset = *data++;
+        state = OFFSET_HIGH;
+        break;
+
+      case OFFSET_HIGH:
+        offset |= *data++ << 8;
+        if (matchLength == 15) {
+          state = MATCH_LENGTH;
+        } else {
+          matchLength += kMinMatch;
+          if (!copyMatch()) {
+            return false;
+          }
+        }
+        break;
+
+      case MATCH_LENGTH:
+        matchLength += *data;
+        if (*data++ != 255) {
+          matchLength += kMinMatch;
+          if (!copyMatch()) {
+            return false;
+          }
+        }
+        break;
+
+      case FAILED:
+        return false;
+    }
+  }
+  return state != FAILED;
+}
+
+}  // namespace sdcompress
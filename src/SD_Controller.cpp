@@ -1,5 +1,24 @@
 #include "SD_Controller.h"
 
+// FNV-1a over the path.
+static uint32_t hashPath(const char *path) {
+  uint32_t hash = 2166136261u;
+  while (*path) {
+    hash = (hash ^ (uint8_t)*path++) * 16777619u;
+  }
+  return hash;
+}
+
+// True if `path` names an entry directly inside `dirname`.
+static bool isInDirectory(const char *path, const char *dirname) {
+  size_t length = strlen(dirname);
+  while (length > 0 && dirname[length - 1] == '/') {
+    length--;
+  }
+  return strncmp(path, dirname, length) == 0 && path[length] == '/' &&
+         path[length + 1] != '\0' && strchr(path + length + 1, '/') == nullptr;
+}
+
 bool SDController::init() {
   if (!SD.begin(2)) {
     Serial.println("SD Card Initialization failed!");
@@ -7,6 +26,8 @@ bool SDController::init() {
   } else {
     initialized = true;
   }
+  // Whatever is on the card now is read on first use.
+  indexReset(false);
   return initialized;
 }
 
@@ -20,30 +41,112 @@ bool SDController::createAndSaveFile(const char* fileName, const char* text) {
     return false;
   }
 
-  file.println(text);
+  size_t written = file.println(text);
   file.close();
+  indexAdd(fileName, false, written);
   return true;
 }
 
-char* SDController::readFile(const char* fileName) {
+bool SDController::createAndSaveFile(const char* fileName, const uint8_t* data, size_t length) {
   if (!initialized) {
-    return nullptr;
+    return false;
   }
 
-  File file = SD.open(fileName);
+  File file = SD.open(fileName, FILE_WRITE);
   if (!file) {
-    return nullptr;
+    return false;
+  }
+
+  size_t written = file.write(data, length);
+  file.close();
+  indexAdd(fileName, false, written);
+  return written == length;
+}
+
+bool SDController::readFile(const char* fileName, uint8_t* buffer, size_t capacity, size_t &length) {
+  length = 0;
+  // Refuse files that do not fit rather than handing back a partial read.
+  int16_t entry = (initialized && indexReady()) ? indexFind(fileName) : -1;
+  if (entry >= 0 && index[entry].size != kUnknownSize && index[entry].size > capacity) {
+    return false;
   }
 
-  int fileSize = file.size();
-  char* buffer = new char[fileSize + 1];
+  SDReader reader = openReader(fileName);
+  if (!reader.isOpen() || reader.size() > capacity) {
+    reader.close();
+    return false;
+  }
 
-  int bytesRead = file.readBytes(buffer, fileSize);
-  buffer[bytesRead] = '\0';
+  length = reader.read(buffer, capacity);
+  bool complete = length == reader.size();
+  reader.close();
+  return complete;
+}
 
-  file.close();
+SDReader SDController::openReader(const char* fileName) {
+  SDReader reader;
+  if (!fileExists(fileName)) {
+    return reader;
+  }
 
-  return buffer;
+  reader.file = SD.open(fileName);
+  if (reader.file) {
+    reader.open = true;
+    reader.fileSize = reader.file.size();
+  }
+  return reader;
+}
+
+bool SDController::forEachChunk(const char* fileName,
+                                bool (*visitor)(const uint8_t* data, size_t length, void* context),
+                                void* context) {
+  SDReader reader = openReader(fileName);
+  if (!reader.isOpen()) {
+    return false;
+  }
+
+  size_t length;
+  bool visited = true;
+  while (visited && (length = reader.read(chunk, sizeof(chunk))) > 0) {
+    visited = visitor(chunk, length, context);
+  }
+  bool complete = visited && reader.remaining() == 0;
+  reader.close();
+  return complete;
+}
+
+size_t SDReader::read(uint8_t* buffer, size_t capacity) {
+  if (!open || capacity == 0 || remaining() == 0) {
+    return 0;
+  }
+
+  size_t wanted = remaining() < capacity ? remaining() : capacity;
+  int got = file.read(buffer, wanted);
+  if (got <= 0) {
+    return 0;
+  }
+  offset += got;
+  return got;
+}
+
+void SDReader::close() {
+  if (open) {
+    file.close();
+    open = false;
+  }
+}
+
+File SDController::openFile(const char* fileName, const char* mode) {
+  if (!initialized) {
+    return File();
+  }
+
+  File file = SD.open(fileName, mode);
+  // The caller writes the file itself, its size is looked up when asked for.
+  if (file && strcmp(mode, FILE_READ) != 0) {
+    indexAdd(fileName, false, kUnknownSize);
+  }
+  return file;
 }
 
 bool SDController::fileExists(const char* fileName) {
@@ -51,64 +154,179 @@ bool SDController::fileExists(const char* fileName) {
     return false;
   }
 
+  if (indexReady()) {
+    if (indexFind(fileName) >= 0) {
+      return true;
+    }
+    if (indexComplete) {
+      return false;
+    }
+  }
   return SD.exists(fileName);
 }
 
-bool SDController::eraseCard() {
+int32_t SDController::fileSize(const char* fileName) {
   if (!initialized) {
+    return -1;
+  }
+
+  int16_t entry = indexReady() ? indexFind(fileName) : -1;
+  if (entry >= 0 && index[entry].size != kUnknownSize) {
+    return index[entry].size;
+  }
+  if (entry < 0 && indexComplete) {
+    return -1;
+  }
+
+  File file = SD.open(fileName);
+  if (!file) {
+    return -1;
+  }
+  int32_t size = file.size();
+  file.close();
+  if (entry >= 0) {
+    index[entry].size = size;
+  }
+  return size;
+}
+
+uint32_t SDController::fileVersion(const char* fileName) {
+  int16_t entry = (initialized && indexReady()) ? indexFind(fileName) : -1;
+  return entry >= 0 ? index[entry].version : 0;
+}
+
+bool SDController::removeFile(const char* fileName) {
+  if (!initialized || !SD.remove(fileName)) {
     return false;
   }
 
-  // Call recursive function to delete all files and directories
-  if (!deleteDirectory("/")) {
+  indexRemove(fileName);
+  return true;
+}
+
+bool SDController::renameFile(const char* from, const char* to) {
+  if (!initialized || !SD.rename(from, to)) {
     return false;
   }
 
+  int16_t entry = indexReady() ? indexFind(from) : -1;
+  uint32_t size = entry >= 0 ? index[entry].size : kUnknownSize;
+  indexRemove(from);
+  indexAdd(to, false, size);
   return true;
 }
 
-bool SDController::deleteDirectory(String path) {
-  File root = SD.open(path);
+bool SDController::makeDirectory(const char* path) {
+  if (!initialized) {
+    return false;
+  }
+  if (fileExists(path)) {
+    return true;
+  }
+  if (!SD.mkdir(path)) {
+    return false;
+  }
 
-  if (!root) {
+  indexAdd(path, true, 0);
+  return true;
+}
+
+bool SDController::beginErase(const char *path) {
+  size_t length = strlen(path);
+  while (length > 1 && path[length - 1] == '/') {
+    length--;
+  }
+  if (!initialized || eraseState == ERASE_RUNNING || length == 0 || length > kMaxErasePath) {
     return false;
   }
 
-  // Delete all files and directories in the current directory
-  while (true) {
-    File file = root.openNextFile();
-    if (!file) {
-      break;
+  memcpy(erasePath, path, length);
+  erasePath[length] = '\0';
+  eraseRootLength = length;
+  eraseCount = 0;
+  eraseExpected = 0;
+  if (indexReady() && indexComplete) {
+    for (uint8_t i = 0; i < kIndexSlots; i++) {
+      const char *entry = index[i].path;
+      if (index[i].used && (length == 1 ||
+          (strncmp(entry, erasePath, length) == 0 && (entry[length] == '\0' || entry[length] == '/')))) {
+        eraseExpected++;
+      }
     }
+  }
+  eraseState = ERASE_RUNNING;
+  return true;
+}
 
-    String filePath = path + "/" + file.name();
-    if (file.isDirectory()) {
-      if (!deleteDirectory(filePath)) {
-        file.close();
-        root.close();
-        return false;
-      }
-    } else {
-      if (!SD.remove(filePath)) {
-        file.close();
-        root.close();
-        return false;
+EraseStatus SDController::eraseStep(uint16_t budget) {
+  while (eraseState == ERASE_RUNNING && budget > 0) {
+    if (!eraseDir) {
+      eraseDir = SD.open(erasePath);
+      if (!eraseDir || !eraseDir.isDirectory()) {
+        return finishErase(false);
       }
     }
 
-    file.close();
-  }
+    File entry = eraseDir.openNextFile();
+    size_t length = strlen(erasePath);
+    if (!entry) {
+      // Empty now, so remove it and go on with its parent.
+      eraseDir.close();
+      if (length == 1) {
+        return finishErase(true);  // The root itself stays.
+      }
+      if (!SD.rmdir(erasePath)) {
+        return finishErase(false);
+      }
+      indexRemove(erasePath);
+      eraseCount++;
+      budget--;
+      if (length == eraseRootLength) {
+        return finishErase(true);
+      }
+      char *slash = strrchr(erasePath, '/');
+      slash[slash == erasePath ? 1 : 0] = '\0';
+      continue;
+    }
 
-  root.close();
+    // Append the entry to the path, in place.
+    const char *name = strrchr(entry.name(), '/') ? strrchr(entry.name(), '/') + 1 : entry.name();
+    bool isDirectory = entry.isDirectory();
+    entry.close();
+    size_t separator = length == 1 ? 0 : 1;
+    if (length + separator + strlen(name) > kMaxErasePath) {
+      return finishErase(false);
+    }
+    if (separator) {
+      erasePath[length] = '/';
+    }
+    strcpy(erasePath + length + separator, name);
 
-  // Remove the current directory
-  if (path != "/") {
-    if (!SD.rmdir(path)) {
-      return false;
+    if (isDirectory) {
+      eraseDir.close();  // Descend, the directory is emptied first.
+      continue;
     }
+    if (!SD.remove(erasePath)) {
+      return finishErase(false);
+    }
+    indexRemove(erasePath);
+    eraseCount++;
+    budget--;
+    erasePath[length] = '\0';
   }
+  return eraseState;
+}
 
-  return true;
+EraseStatus SDController::finishErase(bool erased) {
+  if (eraseDir) {
+    eraseDir.close();
+  }
+  // An emptied card is exactly known again, even if the index overflowed.
+  if (erased && eraseRootLength == 1) {
+    indexReset(true);
+  }
+  eraseState = erased ? ERASE_DONE : ERASE_FAILED;
+  return eraseState;
 }
 
 bool SDController::isCardEmpty() {
@@ -116,6 +334,11 @@ bool SDController::isCardEmpty() {
     return false;
   }
 
+  // Anything that did not fit in the index is still on the card.
+  if (indexReady()) {
+    return indexCount == 0 && indexComplete;
+  }
+
   // Check if there are any files or directories in the root directory
   File root = SD.open("/");
   bool isEmpty = true;
@@ -163,3 +386,133 @@ void SDController::printDirectory(const char *dirname, uint8_t numTabs) {
   }
   root.close();
 }
+
+bool SDController::listFiles(const char *dirname, void (*callback)(const char *name, void *context), void *context) {
+  if (!initialized) {
+    return false;
+  }
+
+  if (indexReady() && indexComplete) {
+    for (uint8_t i = 0; i < kIndexSlots; i++) {
+      if (index[i].used && !index[i].isDirectory && isInDirectory(index[i].path, dirname)) {
+        callback(strrchr(index[i].path, '/') + 1, context);
+      }
+    }
+    return true;
+  }
+
+  File root = SD.open(dirname);
+  if (!root) {
+    return false;
+  }
+
+  while (true) {
+    File entry = root.openNextFile();
+    if (!entry) {
+      break;
+    }
+    if (!entry.isDirectory()) {
+      callback(entry.name(), context);
+    }
+    entry.close();
+  }
+  root.close();
+  return true;
+}
+
+bool SDController::indexReady() {
+  if (!indexBuilt && initialized) {
+    indexReset(true);
+    indexDirectory("/");
+  }
+  return indexBuilt;
+}
+
+void SDController::indexDirectory(const char *dirname) {
+  File root = SD.open(dirname);
+  if (!root) {
+    indexComplete = false;
+    return;
+  }
+
+  while (true) {
+    File entry = root.openNextFile();
+    if (!entry) {
+      break;
+    }
+    if (entry.isDirectory()) {
+      indexAdd(entry.path(), true, 0);
+      indexDirectory(entry.path());
+    } else {
+      indexAdd(entry.path(), false, entry.size());
+    }
+    entry.close();
+  }
+  root.close();
+}
+
+int16_t SDController::indexFind(const char *path) {
+  uint32_t hash = hashPath(path);
+  for (uint8_t slot = hash & (kIndexSlots - 1); index[slot].used; slot = (slot + 1) & (kIndexSlots - 1)) {
+    if (index[slot].hash == hash && strcmp(index[slot].path, path) == 0) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+void SDController::indexAdd(const char *path, bool isDirectory, uint32_t size) {
+  if (!indexBuilt) {
+    return;  // Picked up when the index is built.
+  }
+
+  int16_t found = indexFind(path);
+  if (found < 0) {
+    if (strlen(path) > kMaxIndexedPath || indexCount >= kIndexSlots / 4 * 3) {
+      indexComplete = false;
+      return;
+    }
+    uint32_t hash = hashPath(path);
+    found = hash & (kIndexSlots - 1);
+    while (index[found].used) {
+      found = (found + 1) & (kIndexSlots - 1);
+    }
+    index[found].used = true;
+    index[found].hash = hash;
+    strcpy(index[found].path, path);
+    indexCount++;
+  }
+  index[found].isDirectory = isDirectory;
+  index[found].size = size;
+  index[found].version = ++modifications;
+}
+
+void SDController::indexRemove(const char *path) {
+  int16_t found = indexBuilt ? indexFind(path) : -1;
+  if (found < 0) {
+    return;
+  }
+
+  // Shift later members of the probe run back into the hole, so lookups
+  // never need tombstones.
+  uint8_t mask = kIndexSlots - 1;
+  uint8_t hole = found;
+  for (uint8_t next = (hole + 1) & mask; index[next].used; next = (next + 1) & mask) {
+    uint8_t home = index[next].hash & mask;
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      index[hole] = index[next];
+      hole = next;
+    }
+  }
+  index[hole].used = false;
+  indexCount--;
+}
+
+void SDController::indexReset(bool built) {
+  for (uint8_t i = 0; i < kIndexSlots; i++) {
+    index[i].used = false;
+  }
+  indexCount = 0;
+  indexBuilt = built;
+  indexComplete = true;
+}
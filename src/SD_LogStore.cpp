@@ -0,0 +1,691 @@
+// SD_LogStore.cpp
+#include <SD_LogStore.h>
+#include <IR_Record.h>
+#include <SD_Compress.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t kEntryMagic = 0xA5;
+static const uint8_t kCheckpointMagic[] = {'L', 'I'};
+static const uint8_t kCheckpointVersion = 1;
+static const uint8_t kCheckpointHeaderSize = 20;
+static const uint8_t kCheckpointSlotSize = 10;
+// FILE_WRITE truncates on the ESP32, the log is updated in place.
+static const char *kReadWrite = "r+";
+
+static uint32_t getU32(const uint8_t *in) {
+  return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static void putU32(uint8_t *out, uint32_t value) {
+  out[0] = value;
+  out[1] = value >> 8;
+  out[2] = value >> 16;
+  out[3] = value >> 24;
+}
+
+// FNV-1a, the index keeps only this hash and confirms names on the card.
+static uint32_t hashName(const char *name) {
+  uint32_t hash = 2166136261u;
+  while (*name) {
+    hash = (hash ^ (uint8_t)*name++) * 16777619u;
+  }
+  return hash;
+}
+
+bool SDLogStore::BlockWriter::start(File &target, uint32_t offset) {
+  file = target;
+  blockOffset = offset - offset % kBlockSize;
+  used = offset % kBlockSize;
+  memset(block, 0, sizeof(block));
+  // The last block is rewritten as a whole, so keep what is already in it.
+  if (used != 0) {
+    return file.seek(blockOffset) && file.read(block, used) == used;
+  }
+  return true;
+}
+
+bool SDLogStore::BlockWriter::append(const uint8_t *data, size_t length) {
+  while (length > 0) {
+    size_t chunk = kBlockSize - used < length ? kBlockSize - used : length;
+    memcpy(block + used, data, chunk);
+    used += chunk;
+    data += chunk;
+    length -= chunk;
+    if (used == kBlockSize) {
+      if (!file.seek(blockOffset) || file.write(block, kBlockSize) != kBlockSize) {
+        return false;
+      }
+      blockOffset += kBlockSize;
+      used = 0;
+      memset(block, 0, sizeof(block));
+    }
+  }
+  return true;
+}
+
+bool SDLogStore::BlockWriter::commit() {
+  if (used != 0 && (!file.seek(blockOffset) || file.write(block, kBlockSize) != kBlockSize)) {
+    return false;
+  }
+  file.flush();
+  return true;
+}
+
+// Serialises the first eight bytes of an entry header.
+static void encodeHeader(uint8_t *out, uint8_t type, uint8_t nameLength, uint32_t dataLength,
+                         uint8_t flags = 0) {
+  out[0] = kEntryMagic;
+  out[1] = type;
+  out[2] = nameLength;
+  out[3] = flags;
+  putU32(out + 4, dataLength);
+}
+
+// CRC of the header and name, continued over the data by the caller.
+static uint32_t headerCrc(uint8_t type, const char *name, uint8_t nameLength,
+                          uint32_t dataLength, uint8_t flags = 0) {
+  uint8_t header[8];
+  encodeHeader(header, type, nameLength, dataLength, flags);
+  uint32_t crc = irrecord::crc32(header, sizeof(header));
+  return irrecord::crc32((const uint8_t *)name, nameLength, crc);
+}
+
+static uint32_t entryCrc(uint8_t type, const char *name, uint8_t nameLength,
+                         const uint8_t *data, uint32_t dataLength) {
+  return irrecord::crc32(data, dataLength, headerCrc(type, name, nameLength, dataLength));
+}
+
+// Runs compressor output through the entry CRC.
+class CrcPrint : public Print {
+  public:
+    CrcPrint(uint32_t crc) : crc(crc) {}
+    size_t write(uint8_t value) override { return write(&value, 1); }
+    size_t write(const uint8_t *data, size_t length) override {
+      crc = irrecord::crc32(data, length, crc);
+      return length;
+    }
+    uint32_t crc;
+};
+
+bool SDLogStore::isStoreFile(const char *name) {
+  // Paths are "/name", listings give just the name.
+  return strcmp(name, kLogPath + 1) == 0 || strcmp(name, kCompactPath + 1) == 0 ||
+         strcmp(name, kCheckpointPath + 1) == 0;
+}
+
+bool SDLogStore::begin(uint16_t slots) {
+  mounted = false;
+  if (slots == 0 || (slots & (slots - 1)) != 0) {
+    return false;
+  }
+
+  free(hashes);
+  free(offsets);
+  free(sizes);
+  free(moved);
+  hashes = (uint32_t *)malloc(slots * sizeof(uint32_t));
+  offsets = (uint32_t *)malloc(slots * sizeof(uint32_t));
+  sizes = (uint16_t *)malloc(slots * sizeof(uint16_t));
+  moved = (uint32_t *)malloc(slots * sizeof(uint32_t));
+  if (hashes == nullptr || offsets == nullptr || sizes == nullptr || moved == nullptr) {
+    slotCount = 0;
+    return false;
+  }
+  slotCount = slots;
+
+  mounted = mount();
+  return mounted;
+}
+
+void SDLogStore::end() {
+  if (compacting) {
+    compactWriter.file.close();
+    compacting = false;
+  }
+  log.close();
+  mounted = false;
+}
+
+bool SDLogStore::mount() {
+  memset(offsets, 0, slotCount * sizeof(uint32_t));
+  count = 0;
+  live = 0;
+  compacting = false;
+  writesSinceCheckpoint = 0;
+
+  // Finish or roll back a compaction that was cut short by a reset.
+  if (sd.fileExists(kCompactPath)) {
+    if (sd.fileExists(kLogPath)) {
+      sd.removeFile(kCompactPath);
+    } else {
+      sd.renameFile(kCompactPath, kLogPath);
+    }
+  }
+
+  if (!sd.fileExists(kLogPath)) {
+    File created = sd.openFile(kLogPath, FILE_WRITE);
+    if (!created) {
+      return false;
+    }
+    created.close();
+  }
+  log = sd.openFile(kLogPath, kReadWrite);
+  if (!log) {
+    return false;
+  }
+
+  uint32_t logSize = log.size();
+  uint8_t value[4];
+  if (logSize == 0) {
+    // A checkpoint left from an earlier log must not match this one.
+    sd.removeFile(kCheckpointPath);
+    generation = 1;
+    putU32(value, generation);
+    if (!tail.start(log, 0) || !appendEntry(tail, ENTRY_HEADER, "", value, sizeof(value)) ||
+        !tail.commit()) {
+      return false;
+    }
+    logEnd = tail.position();
+    return true;
+  }
+
+  // Refuse anything that does not start like one of our logs.
+  EntryHeader header;
+  char name[kMaxNameLength + 1];
+  if (!readHeader(log, 0, header, name) || header.type != ENTRY_HEADER ||
+      header.nameLength != 0 || header.dataLength != sizeof(value) ||
+      log.read(value, sizeof(value)) != sizeof(value) ||
+      entryCrc(header.type, name, 0, value, sizeof(value)) != header.crc) {
+    return false;
+  }
+  generation = getU32(value);
+
+  uint32_t replayFrom = loadCheckpoint(logSize) ? logEnd : (uint32_t)kHeaderEntrySize;
+  logEnd = scan(replayFrom, logSize);
+  if (!tail.start(log, logEnd)) {
+    return false;
+  }
+  if (logEnd != replayFrom) {
+    checkpoint();
+  }
+  return true;
+}
+
+bool SDLogStore::loadCheckpoint(uint32_t logSize) {
+  File file = sd.openFile(kCheckpointPath, FILE_READ);
+  if (!file) {
+    return false;
+  }
+
+  uint8_t head[kCheckpointHeaderSize];
+  bool valid = file.read(head, sizeof(head)) == sizeof(head) &&
+               head[0] == kCheckpointMagic[0] && head[1] == kCheckpointMagic[1] &&
+               head[2] == kCheckpointVersion && getU32(head + 4) == generation &&
+               getU32(head + 8) <= logSize;
+  uint16_t entries = head[12] | (head[13] << 8);
+  if (!valid || entries > slotCount / 4 * 3) {
+    file.close();
+    return false;
+  }
+
+  uint32_t crc = irrecord::crc32(head, sizeof(head));
+  uint8_t slot[kCheckpointSlotSize];
+  for (uint16_t i = 0; i < entries && valid; i++) {
+    valid = file.read(slot, sizeof(slot)) == sizeof(slot);
+    crc = irrecord::crc32(slot, sizeof(slot), crc);
+    if (valid) {
+      insert(getU32(slot), getU32(slot + 4), slot[8] | (slot[9] << 8));
+    }
+  }
+  uint8_t stored[4];
+  valid = valid && file.read(stored, sizeof(stored)) == sizeof(stored) &&
+          getU32(stored) == crc && getU32(head + 16) == live;
+  file.close();
+
+  if (!valid) {
+    memset(offsets, 0, slotCount * sizeof(uint32_t));
+    count = 0;
+    live = 0;
+    return false;
+  }
+  logEnd = getU32(head + 8);
+  return true;
+}
+
+uint32_t SDLogStore::scan(uint32_t from, uint32_t logSize) {
+  uint32_t offset = from;
+  EntryHeader header;
+  char name[kMaxNameLength + 1];
+  while (offset + kEntryHeaderSize <= logSize && readHeader(log, offset, header, name) &&
+         offset + header.size() <= logSize && verify(log, offset, header)) {
+    uint32_t hash = hashName(name);
+    int32_t slot = header.type == ENTRY_HEADER ? -1 : find(name, hash);
+    if (header.type == ENTRY_PUT && slot >= 0) {
+      live += header.size() - sizes[slot];
+      offsets[slot] = offset;
+      sizes[slot] = header.size();
+    } else if (header.type == ENTRY_PUT && count < slotCount / 4 * 3) {
+      insert(hash, offset, header.size());
+    } else if (header.type == ENTRY_DELETE && slot >= 0) {
+      erase(slot);
+    }
+    offset += header.size();
+  }
+  return offset;
+}
+
+bool SDLogStore::readHeader(File &file, uint32_t offset, EntryHeader &header, char *name) {
+  uint8_t bytes[kEntryHeaderSize];
+  if (!file.seek(offset) || file.read(bytes, sizeof(bytes)) != sizeof(bytes) ||
+      bytes[0] != kEntryMagic || bytes[1] < ENTRY_PUT || bytes[1] > ENTRY_HEADER ||
+      bytes[2] > kMaxNameLength || (bytes[3] & ~kEntryCompressed) != 0) {
+    return false;
+  }
+
+  header.type = bytes[1];
+  header.flags = bytes[3];
+  header.nameLength = bytes[2];
+  header.dataLength = getU32(bytes + 4);
+  header.crc = getU32(bytes + 8);
+  if (header.dataLength > kMaxDataLength ||
+      file.read((uint8_t *)name, header.nameLength) != header.nameLength) {
+    return false;
+  }
+  name[header.nameLength] = '\0';
+  return true;
+}
+
+bool SDLogStore::verify(File &file, uint32_t offset, const EntryHeader &header) {
+  char name[kMaxNameLength + 1];
+  uint8_t bytes[8];
+  encodeHeader(bytes, header.type, header.nameLength, header.dataLength, header.flags);
+  uint32_t crc = irrecord::crc32(bytes, sizeof(bytes));
+
+  // Name and data follow the header back to back.
+  if (!file.seek(offset + kEntryHeaderSize) ||
+      file.read((uint8_t *)name, header.nameLength) != header.nameLength) {
+    return false;
+  }
+  crc = irrecord::crc32((const uint8_t *)name, header.nameLength, crc);
+
+  uint8_t chunk[64];
+  for (uint32_t done = 0; done < header.dataLength;) {
+    size_t length = header.dataLength - done < sizeof(chunk) ? header.dataLength - done : sizeof(chunk);
+    if (file.read(chunk, length) != length) {
+      return false;
+    }
+    crc = irrecord::crc32(chunk, length, crc);
+    done += length;
+  }
+  return crc == header.crc;
+}
+
+bool SDLogStore::appendEntry(BlockWriter &writer, uint8_t type, const char *name,
+                             const uint8_t *data, size_t length) {
+  uint8_t nameLength = strlen(name);
+  uint8_t header[kEntryHeaderSize];
+  encodeHeader(header, type, nameLength, length);
+  putU32(header + 8, entryCrc(type, name, nameLength, data, length));
+
+  uint32_t start = writer.position();
+  if (writer.append(header, sizeof(header)) &&
+      writer.append((const uint8_t *)name, nameLength) &&
+      writer.append(data, length)) {
+    return true;
+  }
+  // Forget the partial entry, the next one is written over it.
+  writer.start(writer.file, start);
+  return false;
+}
+
+bool SDLogStore::contains(const char *name) {
+  return mounted && find(name, hashName(name)) >= 0;
+}
+
+bool SDLogStore::get(const char *name, uint8_t *buffer, size_t capacity, size_t &length) {
+  length = 0;
+  int32_t slot = mounted ? find(name, hashName(name)) : -1;
+  if (slot < 0) {
+    return false;
+  }
+
+  EntryHeader header;
+  char stored[kMaxNameLength + 1];
+  if (!readHeader(log, offsets[slot], header, stored)) {
+    return false;
+  }
+  if (header.flags & kEntryCompressed) {
+    return getCompressed(header, stored, buffer, capacity, length);
+  }
+  if (header.dataLength > capacity ||
+      log.read(buffer, header.dataLength) != header.dataLength ||
+      entryCrc(header.type, stored, header.nameLength, buffer, header.dataLength) != header.crc) {
+    return false;
+  }
+  length = header.dataLength;
+  return true;
+}
+
+bool SDLogStore::getCompressed(const EntryHeader &header, const char *name, uint8_t *buffer,
+                               size_t capacity, size_t &length) {
+  // The log is positioned at the data. Check and unpack it as it streams in.
+  uint32_t crc = headerCrc(header.type, name, header.nameLength, header.dataLength, header.flags);
+  sdcompress::Decompressor lz(buffer, capacity);
+  uint8_t chunk[128];
+  bool fed = true;
+  for (uint32_t done = 0; fed && done < header.dataLength;) {
+    size_t part = header.dataLength - done < sizeof(chunk) ? header.dataLength - done : sizeof(chunk);
+    fed = log.read(chunk, part) == part && lz.feed(chunk, part);
+    crc = irrecord::crc32(chunk, part, crc);
+    done += part;
+  }
+  if (!fed || crc != header.crc || !lz.finish()) {
+    return false;
+  }
+  length = lz.length();
+  return true;
+}
+
+bool SDLogStore::put(const char *name, const uint8_t *data, size_t length, bool compress) {
+  size_t nameLength = strlen(name);
+  if (!mounted || nameLength == 0 || nameLength > kMaxNameLength || length > kMaxDataLength) {
+    return false;
+  }
+
+  uint32_t hash = hashName(name);
+  int32_t slot = find(name, hash);
+  if (slot < 0 && count >= slotCount / 4 * 3) {
+    return false;  // Index is full.
+  }
+
+  uint32_t offset = tail.position();
+  if (!(compress && appendCompressed(name, data, length)) &&
+      !appendEntry(tail, ENTRY_PUT, name, data, length)) {
+    return false;
+  }
+  if (!tail.commit()) {
+    return false;
+  }
+  uint32_t size = tail.position() - offset;
+  logEnd = tail.position();
+
+  if (slot >= 0) {
+    live += size - sizes[slot];
+    offsets[slot] = offset;
+    sizes[slot] = size;
+  } else {
+    insert(hash, offset, size);
+  }
+  wrote();
+  return true;
+}
+
+bool SDLogStore::appendCompressed(const char *name, const uint8_t *data, size_t length) {
+  // The header carries the compressed length and a CRC over the compressed
+  // bytes, so compress once to size it, once for the CRC and once to write.
+  // That is still cheap next to the card write.
+  sdcompress::CountingPrint packed;
+  if (sdcompress::compress(data, length, packed) == 0 || packed.count >= length) {
+    return false;  // Stored as it is.
+  }
+  uint8_t nameLength = strlen(name);
+  CrcPrint crc(headerCrc(ENTRY_PUT, name, nameLength, packed.count, kEntryCompressed));
+  sdcompress::compress(data, length, crc);
+
+  uint8_t header[kEntryHeaderSize];
+  encodeHeader(header, ENTRY_PUT, nameLength, packed.count, kEntryCompressed);
+  putU32(header + 8, crc.crc);
+  uint32_t start = tail.position();
+  if (tail.append(header, sizeof(header)) &&
+      tail.append((const uint8_t *)name, nameLength) &&
+      sdcompress::compress(data, length, tail) == packed.count) {
+    return true;
+  }
+  tail.start(tail.file, start);
+  return false;
+}
+
+bool SDLogStore::remove(const char *name) {
+  int32_t slot = mounted ? find(name, hashName(name)) : -1;
+  if (slot < 0) {
+    return false;
+  }
+
+  if (!appendEntry(tail, ENTRY_DELETE, name, nullptr, 0) || !tail.commit()) {
+    return false;
+  }
+  logEnd = tail.position();
+  erase(slot);
+  wrote();
+  return true;
+}
+
+void SDLogStore::list(void (*callback)(const char *name, void *context), void *context) {
+  EntryHeader header;
+  char name[kMaxNameLength + 1];
+  for (uint16_t slot = 0; mounted && slot < slotCount; slot++) {
+    if (offsets[slot] != kEmptySlot && readHeader(log, offsets[slot], header, name)) {
+      callback(name, context);
+    }
+  }
+}
+
+bool SDLogStore::checkpoint() {
+  if (!mounted) {
+    return false;
+  }
+  File file = sd.openFile(kCheckpointPath, FILE_WRITE);
+  if (!file) {
+    return false;
+  }
+
+  uint8_t head[kCheckpointHeaderSize] = {kCheckpointMagic[0], kCheckpointMagic[1], kCheckpointVersion};
+  putU32(head + 4, generation);
+  putU32(head + 8, logEnd);
+  head[12] = count;
+  head[13] = count >> 8;
+  putU32(head + 16, live);
+  bool written = file.write(head, sizeof(head)) == sizeof(head);
+  uint32_t crc = irrecord::crc32(head, sizeof(head));
+
+  // Batch the slots so the card sees a few large writes.
+  uint8_t batch[16 * kCheckpointSlotSize];
+  size_t used = 0;
+  for (uint16_t slot = 0; slot < slotCount && written; slot++) {
+    if (offsets[slot] == kEmptySlot) {
+      continue;
+    }
+    putU32(batch + used, hashes[slot]);
+    putU32(batch + used + 4, offsets[slot]);
+    batch[used + 8] = sizes[slot];
+    batch[used + 9] = sizes[slot] >> 8;
+    used += kCheckpointSlotSize;
+    if (used == sizeof(batch)) {
+      written = file.write(batch, used) == used;
+      crc = irrecord::crc32(batch, used, crc);
+      used = 0;
+    }
+  }
+  written = written && file.write(batch, used) == used;
+  crc = irrecord::crc32(batch, used, crc);
+  uint8_t stored[4];
+  putU32(stored, crc);
+  written = written && file.write(stored, sizeof(stored)) == sizeof(stored);
+  file.close();
+
+  if (written) {
+    writesSinceCheckpoint = 0;
+  }
+  return written;
+}
+
+void SDLogStore::wrote() {
+  if (++writesSinceCheckpoint >= kCheckpointInterval) {
+    checkpoint();
+  }
+}
+
+bool SDLogStore::needsCompaction() const {
+  return mounted && (compacting || (deadBytes() >= kCompactThreshold && deadBytes() > live));
+}
+
+bool SDLogStore::compactStep() {
+  if (!needsCompaction()) {
+    return false;
+  }
+
+  if (!compacting) {
+    File target = sd.openFile(kCompactPath, FILE_WRITE);
+    uint8_t value[4];
+    putU32(value, generation + 1);
+    if (!target || !compactWriter.start(target, 0) ||
+        !appendEntry(compactWriter, ENTRY_HEADER, "", value, sizeof(value))) {
+      target.close();
+      sd.removeFile(kCompactPath);
+      return false;
+    }
+    compactRead = kHeaderEntrySize;
+    compactStart = logEnd;
+    compacting = true;
+    return true;
+  }
+
+  if (compactRead >= logEnd) {
+    finishCompaction();
+    return false;
+  }
+
+  // Only the newest entry of each live name is carried over. Entries written
+  // while compacting land behind compactRead and are picked up on the way.
+  // Deletes among them are carried over too: the entry they remove may have
+  // been copied already, and would come back with the next scan of the log.
+  EntryHeader header;
+  char name[kMaxNameLength + 1];
+  bool copied = readHeader(log, compactRead, header, name);
+  if (copied && header.type == ENTRY_PUT) {
+    int32_t slot = findOffset(hashName(name), compactRead);
+    if (slot >= 0) {
+      moved[slot] = compactWriter.position();
+      copied = copyEntry(compactRead, header, name);
+    }
+  } else if (copied && header.type == ENTRY_DELETE && compactRead >= compactStart) {
+    copied = copyEntry(compactRead, header, name);
+  }
+  if (!copied) {
+    compactWriter.file.close();
+    sd.removeFile(kCompactPath);
+    compacting = false;
+    return false;
+  }
+  compactRead += header.size();
+  return true;
+}
+
+bool SDLogStore::copyEntry(uint32_t from, const EntryHeader &header, const char *name) {
+  uint8_t bytes[kEntryHeaderSize];
+  encodeHeader(bytes, header.type, header.nameLength, header.dataLength, header.flags);
+  putU32(bytes + 8, header.crc);
+  if (!compactWriter.append(bytes, sizeof(bytes)) ||
+      !compactWriter.append((const uint8_t *)name, header.nameLength)) {
+    return false;
+  }
+
+  uint8_t chunk[128];
+  uint32_t offset = from + kEntryHeaderSize + header.nameLength;
+  for (uint32_t done = 0; done < header.dataLength;) {
+    size_t length = header.dataLength - done < sizeof(chunk) ? header.dataLength - done : sizeof(chunk);
+    if (!log.seek(offset + done) || log.read(chunk, length) != length ||
+        !compactWriter.append(chunk, length)) {
+      return false;
+    }
+    done += length;
+  }
+  return true;
+}
+
+void SDLogStore::finishCompaction() {
+  bool complete = compactWriter.commit();
+  uint32_t compactEnd = compactWriter.position();
+  compactWriter.file.close();
+  compacting = false;
+  if (!complete) {
+    sd.removeFile(kCompactPath);
+    return;
+  }
+
+  // Swap the logs. mount() sorts out a reset half way through.
+  log.close();
+  if (!sd.removeFile(kLogPath) || !sd.renameFile(kCompactPath, kLogPath)) {
+    mounted = mount();
+    return;
+  }
+  for (uint16_t slot = 0; slot < slotCount; slot++) {
+    if (offsets[slot] != kEmptySlot) {
+      offsets[slot] = moved[slot];
+    }
+  }
+  generation++;
+  logEnd = compactEnd;
+  log = sd.openFile(kLogPath, kReadWrite);
+  mounted = log && tail.start(log, logEnd);
+  if (mounted) {
+    checkpoint();
+  }
+}
+
+int32_t SDLogStore::find(const char *name, uint32_t hash) {
+  EntryHeader header;
+  char stored[kMaxNameLength + 1];
+  uint16_t mask = slotCount - 1;
+  for (uint16_t slot = home(hash); offsets[slot] != kEmptySlot; slot = (slot + 1) & mask) {
+    if (hashes[slot] == hash && readHeader(log, offsets[slot], header, stored) &&
+        strcmp(stored, name) == 0) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+int32_t SDLogStore::findOffset(uint32_t hash, uint32_t offset) const {
+  uint16_t mask = slotCount - 1;
+  for (uint16_t slot = home(hash); offsets[slot] != kEmptySlot; slot = (slot + 1) & mask) {
+    if (offsets[slot] == offset) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+void SDLogStore::insert(uint32_t hash, uint32_t offset, uint32_t size) {
+  uint16_t mask = slotCount - 1;
+  uint16_t slot = home(hash);
+  while (offsets[slot] != kEmptySlot) {
+    slot = (slot + 1) & mask;
+  }
+  hashes[slot] = hash;
+  offsets[slot] = offset;
+  sizes[slot] = size;
+  count++;
+  live += size;
+}
+
+void SDLogStore::erase(uint16_t slot) {
+  live -= sizes[slot];
+  count--;
+
+  // Shift later members of the probe run back into the hole, so lookups
+  // never need tombstones.
+  uint16_t mask = slotCount - 1;
+  uint16_t hole = slot;
+  for (uint16_t next = (hole + 1) & mask; offsets[next] != kEmptySlot; next = (next + 1) & mask) {
+    if (((next - home(hashes[next])) & mask) >= ((next - hole) & mask)) {
+      hashes[hole] = hashes[next];
+      offsets[hole] = offsets[next];
+      sizes[hole] = sizes[next];
+      moved[hole] = moved[next];
+      hole = next;
+    }
+  }
+  offsets[hole] = kEmptySlot;
+}
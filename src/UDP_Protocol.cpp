@@ -0,0 +1,113 @@
+// UDP_Protocol.cpp
+#include <UDP_Protocol.h>
+#include <IR_Record.h>
+#include <string.h>
+
+namespace udpproto {
+
+static uint16_t getU16(const uint8_t *in) {
+  return in[0] | (in[1] << 8);
+}
+
+static uint32_t getU32(const uint8_t *in) {
+  return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static void putU16(uint8_t *out, uint16_t value) {
+  out[0] = value & 0xFF;
+  out[1] = value >> 8;
+}
+
+static void putU32(uint8_t *out, uint32_t value) {
+  putU16(out, value & 0xFFFF);
+  putU16(out + 2, value >> 16);
+}
+
+FrameStatus parseFrame(const uint8_t *data, size_t length, Frame &frame) {
+  if (length < kFrameHeaderSize) {
+    return FRAME_TOO_SHORT;
+  }
+  if (data[0] != kFrameMagic[0] || data[1] != kFrameMagic[1]) {
+    return FRAME_BAD_MAGIC;
+  }
+  if (data[2] != kProtocolVersion) {
+    return FRAME_BAD_VERSION;
+  }
+  uint16_t payloadLength = getU16(data + 6);
+  if (length < kFrameHeaderSize + payloadLength) {
+    return FRAME_TOO_SHORT;
+  }
+  if (length > kFrameHeaderSize + payloadLength || length > kMaxFrameSize) {
+    return FRAME_BAD_LENGTH;
+  }
+  uint32_t crc = irrecord::crc32(data, 8);
+  if (irrecord::crc32(data + kFrameHeaderSize, payloadLength, crc) != getU32(data + 8)) {
+    return FRAME_BAD_CRC;
+  }
+
+  frame.opcode = data[3];
+  frame.sequence = getU16(data + 4);
+  frame.payload = data + kFrameHeaderSize;
+  frame.length = payloadLength;
+  frame.origin = 0;
+  return FRAME_OK;
+}
+
+size_t encodeFrame(uint8_t *out, size_t capacity, uint8_t opcode, uint16_t sequence,
+                   const uint8_t *payload, size_t length) {
+  size_t size = kFrameHeaderSize + length;
+  if (length > kMaxPayloadSize || size > capacity) {
+    return 0;
+  }
+
+  out[0] = kFrameMagic[0];
+  out[1] = kFrameMagic[1];
+  out[2] = kProtocolVersion;
+  out[3] = opcode;
+  putU16(out + 4, sequence);
+  putU16(out + 6, length);
+  if (length != 0) {
+    memcpy(out + kFrameHeaderSize, payload, length);
+  }
+  uint32_t crc = irrecord::crc32(out, 8);
+  putU32(out + 8, irrecord::crc32(out + kFrameHeaderSize, length, crc));
+  return size;
+}
+
+bool payloadText(const Frame &frame, char *out, size_t capacity) {
+  if (frame.length >= capacity || memchr(frame.payload, 0, frame.length) != nullptr) {
+    return false;
+  }
+  memcpy(out, frame.payload, frame.length);
+  out[frame.length] = '\0';
+  return true;
+}
+
+void FrameDispatcher::on(uint8_t opcode, FrameHandler handler, void *context) {
+  if (opcode < kOpcodeLimit) {
+    routes[opcode].handler = handler;
+    routes[opcode].context = context;
+  }
+}
+
+FrameStatus FrameDispatcher::dispatch(const Frame &frame) {
+  if (frame.opcode >= kOpcodeLimit || routes[frame.opcode].handler == nullptr) {
+    counts[FRAME_UNHANDLED]++;
+    return FRAME_UNHANDLED;
+  }
+  counts[FRAME_OK]++;
+  routes[frame.opcode].handler(frame, routes[frame.opcode].context);
+  return FRAME_OK;
+}
+
+FrameStatus FrameDispatcher::dispatch(const uint8_t *data, size_t length) {
+  Frame frame;
+  FrameStatus status = parseFrame(data, length, frame);
+  if (status != FRAME_OK) {
+    counts[status]++;
+    return status;
+  }
+  return dispatch(frame);
+}
+
+}  // namespace udpproto
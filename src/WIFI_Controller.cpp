@@ -13,6 +13,8 @@
  **/
 
 #include <WIFI_Controller.h>
+#include <Event_Log.h>
+#include <algorithm>
 
 #ifdef EASYDEBUG
 void log(String data) {
@@ -43,205 +45,524 @@ void WifiController::init() {
 }
 #pragma endregion
 
-#pragma region WifiController::sendMessage()
+#pragma region WifiController::sendFrame()
 /**
- * @brief Sends a message to a specific client over the UDP protocol
+ * @brief Sends a frame to a connected client over the UDP protocol
  * 
- * This function sends the message specified in the input to a client identified by its IP address and port. The message
- * is sent using the UDP protocol.
+ * This function wraps the payload in a frame (see UDP_Protocol.h) in the transmit buffer and sends it to the client
+ * identified by its id in the client table, as a single datagram.
  * 
- * @param message A reference to a String object that contains the message to be sent
- * @return An integer indicating the number of bytes sent. Returns 0 if the sending process fails.
+ * @param id The id of the client
+ * @param opcode The opcode of the frame
+ * @param sequence The sequence number, that of the request when answering one
+ * @param payload The payload, may be `nullptr` if `length` is 0
+ * @param length The size of the payload in bytes, at most udpproto::kMaxPayloadSize
+ * @return `true` if the frame was sent.
  */
-int WifiController::sendMessage(String& message) {
+bool WifiController::sendFrame(uint16_t id, uint8_t opcode, uint16_t sequence, const uint8_t* payload, size_t length) {
+    size_t size = udpproto::encodeFrame(txBuffer, sizeof(txBuffer), opcode, sequence, payload, length);
+    bool sent = size != 0 && sendDatagram(id, txBuffer, size);
 #ifdef EASYDEBUG
-    Serial.println("WiFi - Sending message with data :" + message);
+    if (!sent) {
+        Serial.printf("WiFi - Sending frame 0x%02x failed...\n", opcode);
+    }
 #endif
-    int result = 0;
-    // Begin sending a packet to the specified client's IP address and port
-    if (udp.beginPacket(client.ip, client.port)) {
-        // Write the message to the packet
-        result = udp.write((uint8_t*) message.c_str(), message.length());
-        // End the packet and send it
-        if (!udp.endPacket()) {
-            result = 0; // Return 0 if the packet was not successfully sent
-        }
+    return sent;
+}
+#pragma endregion
+
+#pragma region WifiController::sendReliable()
+/**
+ * @brief Sends a frame to a connected client and keeps sending it until the client acknowledges it
+ * 
+ * The encoded frame is kept in the retransmission queue under the client's id and `sequence`, and sent again from
+ * serviceClients() whenever the client's retransmission timeout runs out (see UDP_Reliable.h). If the frame does not
+ * fit in a slot or every slot is taken it is only sent once, and counted as undelivered.
+ * 
+ * @param id The id of the client
+ * @param opcode The opcode of the frame
+ * @param sequence The sequence number the client acknowledges
+ * @param payload The payload, may be `nullptr` if `length` is 0
+ * @param length The size of the payload in bytes, at most udpproto::kMaxPayloadSize
+ * @return `true` if the frame was sent the first time.
+ */
+bool WifiController::sendReliable(uint16_t id, uint8_t opcode, uint16_t sequence, const uint8_t* payload, size_t length) {
+    size_t size = udpproto::encodeFrame(txBuffer, sizeof(txBuffer), opcode, sequence, payload, length);
+    if (size == 0) {
+        return false;
     }
+    if (!retransmits.add(id, sequence, txBuffer, size, millis(), clients[id].rtt.timeout())) {
+        undelivered++;
 #ifdef EASYDEBUG
-    if(result == 0) {
-        Serial.println("WiFi - Sending message failed...");
-    } else {
-        Serial.println("WiFi - Sending message done...");
+        Serial.printf("WiFi - No room to keep frame 0x%02x, sending it once\n", opcode);
+#endif
     }
+    return sendDatagram(id, txBuffer, size);
+}
+#pragma endregion
+
+#pragma region WifiController::sendDatagram()
+/**
+ * @brief Sends an encoded frame to a connected client as a single datagram
+ * 
+ * @param id The id of the client
+ * @param data The frame
+ * @param size The size of the frame in bytes
+ * @return `true` if the datagram was sent.
+ */
+bool WifiController::sendDatagram(uint16_t id, const uint8_t* data, size_t size) {
+    return sendPacket(clients[id].ip, clients[id].port, data, size);
+}
+#pragma endregion
+
+#pragma region WifiController::sendPacket()
+/**
+ * @brief Sends a datagram from the UDP socket
+ * 
+ * @param ip The destination IP address, first octet in the low byte as IPAddress keeps it
+ * @param port The destination port
+ * @param data The datagram
+ * @param size The size of the datagram in bytes
+ * @return `true` if the datagram was sent.
+ */
+bool WifiController::sendPacket(uint32_t ip, uint16_t port, const uint8_t* data, size_t size) {
+    if (sock < 0) {
+        return false;
+    }
+    struct sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(port);
+    to.sin_addr.s_addr = ip; // Already in network order
+    return sendto(sock, data, size, 0, (struct sockaddr*) &to, sizeof(to)) == (int) size;
+}
+#pragma endregion
+
+#pragma region WifiController::reply()
+/**
+ * @brief Answers a request with an OP_REPLY frame carrying `text`.
+ * 
+ * The reply goes to the client the request came from, as recorded in its `origin`, so requests can be answered in
+ * any order while their buffers are held. Nothing is sent if that client was dropped in the meantime. The reply is
+ * sent again until the client acknowledges it, see sendReliable().
+ * 
+ * @param request The frame being answered, its sequence number is echoed
+ * @param text The reply, sent without its terminator
+ * @return `true` if the reply was sent.
+ */
+bool WifiController::reply(const udpproto::Frame& request, const char* text) {
+    if (request.origin == clients.kNoClient) {
+        return false;
+    }
+    return sendReliable(request.origin, udpproto::OP_REPLY, request.sequence, (const uint8_t*) text, strlen(text));
+}
+#pragma endregion
+
+#pragma region WifiController::notify()
+/**
+ * @brief Tells every connected client something finished with an OP_NOTIFY frame carrying `text`.
+ * 
+ * Tickets and names in notifications are global, so each client picks out its own. Every client numbers the
+ * notifications it gets one after the other.
+ * 
+ * @param text The notification, sent without its terminator
+ * @return `true` if the notification was sent to every client.
+ */
+bool WifiController::notify(const char* text) {
+    bool sent = true;
+    for (uint16_t i = 0; i < clients.size(); i++) {
+        uint16_t id = clients.client(i);
+        sent &= sendFrame(id, udpproto::OP_NOTIFY, ++clients[id].txSequence, (const uint8_t*) text, strlen(text));
+    }
+    return sent;
+}
+#pragma endregion
+
+#pragma region WifiController::receiveDatagram()
+/**
+ * @brief Checks a datagram just read into `buffer` and its frame
+ * 
+ * This function first verifies that the last octet of the sender's IP is not 255 and that it's different from the
+ * local IP address. If the verification is successful, the frame is checked where it lies in `buffer`, without
+ * copying it anywhere else.
+ * 
+ * Datagrams that are too large or do not hold a valid frame are dropped and counted.
+ * 
+ * @param buffer The receive buffer the datagram was read into, from `remoteIp`:`remotePort`
+ * @param length The size of the datagram, more than `kMaxFrameSize` if it did not fit
+ * @param frame Set to the received frame, valid as long as `buffer` is
+ * @return `true` if a valid frame was received.
+ */
+bool WifiController::receiveDatagram(const uint8_t* buffer, int length, udpproto::Frame& frame) {
+    IPAddress senderIP(remoteIp);
+    // Check if the last octet of the sender IP is not 255 and that it's different from the local IP address
+    if (senderIP[3] == 255 || senderIP[3] == WiFi.localIP()[3]) {
+        return false;
+    }
+    if ((size_t) length > udpproto::kMaxFrameSize) {
+        badFrames++; // Too large to be a frame, the rest of the datagram was discarded
+        return false;
+    }
+
+    udpproto::FrameStatus status = udpproto::parseFrame(buffer, length, frame);
+    if (status != udpproto::FRAME_OK) {
+        badFrames++;
+#ifdef EASYDEBUG
+        Serial.printf("WiFi - Dropped a bad frame from %s, status %d\n", senderIP.toString().c_str(), status);
 #endif
-    return result;
+        return false;
+    }
+    return true;
 }
 #pragma endregion
 
-#pragma region WifiController::receiveMessage()
+#pragma region WifiController::registerClient()
 /**
- * @brief Receives a message sent over the UDP protocol
+ * @brief Registers the sender of an OP_HELLO frame as a client if it knows the `PASS_PHRASE`.
  * 
- * This function receives a message sent over the UDP protocol and stores it in the `receivedMsg` input. The function 
- * first checks the size of the incoming packet and then, if it's not empty, retrieves the sender's IP address. The
- * function then verifies if the last octet of the sender's IP is not 255 and that it's different from the local IP
- * address. If the verification is successful, the function reads the packet and stores it in the `receivedMsg` input,
- * returning the size of the packet.
+ * The sender's IP address and port get a fresh session in the client table, the client is welcomed with an
+ * OP_WELCOME frame and its heartbeat starts from the current time. A client that says hello again, or whose hello was
+ * repeated or arrived late, is welcomed again but keeps its command window, so commands it already sent are not run a
+ * second time; one that reconnects from a new port is a new client, the old session expires on its own.
  * 
- * @param receivedMsg A reference to a String object that will store the received message
- * @return The size of the received packet. Returns 0 if the packet is empty or if the sender's IP address is not valid.
+ * @param frame The OP_HELLO frame
+ * @return `true` if the client was registered, `false` if the pass phrase did not match or the table is full.
  */
-int WifiController::receiveMessage(String& receivedMsg) {
-    int packetSize = udp.parsePacket(); // Get the size of the incoming packet
-    if (packetSize) { // If the packet is not empty
+bool WifiController::registerClient(const udpproto::Frame& frame) {
+    size_t phraseLength = strlen(PASS_PHRASE);
+    if (frame.length != phraseLength || memcmp(frame.payload, PASS_PHRASE, phraseLength) != 0) {
+        return false;
+    }
+
+    uint32_t ip = remoteIp;
+    uint16_t port = remotePort;
+    bool known = clients.find(ip, port) != clients.kNoClient;
+    uint16_t id = clients.add(ip, port);
+    if (id == clients.kNoClient) {
 #ifdef EASYDEBUG
-        Serial.println("WiFi - Recieving message...");
+        Serial.println("WiFi - Client table full, turned away " + IPAddress(ip).toString());
 #endif
-        IPAddress senderIP = udp.remoteIP(); // Retrieve the sender's IP address
+        return false;
+    }
+
+    ClientSession& session = clients[id];
+    if (!known) {
 #ifdef EASYDEBUG
-        Serial.println("WiFi - On client IP :" + senderIP.toString());
+        Serial.println("client ip: " + IPAddress(ip).toString() + " client port: " + String(port));
 #endif
-        // Check if the last octet of the sender IP is not 255 and that it's different from the local IP address
-        if (senderIP[3] != 255 && senderIP[3] != WiFi.localIP()[3]) {
-            char buffer[packetSize + 1]; // Create a buffer to store the received message
-            int len = udp.read((unsigned char*) buffer, packetSize); // Read the packet
-            buffer[len] = '\0'; // Terminate the string
-            receivedMsg = String(buffer); // Store the received message in the input
+        events.log(eventlog::EVENT_CLIENT_CONNECTED, ip, port);
+        session.commands.reset(frame.sequence); // Its commands are numbered on from its hello
+        retransmits.forget(id); // Nothing is awaited from a new client
+    }
+    unsigned long now = millis();
+    session.lastHeard = now; // The client was just heard from
+    session.heartbeat = HEARTBEAT_IDLE;
+    session.missedPongs = 0;
+    clientTimers.schedule(id, now + HEARTBEAT_INTERVAL_MS);
+    sendFrame(id, udpproto::OP_WELCOME, frame.sequence); // Send a message back to the client
+    return true;
+}
+#pragma endregion
+
+#pragma region WifiController::dropClient()
+/**
+ * @brief Forgets a client, freeing its slot in the client table.
+ * 
+ * @param id The id of the client
+ */
+void WifiController::dropClient(uint16_t id) {
 #ifdef EASYDEBUG
-            Serial.println("WiFi - Message recived :" + receivedMsg);
+    Serial.println("WiFi - Lost connection to client " + IPAddress(clients[id].ip).toString());
 #endif
-            return packetSize; // Return the size of the packet
+    events.log(eventlog::EVENT_CLIENT_LOST, clients[id].ip, clients[id].port);
+    clientTimers.cancel(id);
+    retransmits.forget(id);
+    clients.remove(id);
+    // Its id may go to the next client, whose replies must not go to this one's requests
+    for (uint8_t i = 0; i < pendingCount; i++) {
+        udpproto::Frame& frame = pending[(pendingHead + i) % RX_BUFFERS].frame;
+        if (frame.origin == id) {
+            frame.origin = clients.kNoClient;
         }
     }
-    return 0; // Return 0 if the packet is empty or if the sender's IP address is not valid
 }
+#pragma endregion
 
+#pragma region WifiController::acceptFrame()
+/**
+ * @brief Handles the session side of a frame and tells whether it is a command
+ * 
+ * The sender is looked up in the client table by IP address and port. Every frame from a client proves it is still
+ * there and settles its heartbeat. Session frames are handled here and never handed on: an OP_PONG only answers our
+ * ping, an OP_PING is answered with an OP_PONG, an OP_ACK settles one of our replies and an OP_HELLO with the pass
+ * phrase registers its sender. An OP_DISCOVER from anyone is answered with an OP_ANNOUNCE while there is room for
+ * another client, rate limited per sender. Other frames from anyone not registered are dropped.
+ * 
+ * Every command frame is acknowledged with an OP_ACK covering all the client's commands that arrived so far, but only
+ * passed on the first time it arrives; repeats are counted and dropped, so a command the client had to send again
+ * runs exactly once. Commands too far ahead of one still missing are dropped without an acknowledgement.
+ * 
+ * @param frame A frame just received, its `origin` is set to the id of its sender
+ * @return `true` if it is a command frame from a connected client.
+ */
+bool WifiController::acceptFrame(udpproto::Frame& frame) {
+    frame.origin = clients.kNoClient;
+    if (frame.opcode == udpproto::OP_HELLO) {
+        registerClient(frame);
+        return false;
+    }
+    if (frame.opcode == udpproto::OP_DISCOVER) {
+        if (!clients.isFull()) {
+            discovery.answer(frame, remoteIp, remotePort, millis());
+        }
+        return false;
+    }
+    uint16_t id = clients.find(remoteIp, remotePort);
+    if (id == clients.kNoClient) {
+        return false;
+    }
+
+    // Any traffic from the client counts as liveness. An idle client's timer is left alone, it checks lastHeard
+    // when it fires; one waiting for a pong goes back to the normal interval.
+    ClientSession& session = clients[id];
+    session.lastHeard = millis();
+    if (session.heartbeat == HEARTBEAT_AWAITING_PONG) {
+        session.heartbeat = HEARTBEAT_IDLE;
+        session.missedPongs = 0;
+        clientTimers.schedule(id, session.lastHeard + HEARTBEAT_INTERVAL_MS);
+    }
+    switch (frame.opcode) {
+        case udpproto::OP_PONG:
+            return false; // Only an answer to our ping, not a command
+        case udpproto::OP_PING:
+            sendFrame(id, udpproto::OP_PONG, frame.sequence);
+            return false;
+        case udpproto::OP_ACK: {
+            // Time the reply, unless it was sent more than once and the acknowledgement could be for any of them
+            int32_t rtt = retransmits.acknowledge(id, frame.sequence, session.lastHeard);
+            if (rtt >= 0) {
+                session.rtt.sample(rtt);
+            }
+            return false;
+        }
+        default:
+            break;
+    }
+
+    udpproto::Arrival arrival = session.commands.accept(frame.sequence);
+    if (arrival == udpproto::ARRIVAL_AHEAD) {
+        return false; // Sent again once the ones before it are in
+    }
+    sendFrame(id, udpproto::OP_ACK, session.commands.cumulative());
+    if (arrival == udpproto::ARRIVAL_DUPLICATE) {
+        duplicates++; // Our acknowledgement was lost, the command already ran
+        return false;
+    }
+    frame.origin = id;
+    return true;
+}
 #pragma endregion
 
-#pragma region WifiController::checkIncomingClients()
+#pragma region WifiController::receivePackets()
 /**
- * @brief Checks for incoming clients
+ * @brief Reads the datagrams waiting in the socket into free receive buffers
  * 
- * This function checks for incoming clients by calling the `receiveMessage()` function and storing the received
- * message in a `String` object. If the function returns a non-zero value, indicating that a message was received,
- * the function then checks if the received message matches the `PASS_PHRASE`. If the match is successful, the function
- * stores the sender's IP address and port in the `client` object and sets the `connected` flag to `true`. The function
- * then sends a message back to the client using the `sendMessage()` function and updates the value of `lastPingTime`
- * to the current time in milliseconds.
+ * Each datagram is read into a buffer of the receive pool and checked by acceptFrame(). Command frames keep their
+ * buffer and join the pending frames; the buffer of anything else is reused at once.
  * 
- * The function also calls the `broadcastIP()` function with a time interval of 1000 milliseconds.
+ * Stops once the socket is empty or every buffer is taken, in which case the datagrams left in the socket are read
+ * once buffers are released.
  */
-void WifiController::checkIncomingClients() {
-    String receivedMsg; // String object to store the received message
-    int packetSize = receiveMessage(receivedMsg); // Get the size of the received packet
-    if (packetSize != 0) { // If the packet is not empty
-        Serial.println("Received message: " + receivedMsg + " and the pass phrase is : " + PASS_PHRASE);
-        if (receivedMsg == PASS_PHRASE) { // Check if the received message matches the `PASS_PHRASE`
-            client.ip = udp.remoteIP(); // Store the sender's IP address in the `client` object
-            client.port = udp.remotePort(); // Store the sender's port in the `client` object
-            connected = true; // Set the `connected` flag to `true`
-            Serial.println("client ip: " + client.ip.toString() + " client port: " + String(client.port));
-            String msg = "Hello\0";
-            sendMessage(msg); // Send a message back to the client
-            lastPingTime = millis(); // Update the value of `lastPingTime`
+void WifiController::receivePackets() {
+    while (sock >= 0 && rxPool.available() != 0) {
+        uint8_t slot = rxPool.acquire();
+        struct sockaddr_in from;
+        socklen_t fromLength = sizeof(from);
+        // Read the next datagram straight into the buffer, if there is one
+        int length = recvfrom(sock, rxPool.data(slot), rxPool.kSize, 0, (struct sockaddr*) &from, &fromLength);
+        if (length < 0) {
+            rxPool.release(slot);
+            return;
         }
+
+        remoteIp = from.sin_addr.s_addr;
+        remotePort = ntohs(from.sin_port);
+        udpproto::Frame frame;
+        if (!receiveDatagram(rxPool.data(slot), length, frame) || !acceptFrame(frame)) {
+            rxPool.release(slot);
+            continue;
+        }
+        ReceivedFrame& received = pending[(pendingHead + pendingCount) % RX_BUFFERS];
+        received.frame = frame;
+        received.buffer = slot;
+        pendingCount++; // Never more than RX_BUFFERS, each holds a buffer
     }
+}
+#pragma endregion
 
-    // Call the `broadcastIP()` function with a time interval of 1000 milliseconds
-    broadcastIP(1000);
+#pragma region WifiController::receiveFrame()
+/**
+ * @brief Receives a command frame from a connected client
+ * 
+ * Reads what is waiting in the socket (see receivePackets()) and hands out the oldest pending command frame. The
+ * frame is a view into its receive buffer, nothing is copied; the buffer stays reserved until it is handed back with
+ * release(), so several frames can be held at once. While all buffers are held no more datagrams are read.
+ * 
+ * @param received Set to the received frame, valid until it is released
+ * @return `true` if a command frame was received, reply() then answers its sender.
+ */
+bool WifiController::receiveFrame(ReceivedFrame& received) {
+    receivePackets();
+    if (pendingCount == 0) {
+        return false;
+    }
+    received = pending[pendingHead];
+    pendingHead = (pendingHead + 1) % RX_BUFFERS;
+    pendingCount--;
+    return true;
 }
+#pragma endregion
 
+#pragma region WifiController::release()
+/**
+ * @brief Hands the receive buffer of a frame from receiveFrame() back to the pool.
+ * 
+ * The frame's payload must not be used afterwards. Replies can still be sent with a copy of the frame's header.
+ * 
+ * @param received The frame, released exactly once
+ */
+void WifiController::release(const ReceivedFrame& received) {
+    rxPool.release(received.buffer);
+}
 #pragma endregion
 
-#pragma region WifiController::broadcastIP()
+#pragma region WifiController::checkIncomingClients()
 /**
- * @brief Broadcasts the local IP address over UDP.
- *
- * This function sends the local IP address in the form of a string over UDP
- * to the broadcast address on the specified local port. It will only send a
- * broadcast if the time since the last broadcast is greater than the timer's
- * value.
- *
- * @param timer The minimum time in milliseconds between broadcasts.
+ * @brief Lets new clients find the device
+ * 
+ * Keeps the discovery responder up to date with the local and broadcast address, which restarts its announcements
+ * when they change, and lets it announce the device while there is room in the client table. The announcements back
+ * off from DISCOVERY_MIN_INTERVAL_MS to DISCOVERY_MAX_INTERVAL_MS; clients that want to know sooner broadcast an
+ * OP_DISCOVER, answered in acceptFrame(). A client that found the device answers with an OP_HELLO carrying the
+ * `PASS_PHRASE`, see registerClient().
  */
-void WifiController::broadcastIP(unsigned long timer) {
-    // store the time of the last broadcast
-    static unsigned long lastBroadcastTime = 0;
-
-    // check if it has been more than timer's value in milliseconds since the last broadcast
-    if (millis() - lastBroadcastTime >= timer) {
-        // calculate the broadcast address by setting the last octet of the local IP address to 255
-        IPAddress broadcastAddress = WiFi.localIP();
-        broadcastAddress[3] = 255;
-
-        // create a char array to store the local IP address in the form of a string
-        char localIPMessage[32];
-        sprintf(localIPMessage, "%d.%d.%d.%d", WiFi.localIP()[0], WiFi.localIP()[1], WiFi.localIP()[2], WiFi.localIP()[3]);
-
-        // send the local IP message over UDP to the broadcast address on the specified local port
-        udp.beginPacket(broadcastAddress, LOCAL_PORT);
-        udp.write((uint8_t*) localIPMessage, strlen(localIPMessage));
-        int status = udp.endPacket();
-        if (status == 1) {
-            // Packet was successfully sent
-            lastBroadcastTime = millis();
-            led.SetStatus(UDP_BROADCAST_SENT, true);
-        } else {
-            // Failed to send the packet
-            int writeError = udp.getWriteError();
-            if (writeError != 0) {
-                led.SetStatus(UDP_BROADCAST_FAILED, true);
-            } else {
-                led.SetStatus(UDP_UNKNOWN_ERROR, true);
-            }
+void WifiController::checkIncomingClients() {
+    discovery.setAddress(WiFi.localIP(), WiFi.broadcastIP());
+    if (!clients.isFull()) {
+        discovery.poll(millis());
+    }
+}
+#pragma endregion
+
+#pragma region WifiController::sendTo()
+/**
+ * @brief Sends a datagram for the discovery responder
+ * 
+ * A failed send is shown on the LED, a successful one is not: announcements are routine.
+ * 
+ * @param ip The destination IP address
+ * @param port The destination port
+ * @param data The datagram
+ * @param length The size of the datagram in bytes
+ * @param context The WifiController
+ * @return `true` if the datagram was sent.
+ */
+bool WifiController::sendTo(uint32_t ip, uint16_t port, const uint8_t* data, size_t length, void* context) {
+    WifiController& wifi = *(WifiController*) context;
+    if (wifi.sendPacket(ip, port, data, length)) {
+        return true;
+    }
+    // Failed to send the packet
+    wifi.led.SetStatus(UDP_BROADCAST_FAILED, true);
+    return false;
+}
+#pragma endregion
+
+#pragma region WifiController::serviceClients()
+/**
+ * @brief Runs the heartbeat of every connected client and sends unacknowledged replies again.
+ * 
+ * Each client has one timer in a hierarchical timer wheel, so this only visits the clients whose timer is due, however
+ * many are connected. See onClientTimer() for what happens then, and retransmitFrames() for the replies.
+ */
+void WifiController::serviceClients() {
+    unsigned long now = millis();
+    uint16_t id;
+    while ((id = clientTimers.expire(now)) != clientTimers.kNone) {
+        onClientTimer(id, now);
+    }
+    retransmitFrames(now);
+}
+#pragma endregion
+
+#pragma region WifiController::retransmitFrames()
+/**
+ * @brief Sends the frames again whose client did not acknowledge them in time.
+ * 
+ * Every retransmission doubles the frame's timeout. After MAX_RETRANSMITS retransmissions the frame is given up and
+ * counted as undelivered; the client still has the heartbeat to notice the device is gone.
+ * 
+ * @param now The current time in milliseconds
+ */
+void WifiController::retransmitFrames(unsigned long now) {
+    uint8_t slot;
+    while ((slot = retransmits.due(now)) != retransmits.kNone) {
+        const udpproto::RetransmitQueue<RETRANSMIT_SLOTS, RETAINED_FRAME_SIZE>::Entry& entry = retransmits[slot];
+        if (entry.transmissions > MAX_RETRANSMITS) {
+            retransmits.remove(slot);
+            undelivered++;
+            continue;
         }
+        sendDatagram(entry.peer, entry.frame, entry.length);
+        retransmits.retransmitted(slot, now);
     }
 }
 #pragma endregion
 
-#pragma region WifiController::isClientConnected()
+#pragma region WifiController::onClientTimer()
 /**
- * @brief Check if a client is connected.
+ * @brief Moves the heartbeat of a client whose timer fired.
+ * 
+ * The heartbeat is a small state machine per client, driven by its timer and by receiveFrame(), so nothing waits:
  * 
- * The function sends a "ping" message to the client and waits for a response within 1000 milliseconds. 
- * If the response is "pong", the function returns `true` indicating that the client is connected. 
- * If it has been more than 1 minute since the last "ping" message was sent, a new "ping" message is sent to the client.
- * If no response is received, the function returns `false` indicating that the client is not connected.
+ *  * HEARTBEAT_IDLE: if the client was heard from within HEARTBEAT_INTERVAL_MS, the timer is set for the end of that
+ *    interval. Otherwise an OP_PING is sent and the state moves to HEARTBEAT_AWAITING_PONG.
+ *  * HEARTBEAT_AWAITING_PONG: any frame from the client, an OP_PONG or a command, moves the state back to
+ *    HEARTBEAT_IDLE. If none arrives within PONG_TIMEOUT_MS the ping is repeated, and after MAX_MISSED_PONGS
+ *    unanswered pings the client is dropped.
  * 
- * @return `true` if the client is connected, `false` otherwise.
+ * @param id The id of the client
+ * @param now The current time in milliseconds
  */
-bool WifiController::isClientConnected() {
-    if (connected) {
-        unsigned long currentTime = millis();
-        // Check if it has been more than 60000 milliseconds (1 minute) since the last ping
-        if (currentTime - lastPingTime >= 60000) {  
-            String message = "ping";
-            // Send a ping message to the client
-            int bytesSent = sendMessage(message);
-            Serial.println("ping sent to ip: " + client.ip.toString());
-            unsigned long startTime = millis();
-            // Wait for 1000 milliseconds for a response
-            while (millis() - startTime < 1000) {  
-                int bytesReceived = receiveMessage(message);
-                // Check if a response was received and if it was "pong"
-                if (bytesReceived > 0 && message == "pong") {
-                    connected = true;
-                    break;
-                }
-                connected = false;
-            }
-            // If no response or the response was not "pong", the client is considered disconnected
-            if (!connected) {
-                Serial.println("Lost connection");
-                return false;
-            }
-            // Update the last ping time
-            lastPingTime = currentTime;
+void WifiController::onClientTimer(uint16_t id, unsigned long now) {
+    ClientSession& session = clients[id];
+    if (session.heartbeat == HEARTBEAT_IDLE) {
+        // Only ping a client that has gone quiet, regular traffic already shows it is alive
+        if (now - session.lastHeard < HEARTBEAT_INTERVAL_MS) {
+            clientTimers.schedule(id, session.lastHeard + HEARTBEAT_INTERVAL_MS);
+            return;
         }
+    } else if (++session.missedPongs >= MAX_MISSED_PONGS) {
+        // No answer to any of the pings, the client is considered disconnected
+        dropClient(id);
+        return;
     }
-    // Output the connection status
-    Serial.println((connected) ? "true" : "false");
-    return connected;
+    sendPing(id); // The first ping, or the last one or its answer was lost
+}
+#pragma endregion
+
+#pragma region WifiController::sendPing()
+/**
+ * @brief Sends an OP_PING to a client and starts waiting for its answer.
+ * 
+ * @param id The id of the client
+ * @return `true` if the ping was sent.
+ */
+bool WifiController::sendPing(uint16_t id) {
+    ClientSession& session = clients[id];
+    bool sent = sendFrame(id, udpproto::OP_PING, ++session.txSequence);
+    session.heartbeat = HEARTBEAT_AWAITING_PONG;
+    clientTimers.schedule(id, millis() + PONG_TIMEOUT_MS);
+    return sent;
 }
 #pragma endregion
 
@@ -496,12 +817,32 @@ bool WifiController::connect() {
 /**
  * @brief Sets up the UDP connection.
  * 
- * This method starts the UDP connection on the specified local port and
- * prints a message to the Serial console to indicate that the connection has been established.
+ * This method opens a non-blocking lwIP UDP socket on the specified local port, allowed to broadcast for discovery,
+ * and prints a message to the Serial console to indicate that the connection has been established. Using the socket
+ * directly lets datagrams be read straight into the receive buffers and lets waitForTraffic() sleep on it.
  **/
 void WifiController::setupUDP() {
-    // start the UDP connection on the specified local port
-    udp.begin(LOCAL_PORT);
+    clientTimers.start(millis());
+
+    // open the UDP socket on the specified local port
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    struct sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(LOCAL_PORT);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    int enable = 1;
+    if (sock < 0
+        || setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable)) != 0
+        || bind(sock, (struct sockaddr*) &local, sizeof(local)) != 0
+        || fcntl(sock, F_SETFL, O_NONBLOCK) != 0) {
+        Serial.println("UDP socket on port " + String(LOCAL_PORT) + " failed, errno " + String(errno));
+        led.SetStatus(UDP_UNKNOWN_ERROR, true);
+        if (sock >= 0) {
+            closesocket(sock);
+            sock = -1;
+        }
+        return;
+    }
 
     // print a message to the Serial console to indicate that the connection has been established
     Serial.println("UDP connection established on port " + String(LOCAL_PORT));
@@ -513,22 +854,59 @@ void WifiController::setupUDP() {
  * isWiFiConnected
  * Check if the WiFi connection is established
  * 
+ * Called on every pass of the loop, so it only touches the LED when the state changes and prints nothing.
+ * 
  * @return True if the WiFi connection is established, False otherwise
  **/
 bool WifiController::isWiFiConnected() {
     if (WiFi.status() == WL_CONNECTED) {
-        Serial.println(String(led.getStatus()) + " " + String(WIFI_CONNECTED));
         if(led.getStatus() != WIFI_CONNECTED) {
             led.SetStatus(WIFI_CONNECTED, true, 1000);
         }
         return true;
     } else {
-        led.SetStatus(WIFI_CONNECTION_LOST);
+        if (led.getStatus() != WIFI_CONNECTION_LOST) {
+            led.SetStatus(WIFI_CONNECTION_LOST);
+        }
+        discovery.restart(); // Whatever network comes back, clients should hear about the device soon
         return false;
     }
 }
 #pragma endregion
 
+#pragma region WifiController::waitForTraffic()
+/**
+ * @brief Sleeps until a datagram arrives or the controller has something due
+ * 
+ * Blocks in `select()` on the UDP socket, so the calling task uses no CPU while the network is quiet. The wait ends
+ * early when the next client timer, reply retransmission or discovery announcement is due, so the loop can run
+ * serviceClients() and checkIncomingClients() on time.
+ * 
+ * @param timeoutMs The longest to wait, for whatever else the caller has due
+ * @return `true` if a datagram is waiting, `false` if the wait timed out.
+ */
+bool WifiController::waitForTraffic(uint32_t timeoutMs) {
+    unsigned long now = millis();
+    timeoutMs = std::min<uint32_t>(timeoutMs, clientTimers.msUntilNext(now));
+    timeoutMs = std::min<uint32_t>(timeoutMs, retransmits.msUntilNext(now));
+    if (WiFi.status() == WL_CONNECTED && !clients.isFull()) {
+        timeoutMs = std::min<uint32_t>(timeoutMs, discovery.msUntilNext(now));
+    }
+    if (sock < 0) {
+        vTaskDelay(pdMS_TO_TICKS(timeoutMs));
+        return false;
+    }
+
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(sock, &readable);
+    struct timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+    return select(sock + 1, &readable, nullptr, nullptr, &timeout) > 0;
+}
+#pragma endregion
+
 String WifiController::WiFiStatusCodeToString(wl_status_t status) {
     switch (status) {
     case WL_NO_SHIELD:
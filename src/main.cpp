@@ -1,12 +1,33 @@
 #include <Arduino.h>
+#include <stdarg.h>
 #include <LED_driver.h>
 #include <WIFI_Controller.h>
 #include <BLE_Controller.h>
 #include <IR_Controller.h>
+#include <IR_Scene.h>
 
 WifiController wifi(SLED);
 BLEController bt(wifi, SLED);
 IRController ir;
+SceneRunner scenes(ir);
+udpproto::FrameDispatcher commands;
+char learnName[IRCodeCache::kMaxNameLength + 1] = "";  // Code being learned, empty when not learning.
+bool learnSaving = false;   // Captured, waiting for the storage task.
+StorageResult learnSaved;
+bool erasing = false;       // Waiting for the storage task to empty the card.
+StorageResult erased;
+
+// Longest reply or notification, other than the storage report.
+static const size_t kReplyLength = 96;
+
+// The loop sleeps until a datagram arrives or something is due. Results from
+// the IR tasks do not wake it, so while some are expected it looks every
+// kBusyPollMs; otherwise it looks at least every kIdleWaitMs, e.g. for the
+// Wi-Fi coming back.
+static const uint32_t kBusyPollMs = 10;
+static const uint32_t kIdleWaitMs = 1000;
+
+static void registerCommands();
 
 void setup() {
 #ifdef EASYDEBUG
@@ -17,9 +38,12 @@ void setup() {
   Serial.println("ESP32 Booted");
 #endif
   SLED.SetStatus(BOOTED, true, 1000); // Set the BOOTED status of the LED
+  // Kept in RAM until the storage task starts writing the event log.
+  events.log(eventlog::EVENT_BOOT, ESP.getFreeHeap(), ESP.getMaxAllocHeap());
 
   wifi.init();
   //wifi.set_initialized(false);
+  registerCommands();
 
   // Check if the Wi-Fi credentials are saved in EEPROM
   if (wifi.hasCredentials()) {
@@ -31,17 +55,202 @@ void setup() {
   }
 }
 
+// Appends to the `used` characters already in `out` like snprintf(),
+// truncating at `capacity`. Returns the new length.
+static size_t appendText(char *out, size_t capacity, size_t used, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(out + used, capacity - used, format, args);
+  va_end(args);
+  used += written > 0 ? written : 0;
+  return used < capacity ? used : capacity - 1;
+}
+
+// Appends the buckets of a StorageStats histogram as " <label> a,b,c".
+static size_t appendCounts(char *out, size_t capacity, size_t used, const char *label,
+                           const uint32_t *counts, uint8_t length) {
+  used = appendText(out, capacity, used, " %s ", label);
+  for (uint8_t i = 0; i < length; i++) {
+    used = appendText(out, capacity, used, i != 0 ? ",%u" : "%u", counts[i]);
+  }
+  return used;
+}
+
+// "STORAGE depth <counts> latency <counts> service <counts> coalesced <n>
+// rejected <n>", see StorageStats for the buckets. Truncated to `capacity`.
+static void storageReport(char *out, size_t capacity) {
+  const StorageStats &stats = ir.storageStats();
+  size_t used = appendText(out, capacity, 0, "STORAGE");
+  used = appendCounts(out, capacity, used, "depth", stats.depth, kStorageQueueLength + 1);
+  used = appendCounts(out, capacity, used, "latency", stats.latency, StorageStats::kBuckets);
+  used = appendCounts(out, capacity, used, "service", stats.service, StorageStats::kBuckets);
+  appendText(out, capacity, used, " coalesced %u rejected %u", stats.coalesced, stats.rejected);
+}
+
+// Commands arrive as frames (see UDP_Protocol.h) and are answered with an
+// OP_REPLY frame carrying the same sequence number. Both are acknowledged and
+// repeats are only run once (see UDP_Reliable.h):
+//   OP_SEND <code>      queue a stored code behind any pending replays
+//   OP_SEND_NOW <code>  queue a stored code ahead of pending replays
+//   OP_SCENE <name>     play a scene stored in /scenes/ (see IR_Scene.h)
+//   OP_LEARN <code>     capture the next IR message and store it as <code>
+//   OP_DELETE <code>    remove a stored code
+//   OP_STORAGE          report the storage task's queue depth and latency
+//   OP_ERASE            delete every code, scene and log on the SD card
+// Queued codes are answered with "QUEUED <ticket>" now and notified with
+// "SENT <ticket>" or "FAILED <ticket>" once they have been transmitted.
+// Scenes are answered with "SCENE STARTED" or "SCENE FAILED" now and notified
+// with "SCENE DONE <name> <failed steps>" once the last step has run.
+// A scene that turns out to be missing or invalid is notified later with
+// "SCENE FAILED <name>".
+// Learning is answered with "LEARNING" now and notified with "LEARNED <code>"
+// once a message was stored, followed by " DUPLICATE <stored code>" or
+// " SIMILAR <stored code> <score>" if it resembles a code already stored, or
+// with "LEARN FAILED <code>" if it could not be saved.
+// Deleting is answered with "DELETING" or "BUSY". Erasing is answered with
+// "ERASING" or "BUSY" now and notified with "ERASED <entries>" or
+// "ERASE FAILED <entries>" once the storage task is done. A name that is too long is
+// answered with "BAD NAME", an unknown opcode with "UNKNOWN".
+
+// Copies the name a command carries, or answers "BAD NAME".
+static bool commandName(const udpproto::Frame &frame, char *name, size_t capacity) {
+  if (frame.length == 0 || !udpproto::payloadText(frame, name, capacity)) {
+    wifi.reply(frame, "BAD NAME");
+    return false;
+  }
+  return true;
+}
+
+static void onSend(const udpproto::Frame &frame, void *context) {
+  char name[IRCodeCache::kMaxNameLength + 1];
+  if (!commandName(frame, name, sizeof(name))) {
+    return;
+  }
+  SendPriority priority = (SendPriority)(intptr_t)context;
+  uint32_t ticket = ir.sendAsync(name, priority);
+  char reply[kReplyLength];
+  snprintf(reply, sizeof(reply), "QUEUED %u", ticket);
+  wifi.reply(frame, ticket != 0 ? reply : "BUSY");
+}
+
+static void onScene(const udpproto::Frame &frame, void *) {
+  char name[IRCodeCache::kMaxNameLength + 1];
+  if (commandName(frame, name, sizeof(name))) {
+    wifi.reply(frame, scenes.start(name) ? "SCENE STARTED" : "SCENE FAILED");
+  }
+}
+
+static void onLearn(const udpproto::Frame &frame, void *) {
+  if (learnSaving) {
+    wifi.reply(frame, "BUSY");
+  } else if (commandName(frame, learnName, sizeof(learnName))) {
+    ir.start();
+    wifi.reply(frame, "LEARNING");
+  }
+}
+
+static void onDelete(const udpproto::Frame &frame, void *) {
+  char name[IRCodeCache::kMaxNameLength + 1];
+  if (commandName(frame, name, sizeof(name))) {
+    wifi.reply(frame, ir.remove(name) ? "DELETING" : "BUSY");
+  }
+}
+
+static void onStorage(const udpproto::Frame &frame, void *) {
+  char report[udpproto::kMaxPayloadSize + 1];
+  storageReport(report, sizeof(report));
+  wifi.reply(frame, report);
+}
+
+static void onErase(const udpproto::Frame &frame, void *) {
+  if (!erasing && ir.eraseCard(erased)) {
+    erasing = true;
+    wifi.reply(frame, "ERASING");
+  } else {
+    wifi.reply(frame, "BUSY");
+  }
+}
+
+static void registerCommands() {
+  commands.on(udpproto::OP_SEND, onSend, (void *)(intptr_t)SEND_NORMAL);
+  commands.on(udpproto::OP_SEND_NOW, onSend, (void *)(intptr_t)SEND_INTERACTIVE);
+  commands.on(udpproto::OP_SCENE, onScene);
+  commands.on(udpproto::OP_LEARN, onLearn);
+  commands.on(udpproto::OP_DELETE, onDelete);
+  commands.on(udpproto::OP_STORAGE, onStorage);
+  commands.on(udpproto::OP_ERASE, onErase);
+}
+
 void loop() {
   if(wifi.isWiFiConnected()) {
-    if(!wifi.isClientConnected()) {
-      wifi.checkIncomingClients();
-    } else {
-      String data;
-      if(wifi.receiveMessage(data) > 0) {
-        Serial.println(data);
-        data = "OK";
-        wifi.sendMessage(data);
+    wifi.checkIncomingClients();
+    wifi.serviceClients();
+    ReceivedFrame received;
+    while (wifi.receiveFrame(received)) {
+      if (commands.dispatch(received.frame) == udpproto::FRAME_UNHANDLED) {
+        wifi.reply(received.frame, "UNKNOWN");
+      }
+      wifi.release(received);
+    }
+
+    // Report finished transmissions back to the clients, unless they were
+    // steps of a scene.
+    char reply[kReplyLength];
+    SendResult result;
+    while (ir.nextCompletion(result)) {
+      if (scenes.onSendComplete(result)) {
+        continue;
       }
+      snprintf(reply, sizeof(reply), "%s %u", result.sent ? "SENT" : "FAILED", result.ticket);
+      wifi.notify(reply);
+    }
+
+    if (learnName[0] != '\0' && !learnSaving && ir.hasCapture()) {
+      ir.read(learnName, &learnSaved);
+      ir.stop();
+      learnSaving = true;
+    }
+
+    // Answer once the storage task has the code on the card.
+    if (learnSaving && learnSaved.done) {
+      if (learnSaved.status == STORAGE_FAILED) {
+        snprintf(reply, sizeof(reply), "LEARN FAILED %s", learnName);
+      } else if (ir.lastMatchCount() == 0) {
+        snprintf(reply, sizeof(reply), "LEARNED %s", learnName);
+      } else {
+        const IRMatch &best = ir.lastMatches()[0];
+        if (best.score == 100) {
+          snprintf(reply, sizeof(reply), "LEARNED %s DUPLICATE %s", learnName, best.name);
+        } else {
+          snprintf(reply, sizeof(reply), "LEARNED %s SIMILAR %s %u", learnName, best.name, best.score);
+        }
+      }
+      wifi.notify(reply);
+      learnName[0] = '\0';
+      learnSaving = false;
+    }
+
+    if (erasing && erased.done) {
+      snprintf(reply, sizeof(reply), "%s %u", erased.status == STORAGE_OK ? "ERASED" : "ERASE FAILED",
+               (unsigned)erased.length);
+      wifi.notify(reply);
+      erasing = false;
+    }
+
+    SceneState scene = scenes.tick();
+    if (scene == SCENE_FINISHED) {
+      snprintf(reply, sizeof(reply), "SCENE DONE %s %u", scenes.name(), scenes.failedSteps());
+      wifi.notify(reply);
+    } else if (scene == SCENE_FAILED) {
+      events.log(eventlog::EVENT_SCENE_FAILED);
+      snprintf(reply, sizeof(reply), "SCENE FAILED %s", scenes.name());
+      wifi.notify(reply);
     }
   }
-}
\ No newline at end of file
+
+  uint32_t waitMs = scenes.msUntilNextStep();
+  if (ir.hasPendingWork() || learnName[0] != '\0') {
+    waitMs = std::min(waitMs, kBusyPollMs);
+  }
+  wifi.waitForTraffic(std::min(waitMs, kIdleWaitMs));
+}
@@ -0,0 +1,664 @@
+// Host benchmarks of the IR storage hot path: pio test -e native_bench -v
+//
+// The PC side of IR_Benchmark.h, against the same captures. Every benchmark
+// also checks what it produced, so a broken change fails the run instead of
+// reporting a fast time. Results are printed as CSV, one line per benchmark
+// and capture:
+//
+//   # ir-bench-host,<format version>,<optimised 0/1>
+//   bench,capture,entries,bytes,iterations,ns_per_op,alloc_bytes,peak_stack
+//   text_parse,nec,67,297,148038,758,0,56
+//   ...
+//
+// alloc_bytes is what malloc() and operator new handed out per operation
+// (glibc only, -1 elsewhere); the hot path is meant to keep it at 0.
+// peak_stack is the deepest stack one operation used, in bytes, measured on a
+// thread whose stack is painted before the run.
+//
+// Captures recorded on a real receiver are benchmarked next to the synthetic
+// ones: copy codes the firmware saved, as records or as raw_array text, into
+// test/test_bench/captures (or $IR_BENCH_CAPTURES), named after the remote.
+#include <unity.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <IR_BenchCorpus.h>
+#include <IR_Matcher.h>
+#include <IR_Record.h>
+#include <SD_Compress.h>
+#include <UDP_Protocol.h>
+
+using namespace irbench;
+
+// Bump when the CSV columns change, so old results are not compared blindly.
+static const uint8_t kBenchFormatVersion = 1;
+static const size_t kBenchStackSize = 256 * 1024;
+static const uint8_t kStackPaint = 0xA5;
+// Each benchmark repeats its operation for roughly this long.
+static const uint64_t kBenchTargetNs = 200000000;
+static const uint32_t kBenchMaxIterations = 1000000;
+// IR_Config.h values, which need Arduino.
+static const uint8_t kTolerance = 25;
+static const uint16_t kMinRepeatGap = 5000;
+static const uint8_t kMatchResults = 3;
+static const uint8_t kMinMatchScore = 60;
+// IRremoteESP8266's, micro-seconds per receiver tick.
+static const uint16_t kRawTick = 2;
+// Codes in the library the matchers search, jittered copies of the corpus.
+static const uint16_t kLibrarySize = 4096;
+static const char kRecordedPath[] = "test/test_bench/captures";
+static const uint8_t kMaxRecorded = 16;
+
+#ifdef __GLIBC__
+// Every allocation of the process passes through here, the code under test
+// included, so nothing can allocate behind the benchmark's back.
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+static std::atomic<uint64_t> allocated{0};
+
+extern "C" void *malloc(size_t size) {
+  allocated += size;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+  allocated += count * size;
+  return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size) {
+  allocated += size;
+  return __libc_realloc(pointer, size);
+}
+
+static uint64_t allocatedBytes() { return allocated; }
+#else
+static uint64_t allocatedBytes() { return 0; }
+#endif
+
+static uint64_t nowNs() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+struct BenchJob {
+  void (*run)();
+  uint32_t iterations;
+  uint64_t nsPerOp;
+  int64_t allocBytes;
+  size_t peakStack;
+};
+
+static void *benchThread(void *param) {
+  BenchJob &job = *(BenchJob *)param;
+  uint64_t allocatedBefore = allocatedBytes();
+
+  // Size the run from one warm up call.
+  uint64_t start = nowNs();
+  job.run();
+  uint64_t single = nowNs() - start;
+  job.iterations = single > 0 ? kBenchTargetNs / single : kBenchMaxIterations;
+  if (job.iterations < 1) {
+    job.iterations = 1;
+  } else if (job.iterations > kBenchMaxIterations) {
+    job.iterations = kBenchMaxIterations;
+  }
+
+  start = nowNs();
+  for (uint32_t i = 0; i < job.iterations; i++) {
+    job.run();
+  }
+  job.nsPerOp = (nowNs() - start) / job.iterations;
+#ifdef __GLIBC__
+  job.allocBytes = (allocatedBytes() - allocatedBefore) / (job.iterations + 1);
+#else
+  (void)allocatedBefore;
+  job.allocBytes = -1;
+#endif
+  return nullptr;
+}
+
+// Runs `run` on a thread of its own, with a stack painted beforehand so the
+// deepest point it reached can be read back afterwards.
+static BenchJob measure(void (*run)()) {
+  static uint8_t *stack = (uint8_t *)aligned_alloc(4096, kBenchStackSize);
+  BenchJob job = {run, 0, 0, 0, 0};
+  run();  // Library calls are resolved on first use, not on the measured stack.
+  memset(stack, kStackPaint, kBenchStackSize);
+
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setstack(&attributes, stack, kBenchStackSize);
+  pthread_t thread;
+  TEST_ASSERT_EQUAL(0, pthread_create(&thread, &attributes, benchThread, &job));
+  pthread_join(thread, nullptr);
+  pthread_attr_destroy(&attributes);
+
+  // The stack grows down from the top of the block.
+  size_t untouched = 0;
+  while (untouched < kBenchStackSize && stack[untouched] == kStackPaint) {
+    untouched++;
+  }
+  job.peakStack = kBenchStackSize - untouched;
+  return job;
+}
+
+// The captures and scratch buffers are static, so they do not count against
+// the benchmark thread's stack.
+static Capture corpus[4];
+// Plain captures of growing length, for the text encoder.
+static Capture sized[3];
+static Capture recorded[kMaxRecorded];
+static uint8_t recordedCount;
+static const Capture *current;
+static char textBuffer[8 * kMaxTimings];
+static size_t textLength;
+static char legacyBuffer[8 * kMaxTimings];
+static size_t written;
+static uint8_t recordBuffer[irrecord::maxRecordSize(kMaxTimings)];
+static size_t recordLength;
+static const uint8_t *lzInput;
+static size_t lzLength;
+static uint8_t packedBuffer[8 * kMaxTimings + 8 * kMaxTimings / 255 + 16];
+static size_t packedLength;
+static uint8_t unpackedBuffer[8 * kMaxTimings];
+static uint8_t frameBuffer[udpproto::kMaxFrameSize];
+static size_t frameLength;
+static size_t payloadLength;
+static uint16_t decoded[kMaxTimings];
+// Receiver output for `current`, as IRrecv leaves it in rawbuf.
+static uint16_t ticks[2 * kMaxTimings];
+static uint16_t tickCount;
+static uint16_t timings[kMaxTimings];
+static IRCodeIndex library;
+static Capture libraryCodes[kLibrarySize];
+static IRMatch matches[kMatchResults];
+static volatile uint32_t benchSink;  // Keeps results alive.
+// Stack the benchmark thread takes for itself, taken off every peak_stack.
+static size_t threadStack;
+
+// Times one benchmark against `current` and prints its row. `bytes` is the
+// size of what the operation produces, e.g. the record.
+static void report(const char *name, void (*run)(), size_t bytes) {
+  BenchJob job = measure(run);
+  size_t stack = job.peakStack > threadStack ? job.peakStack - threadStack : 0;
+  printf("%s,%s,%u,%u,%u,%llu,%lld,%u\n", name, current->name, current->length, (unsigned)bytes,
+         job.iterations, (unsigned long long)job.nsPerOp, (long long)job.allocBytes,
+         (unsigned)stack);
+}
+
+// The text format as the firmware wrote it before the streaming encoder.
+static size_t legacyText(const uint16_t *timings, uint16_t length, char *text) {
+  sprintf(text, "raw_array:[");
+  for (int i = 0; i < length; i++) {
+    sprintf(text + strlen(text), "%d", timings[i]);
+    if (i != length - 1) {
+      sprintf(text + strlen(text), ",");
+    }
+  }
+  sprintf(text + strlen(text), "]");
+  return strlen(text);
+}
+
+static size_t appendText(const uint8_t *data, size_t length, void *) {
+  memcpy(textBuffer + written, data, length);
+  written += length;
+  return length;
+}
+
+static size_t appendPacked(const uint8_t *data, size_t length, void *) {
+  memcpy(packedBuffer + written, data, length);
+  written += length;
+  return length;
+}
+
+static void benchNothing() {}
+
+static void benchTextWrite() {
+  written = 0;
+  benchSink = irrecord::writeText(current->timings, current->length, appendText, nullptr);
+}
+
+static void benchTextWriteSprintf() {
+  benchSink = legacyText(current->timings, current->length, legacyBuffer);
+}
+
+static void benchTextParse() {
+  uint16_t count;
+  irrecord::parseText(textBuffer, textLength, decoded, kMaxTimings, count);
+  benchSink = count;
+}
+
+static void benchRecordEncode() {
+  benchSink = irrecord::encode(rawCode(*current), recordBuffer, sizeof(recordBuffer));
+}
+
+static void benchRecordDecode() {
+  irrecord::IRCode code;
+  benchSink = irrecord::decode(recordBuffer, recordLength, decoded, kMaxTimings, code);
+}
+
+static void benchTicksToTimings() {
+  bool overflow;
+  benchSink = irrecord::ticksToTimings(ticks, tickCount, kRawTick, timings, kMaxTimings, overflow);
+}
+
+// IRremoteESP8266's getCorrectedRawLength() and resultToRawArray(), as the
+// firmware called them for every capture before ticksToTimings(): a pass to
+// size the array, a heap allocation and a pass to fill it.
+static uint16_t legacyRawLength(const uint16_t *raw, uint16_t count) {
+  uint16_t extended = 0;
+  for (uint16_t i = 1; i < count; i++) {
+    uint32_t usecs = raw[i] * kRawTick;
+    extended += (usecs / (UINT16_MAX + 1)) * 2;
+  }
+  return count - 1 + extended;
+}
+
+static uint16_t *legacyRawArray(const uint16_t *raw, uint16_t count) {
+  uint16_t *result = new uint16_t[legacyRawLength(raw, count)];
+  uint16_t position = 0;
+  for (uint16_t i = 1; i < count; i++) {
+    uint32_t usecs = raw[i] * kRawTick;
+    while (usecs > UINT16_MAX) {
+      result[position++] = UINT16_MAX;
+      result[position++] = 0;
+      usecs -= UINT16_MAX;
+    }
+    result[position++] = usecs;
+  }
+  return result;
+}
+
+static void benchTicksToTimingsAlloc() {
+  uint16_t *array = legacyRawArray(ticks, tickCount);
+  benchSink = legacyRawLength(ticks, tickCount) + array[0];
+  delete[] array;
+}
+
+static void benchCompress() {
+  written = 0;
+  benchSink = sdcompress::compress(lzInput, lzLength, appendPacked, nullptr);
+}
+
+static void benchDecompress() {
+  sdcompress::Decompressor lz(unpackedBuffer, sizeof(unpackedBuffer));
+  lz.feed(packedBuffer, packedLength);
+  benchSink = lz.finish() ? lz.length() : 0;
+}
+
+static void benchFrameEncode() {
+  benchSink = udpproto::encodeFrame(frameBuffer, sizeof(frameBuffer), udpproto::OP_SEND, 1,
+                                    recordBuffer, payloadLength);
+}
+
+static void benchFrameParse() {
+  udpproto::Frame frame;
+  benchSink = udpproto::parseFrame(frameBuffer, frameLength, frame);
+}
+
+static void benchTrimRepeats() {
+  irrecord::IRCode code = rawCode(*current);
+  benchSink = irrecord::trimRepeats(code, kTolerance, kMinRepeatGap);
+}
+
+static void benchIndexMatch() {
+  benchSink = library.findNearest(rawCode(*current), matches, kMatchResults, kMinMatchScore);
+}
+
+// What matching costs without the index, even with every stored code
+// already in RAM: compare the capture with each of them timing by timing,
+// within the tolerance, and keep the best kMatchResults.
+static void benchLinearMatch() {
+  uint8_t found = 0;
+  for (uint16_t i = 0; i < kLibrarySize; i++) {
+    const Capture &code = libraryCodes[i];
+    uint16_t shorter = code.length < current->length ? code.length : current->length;
+    uint16_t longer = code.length < current->length ? current->length : code.length;
+    uint16_t close = 0;
+    for (uint16_t t = 0; t < shorter; t++) {
+      int32_t difference = (int32_t)current->timings[t] - code.timings[t];
+      if (difference < 0) {
+        difference = -difference;
+      }
+      close += difference * 100 <= (int32_t)code.timings[t] * kTolerance;
+    }
+    uint8_t score = longer != 0 ? close * 100 / longer : 0;
+    if (score < kMinMatchScore || (found == kMatchResults && score <= matches[found - 1].score)) {
+      continue;
+    }
+    uint8_t slot = found < kMatchResults ? found++ : found - 1;
+    while (slot > 0 && matches[slot - 1].score < score) {
+      matches[slot] = matches[slot - 1];
+      slot--;
+    }
+    strcpy(matches[slot].name, code.name);
+    matches[slot].score = score;
+  }
+  benchSink = found;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// The streaming encoder against the sprintf() and strlen() loop it replaced,
+// which rescans the text for every timing.
+static void textWrite(const Capture &capture) {
+  current = &capture;
+  textLength = legacyText(capture.timings, capture.length, legacyBuffer);
+  report("text_write", benchTextWrite, textLength);
+  report("text_write_sprintf", benchTextWriteSprintf, textLength);
+
+  written = 0;
+  TEST_ASSERT_EQUAL(textLength,
+                    irrecord::writeText(capture.timings, capture.length, appendText, nullptr));
+  TEST_ASSERT_EQUAL(textLength, written);
+  TEST_ASSERT_EQUAL_MEMORY(legacyBuffer, textBuffer, textLength);
+}
+
+void test_text_write(void) {
+  for (const Capture &capture : corpus) {
+    textWrite(capture);
+  }
+  for (const Capture &capture : sized) {
+    textWrite(capture);
+  }
+  for (uint8_t i = 0; i < recordedCount; i++) {
+    textWrite(recorded[i]);
+  }
+}
+
+static void textParse(const Capture &capture) {
+  current = &capture;
+  textLength = legacyText(capture.timings, capture.length, textBuffer);
+  report("text_parse", benchTextParse, textLength);
+
+  uint16_t count;
+  TEST_ASSERT_EQUAL(irrecord::PARSE_OK,
+                    irrecord::parseText(textBuffer, textLength, decoded, kMaxTimings, count));
+  TEST_ASSERT_EQUAL(capture.length, count);
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(capture.timings, decoded, count);
+}
+
+void test_text_parse(void) {
+  for (const Capture &capture : corpus) {
+    textParse(capture);
+  }
+  for (uint8_t i = 0; i < recordedCount; i++) {
+    textParse(recorded[i]);
+  }
+}
+
+static void record(const Capture &capture) {
+  current = &capture;
+  recordLength = irrecord::encode(rawCode(capture), recordBuffer, sizeof(recordBuffer));
+  report("record_encode", benchRecordEncode, recordLength);
+  report("record_decode", benchRecordDecode, recordLength);
+
+  irrecord::IRCode code;
+  TEST_ASSERT_EQUAL(irrecord::RECORD_OK,
+                    irrecord::decode(recordBuffer, recordLength, decoded, kMaxTimings, code));
+  TEST_ASSERT_EQUAL(capture.length, code.length);
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(capture.timings, decoded, code.length);
+}
+
+void test_record(void) {
+  for (const Capture &capture : corpus) {
+    record(capture);
+  }
+  for (uint8_t i = 0; i < recordedCount; i++) {
+    record(recorded[i]);
+  }
+}
+
+// Turns a capture back into the receiver ticks it came from, long gaps
+// split into 65535us pairs joined up again.
+static void makeTicks(const Capture &capture) {
+  tickCount = 0;
+  ticks[tickCount++] = 0;  // The gap before the capture, which is skipped.
+  uint32_t usecs = 0;
+  for (uint16_t i = 0; i < capture.length; i++) {
+    usecs += capture.timings[i];
+    bool split = capture.timings[i] == UINT16_MAX && i + 1 < capture.length &&
+                 capture.timings[i + 1] == 0;
+    if (split) {
+      i++;
+    } else {
+      ticks[tickCount++] = usecs / kRawTick;
+      usecs = 0;
+    }
+  }
+}
+
+// Converting receiver output in place, against the allocate and copy it
+// replaced.
+static void ticksRows(const Capture &capture) {
+  current = &capture;
+  makeTicks(capture);
+  report("ticks_to_timings", benchTicksToTimings, capture.length * sizeof(uint16_t));
+  report("ticks_to_timings_alloc", benchTicksToTimingsAlloc, capture.length * sizeof(uint16_t));
+
+  bool overflow;
+  uint16_t length = irrecord::ticksToTimings(ticks, tickCount, kRawTick, timings, kMaxTimings,
+                                             overflow);
+  TEST_ASSERT_FALSE(overflow);
+  TEST_ASSERT_EQUAL(legacyRawLength(ticks, tickCount), length);
+  uint16_t *array = legacyRawArray(ticks, tickCount);
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(array, timings, length);
+  delete[] array;
+}
+
+void test_ticks_to_timings(void) {
+  for (const Capture &capture : corpus) {
+    ticksRows(capture);
+  }
+  for (uint8_t i = 0; i < recordedCount; i++) {
+    ticksRows(recorded[i]);
+  }
+}
+
+// Compresses `lzInput` and checks it comes back the same.
+static void compressRows(const char *compressName, const char *decompressName) {
+  written = 0;
+  packedLength = sdcompress::compress(lzInput, lzLength, appendPacked, nullptr);
+  report(compressName, benchCompress, packedLength);
+  report(decompressName, benchDecompress, lzLength);
+
+  TEST_ASSERT_EQUAL(packedLength, written);
+  sdcompress::Decompressor lz(unpackedBuffer, sizeof(unpackedBuffer));
+  TEST_ASSERT_TRUE(lz.feed(packedBuffer, packedLength));
+  TEST_ASSERT_TRUE(lz.finish());
+  TEST_ASSERT_EQUAL(lzLength, lz.length());
+  TEST_ASSERT_EQUAL_MEMORY(lzInput, unpackedBuffer, lzLength);
+}
+
+static void compress(const Capture &capture) {
+  current = &capture;
+  recordLength = irrecord::encode(rawCode(capture), recordBuffer, sizeof(recordBuffer));
+  lzInput = recordBuffer;
+  lzLength = recordLength;
+  compressRows("lz_compress", "lz_decompress");
+
+  // Text files repeat the same few numbers far more visibly.
+  lzInput = (const uint8_t *)legacyBuffer;
+  lzLength = legacyText(capture.timings, capture.length, legacyBuffer);
+  compressRows("lz_compress_text", "lz_decompress_text");
+}
+
+// The ratio is the compressed bytes against the input's. Decompressing pays
+// off where it takes less time than the card needs for the bytes it saves.
+void test_compress(void) {
+  for (const Capture &capture : corpus) {
+    compress(capture);
+  }
+  for (uint8_t i = 0; i < recordedCount; i++) {
+    compress(recorded[i]);
+  }
+}
+
+void test_frame(void) {
+  // The frame check is dominated by the CRC, so the record stands in for a
+  // payload of its size. A record too large for one datagram is cut to
+  // kMaxPayloadSize, the most a frame carries.
+  for (const Capture &capture : corpus) {
+    current = &capture;
+    recordLength = irrecord::encode(rawCode(capture), recordBuffer, sizeof(recordBuffer));
+    payloadLength = recordLength < udpproto::kMaxPayloadSize ? recordLength : udpproto::kMaxPayloadSize;
+    frameLength = udpproto::encodeFrame(frameBuffer, sizeof(frameBuffer), udpproto::OP_SEND, 1,
+                                        recordBuffer, payloadLength);
+    TEST_ASSERT_EQUAL(udpproto::kFrameHeaderSize + payloadLength, frameLength);
+    report("frame_encode", benchFrameEncode, frameLength);
+    report("frame_parse", benchFrameParse, frameLength);
+
+    udpproto::Frame frame;
+    TEST_ASSERT_EQUAL(udpproto::FRAME_OK, udpproto::parseFrame(frameBuffer, frameLength, frame));
+    TEST_ASSERT_EQUAL_MEMORY(recordBuffer, frame.payload, payloadLength);
+  }
+}
+
+void test_trim_repeats(void) {
+  for (const Capture &capture : corpus) {
+    current = &capture;
+    report("trim_repeats", benchTrimRepeats, 0);
+
+    // Only the held Samsung button repeats.
+    irrecord::IRCode code = rawCode(capture);
+    bool held = strcmp(capture.name, "samsung_x3") == 0;
+    TEST_ASSERT_EQUAL(held, irrecord::trimRepeats(code, kTolerance, kMinRepeatGap));
+    TEST_ASSERT_EQUAL(held ? 2 : 0, code.repeats);
+  }
+}
+
+void test_match(void) {
+  for (const Capture &capture : corpus) {
+    current = &capture;
+    report("index_match", benchIndexMatch, 0);
+    report("linear_match", benchLinearMatch, 0);
+
+    // Both find variants of the capture the query was made from.
+    size_t family = strlen(capture.name);
+    TEST_ASSERT_NOT_EQUAL(0, library.findNearest(rawCode(capture), matches, kMatchResults,
+                                                 kMinMatchScore));
+    TEST_ASSERT_EQUAL_STRING_LEN(capture.name, matches[0].name, family);
+    benchLinearMatch();
+    TEST_ASSERT_NOT_EQUAL(0, benchSink);
+    TEST_ASSERT_EQUAL_STRING_LEN(capture.name, matches[0].name, family);
+  }
+}
+
+// A library of similar remotes: each corpus capture again and again, every
+// timing moved by up to 10%.
+static void fillLibrary() {
+  static char names[kLibrarySize][IRCodeIndex::kMaxNameLength + 1];
+  library.begin(kLibrarySize, kTolerance);
+  for (uint16_t i = 0; i < kLibrarySize; i++) {
+    const Capture &base = corpus[i % 4];
+    makeVariant(libraryCodes[i], base, 10, i * 2654435761u);
+    snprintf(names[i], sizeof(names[i]), "%s_%u", base.name, i);
+    libraryCodes[i].name = names[i];
+    library.add(names[i], rawCode(libraryCodes[i]));
+  }
+}
+
+// Reads one recorded capture, a record or raw_array text, into `capture`.
+static bool loadRecorded(const char *path, Capture &capture) {
+  static uint8_t file[8 * kMaxTimings];
+  FILE *stream = fopen(path, "rb");
+  if (stream == nullptr) {
+    return false;
+  }
+  size_t length = fread(file, 1, sizeof(file), stream);
+  bool whole = feof(stream) != 0;
+  fclose(stream);
+  if (!whole) {
+    return false;
+  }
+
+  uint16_t count = 0;
+  if (irrecord::isRecord(file, length)) {
+    irrecord::IRCode code;
+    if (irrecord::decode(file, length, capture.timings, kMaxTimings, code) != irrecord::RECORD_OK ||
+        !code.isRaw() || code.repeats != 0) {
+      return false;  // Only plain raw captures say anything about the timings.
+    }
+    count = code.length;
+  } else if (irrecord::parseText((const char *)file, length, capture.timings, kMaxTimings,
+                                 count) != irrecord::PARSE_OK) {
+    return false;
+  }
+  capture.length = count;
+  return count != 0;
+}
+
+// Loads the recorded captures, in name order so runs line up.
+static void loadRecordedCaptures() {
+  static char names[kMaxRecorded][64];
+  const char *directory = getenv("IR_BENCH_CAPTURES");
+  if (directory == nullptr) {
+    directory = kRecordedPath;
+  }
+  DIR *listing = opendir(directory);
+  if (listing == nullptr) {
+    return;
+  }
+  dirent *entry;
+  while ((entry = readdir(listing)) != nullptr && recordedCount < kMaxRecorded) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+    Capture &capture = recorded[recordedCount];
+    if (entry->d_name[0] == '.' || !loadRecorded(path, capture)) {
+      continue;
+    }
+    snprintf(names[recordedCount], sizeof(names[recordedCount]), "recorded_%.48s", entry->d_name);
+    char *extension = strrchr(names[recordedCount], '.');
+    if (extension != nullptr) {
+      *extension = 0;
+    }
+    capture.name = names[recordedCount];
+    recordedCount++;
+  }
+  closedir(listing);
+  qsort(recorded, recordedCount, sizeof(Capture), [](const void *a, const void *b) {
+    return strcmp(((const Capture *)a)->name, ((const Capture *)b)->name);
+  });
+}
+
+int main() {
+  makeNec(corpus[0]);
+  makeSamsung(corpus[1]);
+  makeKelvinator(corpus[2]);
+  makeDaikin(corpus[3]);
+  makeLength(sized[0], "plain_100", 100);
+  makeLength(sized[1], "plain_500", 500);
+  makeLength(sized[2], "plain_1024", 1024);
+  loadRecordedCaptures();
+  fillLibrary();
+  // The first thread also pays for resolving library calls, so the second
+  // one tells what every benchmark thread takes.
+  measure(benchNothing);
+  threadStack = measure(benchNothing).peakStack;
+
+#ifdef __OPTIMIZE__
+  printf("# ir-bench-host,%u,1\n", kBenchFormatVersion);
+#else
+  printf("# ir-bench-host,%u,0\n", kBenchFormatVersion);
+#endif
+  printf("bench,capture,entries,bytes,iterations,ns_per_op,alloc_bytes,peak_stack\n");
+
+  UNITY_BEGIN();
+  RUN_TEST(test_text_write);
+  RUN_TEST(test_text_parse);
+  RUN_TEST(test_record);
+  RUN_TEST(test_ticks_to_timings);
+  RUN_TEST(test_compress);
+  RUN_TEST(test_frame);
+  RUN_TEST(test_trim_repeats);
+  RUN_TEST(test_match);
+  return UNITY_END();
+}
@@ -0,0 +1,164 @@
+// Host tests for UDP_Clients.h: pio test -e native -f test_client_table
+#include <unity.h>
+#include <stdint.h>
+#include <map>
+#include <random>
+#include <utility>
+#include <UDP_Clients.h>
+
+static const uint16_t kClients = 8;
+typedef ClientTable<kClients> Table;
+typedef std::pair<uint32_t, uint16_t> Address;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// The bucket ClientTable starts probing at, for a table of 16 buckets.
+static uint16_t homeBucket(uint32_t ip, uint16_t port) {
+  uint32_t key = (ip ^ ((uint32_t)port << 16) ^ port) * 2654435761u;
+  return (key >> 16) & 15;
+}
+
+// Checks every lookup, and the dense list of ids, against `expected`.
+static void checkTable(Table &table, const std::map<Address, uint16_t> &expected,
+                       const Address *addresses, size_t count) {
+  TEST_ASSERT_EQUAL(expected.size(), table.size());
+  TEST_ASSERT_EQUAL(expected.size() == kClients, table.isFull());
+  for (size_t i = 0; i < count; i++) {
+    auto found = expected.find(addresses[i]);
+    uint16_t id = table.find(addresses[i].first, addresses[i].second);
+    TEST_ASSERT_EQUAL(found == expected.end() ? Table::kNoClient : found->second, id);
+  }
+
+  bool listed[kClients] = {};
+  for (uint16_t i = 0; i < table.size(); i++) {
+    uint16_t id = table.client(i);
+    TEST_ASSERT_TRUE(id < kClients);
+    TEST_ASSERT_FALSE(listed[id]);
+    listed[id] = true;
+  }
+  for (const auto &client : expected) {
+    TEST_ASSERT_TRUE(listed[client.second]);
+    TEST_ASSERT_EQUAL_UINT32(client.first.first, table[client.second].ip);
+    TEST_ASSERT_EQUAL(client.first.second, table[client.second].port);
+  }
+}
+
+void test_add_find_remove(void) {
+  Table table;
+  uint16_t id = table.add(0x0A000002, 5000);
+  TEST_ASSERT_TRUE(id < kClients);
+  TEST_ASSERT_EQUAL(id, table.add(0x0A000002, 5000));   // Already there.
+  TEST_ASSERT_EQUAL(1, table.size());
+  TEST_ASSERT_EQUAL(Table::kNoClient, table.find(0x0A000002, 5001));
+
+  table[id].missedPongs = 3;
+  table.remove(id);
+  TEST_ASSERT_EQUAL(0, table.size());
+  TEST_ASSERT_EQUAL(Table::kNoClient, table.find(0x0A000002, 5000));
+  table.remove(id);   // Not registered, nothing happens.
+  TEST_ASSERT_EQUAL(0, table.size());
+
+  // A client that comes back starts a fresh session.
+  id = table.add(0x0A000002, 5000);
+  TEST_ASSERT_EQUAL(0, table[id].missedPongs);
+}
+
+void test_full(void) {
+  Table table;
+  for (uint16_t i = 0; i < kClients; i++) {
+    TEST_ASSERT_TRUE(table.add(0xC0A80000 + i, 4000) != Table::kNoClient);
+  }
+  TEST_ASSERT_TRUE(table.isFull());
+  TEST_ASSERT_EQUAL(Table::kNoClient, table.add(0xC0A800FF, 4000));
+  // Registered clients are still found, and a removal frees a place.
+  uint16_t id = table.find(0xC0A80003, 4000);
+  TEST_ASSERT_TRUE(id != Table::kNoClient);
+  table.remove(id);
+  TEST_ASSERT_EQUAL(id, table.add(0xC0A800FF, 4000));
+}
+
+void test_colliding_removal(void) {
+  // Addresses that all start probing at the same bucket, and one that
+  // starts right after it, so removing from the front of the run has to
+  // shift the others back.
+  Address addresses[4];
+  size_t count = 0;
+  uint16_t home = homeBucket(0x0A000001, 7000);
+  addresses[count++] = {0x0A000001, 7000};
+  for (uint16_t port = 7001; count < 3; port++) {
+    if (homeBucket(0x0A000001, port) == home) {
+      addresses[count++] = {0x0A000001, port};
+    }
+  }
+  for (uint16_t port = 7001; count < 4; port++) {
+    if (homeBucket(0x0A000001, port) == ((home + 1) & 15)) {
+      addresses[count++] = {0x0A000001, port};
+    }
+  }
+
+  // Remove each of them in turn from the full run, and add it back.
+  for (size_t removed = 0; removed < count; removed++) {
+    Table table;
+    std::map<Address, uint16_t> expected;
+    for (size_t i = 0; i < count; i++) {
+      expected[addresses[i]] = table.add(addresses[i].first, addresses[i].second);
+    }
+    checkTable(table, expected, addresses, count);
+
+    table.remove(expected[addresses[removed]]);
+    expected.erase(addresses[removed]);
+    checkTable(table, expected, addresses, count);
+
+    expected[addresses[removed]] = table.add(addresses[removed].first, addresses[removed].second);
+    checkTable(table, expected, addresses, count);
+  }
+}
+
+// Adds and removes clients at random against a map, with few enough
+// addresses that probe runs collide and wrap around the end of the index.
+void test_random_against_reference(void) {
+  Address addresses[24];
+  const size_t count = sizeof(addresses) / sizeof(addresses[0]);
+  for (size_t i = 0; i < count; i++) {
+    addresses[i] = {0xC0A80100 + i % 6, (uint16_t)(5000 + i / 6)};
+  }
+
+  Table table;
+  std::map<Address, uint16_t> expected;
+  std::mt19937 random(21);
+  uint32_t collisions = 0;
+  for (int round = 0; round < 20000; round++) {
+    const Address &address = addresses[random() % count];
+    if (random() % 2 == 0) {
+      uint16_t id = table.add(address.first, address.second);
+      if (expected.count(address) == 1) {
+        TEST_ASSERT_EQUAL(expected[address], id);
+      } else if (expected.size() == kClients) {
+        TEST_ASSERT_EQUAL(Table::kNoClient, id);
+      } else {
+        TEST_ASSERT_TRUE(id != Table::kNoClient);
+        for (const auto &client : expected) {
+          TEST_ASSERT_TRUE(client.second != id);
+          collisions += homeBucket(client.first.first, client.first.second) ==
+                        homeBucket(address.first, address.second);
+        }
+        expected[address] = id;
+      }
+    } else if (expected.count(address) == 1) {
+      table.remove(expected[address]);
+      expected.erase(address);
+    }
+    checkTable(table, expected, addresses, count);
+  }
+  TEST_ASSERT_TRUE_MESSAGE(collisions > 100, "too few colliding addresses");
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_add_find_remove);
+  RUN_TEST(test_full);
+  RUN_TEST(test_colliding_removal);
+  RUN_TEST(test_random_against_reference);
+  return UNITY_END();
+}
@@ -0,0 +1,162 @@
+// Host tests for IR_Matcher: pio test -e native -f test_ir_matcher
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <IR_Matcher.h>
+
+using namespace irrecord;
+
+static const int16_t kNec = 3;        // decode_type_t NEC.
+static const int16_t kSamsung = 7;    // decode_type_t SAMSUNG.
+static const int16_t kDaikin = 16;    // decode_type_t DAIKIN.
+
+static IRCodeIndex codes;
+static IRMatch matches[3];
+
+// A value protocol as read() stores it: the value in (bits + 7) / 8 bytes.
+static uint8_t valueBytes[8];
+static IRCode valueCode(int16_t protocol, uint64_t value, uint16_t bits) {
+  for (uint8_t i = 0; i < 8; i++) {
+    valueBytes[i] = value >> (8 * i);
+  }
+  IRCode code;
+  code.protocol = protocol;
+  code.bits = bits;
+  code.length = (bits + 7) / 8;
+  code.bytes = valueBytes;
+  return code;
+}
+
+// NEC frame for an address and command, as raw timings.
+static uint16_t necTimings[68];
+static IRCode necRaw(uint8_t address, uint8_t command) {
+  uint32_t data = address | (uint32_t)(address ^ 0xFF) << 8 | (uint32_t)command << 16 |
+                  (uint32_t)(command ^ 0xFF) << 24;
+  uint16_t length = 0;
+  necTimings[length++] = 9000;
+  necTimings[length++] = 4500;
+  for (uint8_t bit = 0; bit < 32; bit++) {
+    necTimings[length++] = 560;
+    necTimings[length++] = (data >> bit) & 1 ? 1690 : 560;
+  }
+  necTimings[length++] = 560;
+  IRCode code;
+  code.frequency = 38000;
+  code.timings = necTimings;
+  code.length = length;
+  return code;
+}
+
+void setUp(void) {
+  TEST_ASSERT_TRUE(codes.begin(64, 25));
+}
+void tearDown(void) {}
+
+void test_raw_duplicate_and_similar(void) {
+  TEST_ASSERT_TRUE(codes.add("tv_power", necRaw(0x04, 0x08)));
+  TEST_ASSERT_TRUE(codes.add("tv_mute", necRaw(0x04, 0x09)));
+  TEST_ASSERT_TRUE(codes.add("amp_power", necRaw(0x7A, 0x40)));
+
+  TEST_ASSERT_EQUAL(3, codes.findNearest(necRaw(0x04, 0x08), matches, 3));
+  TEST_ASSERT_EQUAL_STRING("tv_power", matches[0].name);
+  TEST_ASSERT_EQUAL(100, matches[0].score);
+  TEST_ASSERT_EQUAL_STRING("tv_mute", matches[1].name);
+  TEST_ASSERT_LESS_THAN(100, matches[1].score);
+  TEST_ASSERT_GREATER_THAN(matches[2].score, matches[1].score);
+
+  TEST_ASSERT_EQUAL(2, codes.findNearest(necRaw(0x04, 0x08), matches, 3, 1, "tv_power"));
+  TEST_ASSERT_EQUAL_STRING("tv_mute", matches[0].name);
+}
+
+void test_protocol_value_distance(void) {
+  // Two buttons of one remote, an unrelated value and another protocol.
+  TEST_ASSERT_TRUE(codes.add("power", valueCode(kNec, 0x20DF10EF, 32)));
+  TEST_ASSERT_TRUE(codes.add("mute", valueCode(kNec, 0x20DF906F, 32)));
+  TEST_ASSERT_TRUE(codes.add("other", valueCode(kNec, 0xDF20EF10, 32)));
+  TEST_ASSERT_TRUE(codes.add("samsung", valueCode(kSamsung, 0x20DF10EF, 32)));
+
+  // The same value is a duplicate, the other button is similar, the
+  // unrelated value is not, and other protocols never match.
+  TEST_ASSERT_EQUAL(2, codes.findNearest(valueCode(kNec, 0x20DF10EF, 32), matches, 3, 60));
+  TEST_ASSERT_EQUAL_STRING("power", matches[0].name);
+  TEST_ASSERT_EQUAL(100, matches[0].score);
+  TEST_ASSERT_EQUAL_STRING("mute", matches[1].name);
+  TEST_ASSERT_EQUAL(93, matches[1].score);  // 30 of 32 bits agree.
+
+  // Close to a stored value, but never a duplicate of it.
+  TEST_ASSERT_EQUAL(2, codes.findNearest(valueCode(kNec, 0x20DF10EE, 32), matches, 3, 60));
+  TEST_ASSERT_EQUAL_STRING("power", matches[0].name);
+  TEST_ASSERT_EQUAL(96, matches[0].score);
+}
+
+void test_protocol_state_distance(void) {
+  uint8_t state[35];
+  for (uint8_t i = 0; i < sizeof(state); i++) {
+    state[i] = i * 37;
+  }
+  IRCode code;
+  code.protocol = kDaikin;
+  code.bits = sizeof(state) * 8;
+  code.length = sizeof(state);
+  code.bytes = state;
+  TEST_ASSERT_TRUE(codes.add("ac_cool_22", code));
+
+  // One degree warmer: a couple of bits in the temperature and the checksum.
+  state[6] ^= 0x02;
+  state[34] ^= 0x03;
+  TEST_ASSERT_EQUAL(1, codes.findNearest(code, matches, 3, 60));
+  TEST_ASSERT_EQUAL(98, matches[0].score);
+
+  // A shorter state of the same protocol is scaled down by its length.
+  code.length = 27;
+  code.bits = 27 * 8;
+  TEST_ASSERT_EQUAL(1, codes.findNearest(code, matches, 3, 1));
+  TEST_ASSERT_LESS_THAN(80, matches[0].score);
+}
+
+void test_add_replace_remove_by_name(void) {
+  char name[16];
+  // Enough codes for long probe runs in the name table.
+  for (uint16_t i = 0; i < 64; i++) {
+    snprintf(name, sizeof(name), "code%u", i);
+    TEST_ASSERT_TRUE(codes.add(name, valueCode(kNec, i, 32)));
+  }
+  TEST_ASSERT_EQUAL(64, codes.size());
+  TEST_ASSERT_FALSE(codes.add("one_too_many", valueCode(kNec, 1000, 32)));
+
+  // Replacing keeps the count, the new value is found under the old name.
+  TEST_ASSERT_TRUE(codes.add("code10", valueCode(kNec, 0xABCDEF, 32)));
+  TEST_ASSERT_EQUAL(64, codes.size());
+  TEST_ASSERT_EQUAL(1, codes.findNearest(valueCode(kNec, 0xABCDEF, 32), matches, 1, 100));
+  TEST_ASSERT_EQUAL_STRING("code10", matches[0].name);
+
+  // Remove every other code; the rest must still be found by name and value.
+  for (uint16_t i = 0; i < 64; i += 2) {
+    snprintf(name, sizeof(name), "code%u", i);
+    codes.remove(name);
+  }
+  codes.remove("missing");
+  TEST_ASSERT_EQUAL(32, codes.size());
+  for (uint16_t i = 1; i < 64; i += 2) {
+    snprintf(name, sizeof(name), "code%u", i);
+    TEST_ASSERT_EQUAL(1, codes.findNearest(valueCode(kNec, i, 32), matches, 1, 100));
+    TEST_ASSERT_EQUAL_STRING(name, matches[0].name);
+    TEST_ASSERT_TRUE(codes.add(name, valueCode(kNec, i + 1000, 32)));
+  }
+  TEST_ASSERT_EQUAL(32, codes.size());
+  TEST_ASSERT_EQUAL(0, codes.findNearest(valueCode(kNec, 0, 32), matches, 1, 100));
+
+  codes.clear();
+  TEST_ASSERT_EQUAL(0, codes.size());
+  TEST_ASSERT_TRUE(codes.add("code1", valueCode(kNec, 1, 32)));
+  TEST_ASSERT_EQUAL(1, codes.size());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_raw_duplicate_and_similar);
+  RUN_TEST(test_protocol_value_distance);
+  RUN_TEST(test_protocol_state_distance);
+  RUN_TEST(test_add_replace_remove_by_name);
+  return UNITY_END();
+}
@@ -0,0 +1,167 @@
+// Host tests for IR_Record: pio test -e native -f test_ir_record
+#include <unity.h>
+#include <string.h>
+#include <IR_Record.h>
+
+using namespace irrecord;
+
+static const uint8_t kTolerance = 25;
+static const uint16_t kMinGap = 5000;
+
+// A short frame: header, three bits, trailing mark.
+static const uint16_t kFrame[] = {9000, 4500, 560, 560, 560, 1690, 560, 560, 560};
+static const uint16_t kFrameLength = sizeof(kFrame) / sizeof(kFrame[0]);
+static const uint16_t kGap = 40000;
+
+// `frames` copies of kFrame separated by kGap, with some jitter.
+static uint16_t buildRepeats(uint16_t *timings, uint8_t frames) {
+  uint16_t length = 0;
+  for (uint8_t frame = 0; frame < frames; frame++) {
+    if (frame != 0) {
+      timings[length++] = kGap + frame * 100;
+    }
+    for (uint16_t i = 0; i < kFrameLength; i++) {
+      timings[length++] = kFrame[i] + (i + frame) % 3 * 10;
+    }
+  }
+  return length;
+}
+
+static IRCode rawCode(const uint16_t *timings, uint16_t length) {
+  IRCode code;
+  code.frequency = 38000;
+  code.timings = timings;
+  code.length = length;
+  return code;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_trim_two_frames(void) {
+  uint16_t timings[64];
+  IRCode code = rawCode(timings, buildRepeats(timings, 2));
+  TEST_ASSERT_EQUAL(2 * kFrameLength + 1, code.length);
+  TEST_ASSERT_TRUE(trimRepeats(code, kTolerance, kMinGap));
+  TEST_ASSERT_EQUAL(kFrameLength, code.length);
+  TEST_ASSERT_EQUAL(1, code.repeats);
+  TEST_ASSERT_EQUAL(kGap + 100, code.gap);
+}
+
+void test_trim_three_frames(void) {
+  uint16_t timings[64];
+  IRCode code = rawCode(timings, buildRepeats(timings, 3));
+  TEST_ASSERT_TRUE(trimRepeats(code, kTolerance, kMinGap));
+  TEST_ASSERT_EQUAL(kFrameLength, code.length);
+  TEST_ASSERT_EQUAL(2, code.repeats);
+}
+
+void test_single_frame_untouched(void) {
+  uint16_t timings[64];
+  IRCode code = rawCode(timings, buildRepeats(timings, 1));
+  TEST_ASSERT_FALSE(trimRepeats(code, kTolerance, kMinGap));
+  TEST_ASSERT_EQUAL(kFrameLength, code.length);
+  TEST_ASSERT_EQUAL(0, code.repeats);
+}
+
+void test_different_frames_untouched(void) {
+  uint16_t timings[64];
+  uint16_t length = buildRepeats(timings, 2);
+  timings[kFrameLength + 1 + 3] = 1690;  // Flip a bit of the second frame.
+  IRCode code = rawCode(timings, length);
+  TEST_ASSERT_FALSE(trimRepeats(code, kTolerance, kMinGap));
+  TEST_ASSERT_EQUAL(length, code.length);
+}
+
+void test_short_gap_untouched(void) {
+  uint16_t timings[64];
+  uint16_t length = buildRepeats(timings, 2);
+  timings[kFrameLength] = kMinGap - 1;
+  IRCode code = rawCode(timings, length);
+  TEST_ASSERT_FALSE(trimRepeats(code, kTolerance, kMinGap));
+}
+
+void test_trimmed_record_round_trip(void) {
+  uint16_t timings[64];
+  IRCode code = rawCode(timings, buildRepeats(timings, 2));
+  TEST_ASSERT_TRUE(trimRepeats(code, kTolerance, kMinGap));
+
+  uint8_t record[maxRecordSize(64)];
+  size_t size = encode(code, record, sizeof(record));
+  TEST_ASSERT_NOT_EQUAL(0, size);
+
+  uint16_t decoded[64];
+  IRCode copy;
+  TEST_ASSERT_EQUAL(RECORD_OK, decode(record, size, decoded, 64, copy));
+  TEST_ASSERT_EQUAL(code.length, copy.length);
+  TEST_ASSERT_EQUAL(code.repeats, copy.repeats);
+  TEST_ASSERT_EQUAL(code.gap, copy.gap);
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(timings, decoded, code.length);
+}
+
+static char text[512];
+static size_t textLength;
+
+static size_t collect(const uint8_t *data, size_t length, void *calls) {
+  memcpy(text + textLength, data, length);
+  textLength += length;
+  (*(uint8_t *)calls)++;
+  return length;
+}
+
+void test_text_round_trip(void) {
+  // Long enough to be handed over in several chunks, widest numbers included.
+  uint16_t timings[40];
+  for (uint16_t i = 0; i < 40; i++) {
+    timings[i] = i % 3 == 0 ? 65535 : i * 7;
+  }
+  uint8_t calls = 0;
+  textLength = 0;
+  size_t written = writeText(timings, 40, collect, &calls);
+  TEST_ASSERT_EQUAL(textLength, written);
+  TEST_ASSERT_GREATER_THAN(1, calls);
+  TEST_ASSERT_EQUAL_MEMORY("raw_array:[65535,7,14,65535,", text, 28);
+  TEST_ASSERT_EQUAL(']', text[textLength - 1]);
+
+  uint16_t parsed[40];
+  uint16_t count;
+  TEST_ASSERT_EQUAL(PARSE_OK, parseText(text, textLength, parsed, 40, count));
+  TEST_ASSERT_EQUAL(40, count);
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(timings, parsed, 40);
+
+  textLength = 0;
+  writeText(timings, 0, collect, &calls);
+  TEST_ASSERT_EQUAL(12, textLength);
+  TEST_ASSERT_EQUAL_MEMORY("raw_array:[]", text, 12);
+}
+
+void test_ticks_to_timings(void) {
+  // The gap before the capture, a mark, a 70000us space and a mark, in
+  // 2us ticks.
+  const uint16_t ticks[] = {50000, 4500, 35000, 280};
+  uint16_t timings[8];
+  bool overflow = true;
+  TEST_ASSERT_EQUAL(5, ticksToTimings(ticks, 4, 2, timings, 8, overflow));
+  TEST_ASSERT_FALSE(overflow);
+  const uint16_t expected[] = {9000, 65535, 0, 4465, 560};
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(expected, timings, 5);
+
+  // A split gap that does not fit whole is not kept truncated.
+  TEST_ASSERT_EQUAL(1, ticksToTimings(ticks, 4, 2, timings, 3, overflow));
+  TEST_ASSERT_TRUE(overflow);
+  TEST_ASSERT_EQUAL(4, ticksToTimings(ticks, 4, 2, timings, 4, overflow));
+  TEST_ASSERT_TRUE(overflow);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_trim_two_frames);
+  RUN_TEST(test_trim_three_frames);
+  RUN_TEST(test_single_frame_untouched);
+  RUN_TEST(test_different_frames_untouched);
+  RUN_TEST(test_short_gap_untouched);
+  RUN_TEST(test_trimmed_record_round_trip);
+  RUN_TEST(test_text_round_trip);
+  RUN_TEST(test_ticks_to_timings);
+  return UNITY_END();
+}
@@ -0,0 +1,185 @@
+// Host tests for SPSC_Queue.h: pio test -e native -f test_spsc_queue
+#include <unity.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <SPSC_Queue.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Large enough that a torn slot would show up as a payload mismatch.
+struct Item {
+  uint32_t sequence;
+  uint32_t payload[15];
+};
+
+static void fill(Item &item, uint32_t sequence) {
+  item.sequence = sequence;
+  for (uint32_t i = 0; i < 15; i++) {
+    item.payload[i] = sequence * 2654435761u + i;
+  }
+}
+
+static bool intact(const Item &item) {
+  for (uint32_t i = 0; i < 15; i++) {
+    if (item.payload[i] != item.sequence * 2654435761u + i) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void test_fills_every_slot_then_drops(void) {
+  SPSCQueue<uint32_t, 4> queue;
+  TEST_ASSERT_TRUE(queue.empty());
+  for (uint32_t i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(queue.push(i));
+  }
+  TEST_ASSERT_EQUAL(4, queue.size());
+  TEST_ASSERT_FALSE(queue.push(4));
+  TEST_ASSERT_NULL(queue.reserve());
+  TEST_ASSERT_EQUAL(2, queue.dropped());
+
+  for (uint32_t i = 0; i < 4; i++) {
+    uint32_t *item = queue.front();
+    TEST_ASSERT_NOT_NULL(item);
+    TEST_ASSERT_EQUAL(i, *item);
+    queue.pop();
+  }
+  TEST_ASSERT_NULL(queue.front());
+}
+
+void test_wraps_around(void) {
+  SPSCQueue<uint32_t, 4> queue;
+  for (uint32_t i = 0; i < 1000; i++) {
+    TEST_ASSERT_TRUE(queue.push(i));
+    TEST_ASSERT_TRUE(queue.push(i + 1));
+    TEST_ASSERT_EQUAL(i, *queue.front());
+    queue.pop();
+    TEST_ASSERT_EQUAL(i + 1, *queue.front());
+    queue.pop();
+  }
+  TEST_ASSERT_TRUE(queue.empty());
+  TEST_ASSERT_EQUAL(0, queue.dropped());
+}
+
+// A producer and a consumer thread hammer a small queue: every item must come
+// out once, in order and whole, and every failed reserve() must be counted.
+void test_producer_consumer_threads(void) {
+  static SPSCQueue<Item, 8> queue;
+  const uint32_t kItems = 200000;
+  uint32_t failedReserves = 0;
+
+  std::thread producer([&]() {
+    for (uint32_t sequence = 0; sequence < kItems;) {
+      Item *slot = queue.reserve();
+      if (slot == nullptr) {
+        failedReserves++;
+        std::this_thread::yield();
+        continue;
+      }
+      fill(*slot, sequence++);
+      queue.commit();
+    }
+  });
+
+  uint32_t expected = 0;
+  uint32_t outOfOrder = 0;
+  uint32_t torn = 0;
+  while (expected < kItems) {
+    Item *item = queue.front();
+    if (item == nullptr) {
+      std::this_thread::yield();
+      continue;
+    }
+    outOfOrder += item->sequence != expected;
+    torn += !intact(*item);
+    expected++;
+    queue.pop();
+  }
+  producer.join();
+
+  TEST_ASSERT_EQUAL(0, outOfOrder);
+  TEST_ASSERT_EQUAL(0, torn);
+  TEST_ASSERT_TRUE(queue.empty());
+  TEST_ASSERT_EQUAL(failedReserves, queue.dropped());
+}
+
+// What IRController::start() relies on: captures queued before a learn, e.g.
+// repeat frames of a held button, are gone and fresh ones come through.
+void test_clear_drops_queued_items(void) {
+  SPSCQueue<uint32_t, 4> queue;
+  for (uint32_t i = 0; i < 5; i++) {
+    queue.push(i);
+  }
+  queue.pop();
+  queue.clear();
+  TEST_ASSERT_TRUE(queue.empty());
+  TEST_ASSERT_NULL(queue.front());
+
+  // Every slot is usable again.
+  for (uint32_t i = 100; i < 104; i++) {
+    TEST_ASSERT_TRUE(queue.push(i));
+  }
+  TEST_ASSERT_EQUAL(100, *queue.front());
+  queue.clear();
+  queue.clear();
+  TEST_ASSERT_TRUE(queue.empty());
+}
+
+// clear() while the producer keeps going: everything committed before it is
+// dropped, nothing after it is lost, reordered or torn.
+void test_clear_while_producing(void) {
+  static SPSCQueue<Item, 8> queue;
+  const uint32_t kItems = 200000;
+  std::atomic<uint32_t> committed{0};
+
+  std::thread producer([&]() {
+    for (uint32_t sequence = 0; sequence < kItems;) {
+      Item *slot = queue.reserve();
+      if (slot == nullptr) {
+        std::this_thread::yield();
+        continue;
+      }
+      fill(*slot, sequence++);
+      queue.commit();
+      committed.store(sequence, std::memory_order_release);
+    }
+  });
+
+  uint32_t staleOrOutOfOrder = 0;
+  uint32_t torn = 0;
+  uint32_t next = 0;
+  for (uint32_t round = 0; next < kItems; round++) {
+    if (round % 64 == 0) {
+      uint32_t before = committed.load(std::memory_order_acquire);
+      queue.clear();
+      next = next > before ? next : before;
+      continue;
+    }
+    Item *item = queue.front();
+    if (item == nullptr) {
+      std::this_thread::yield();
+      continue;
+    }
+    staleOrOutOfOrder += item->sequence < next;
+    torn += !intact(*item);
+    next = item->sequence + 1;
+    queue.pop();
+  }
+  producer.join();
+
+  TEST_ASSERT_EQUAL(0, staleOrOutOfOrder);
+  TEST_ASSERT_EQUAL(0, torn);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_fills_every_slot_then_drops);
+  RUN_TEST(test_wraps_around);
+  RUN_TEST(test_producer_consumer_threads);
+  RUN_TEST(test_clear_drops_queued_items);
+  RUN_TEST(test_clear_while_producing);
+  return UNITY_END();
+}
@@ -0,0 +1,144 @@
+// Host tests for Timer_Wheel.h: pio test -e native -f test_timer_wheel
+#include <unity.h>
+#include <stdint.h>
+#include <map>
+#include <utility>
+#include <random>
+#include <Timer_Wheel.h>
+
+static const uint16_t kTimers = 32;
+static const uint16_t kTick = 10;
+typedef TimerWheel<kTimers, kTick> Wheel;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Steps the clock a millisecond at a time from `now` to `end`, recording
+// when each timer fires.
+static void runUntil(Wheel &wheel, uint32_t &now, uint32_t end, uint32_t fired[kTimers]) {
+  while (now != end) {
+    now++;
+    uint16_t id;
+    while ((id = wheel.expire(now)) != Wheel::kNone) {
+      fired[id] = now;
+    }
+  }
+}
+
+static void checkCascade(uint32_t start) {
+  Wheel wheel;
+  wheel.start(start);
+
+  // Either side of the end of the first turns of the near wheel, where
+  // timers move from the far wheel into the near one, and the horizon.
+  const uint32_t turn = Wheel::kNearTicks * kTick;
+  const uint32_t delays[] = {
+    1, kTick, turn - kTick, turn - 1, turn, turn + 1, turn + kTick,
+    2 * turn - 1, 2 * turn, 2 * turn + 3, 5 * turn + 7, Wheel::kHorizonMs
+  };
+  const uint16_t count = sizeof(delays) / sizeof(delays[0]);
+  uint32_t fired[kTimers] = {};
+  for (uint16_t id = 0; id < count; id++) {
+    wheel.schedule(id, start + delays[id]);
+  }
+
+  uint32_t now = start;
+  runUntil(wheel, now, start + Wheel::kHorizonMs + kTick, fired);
+  for (uint16_t id = 0; id < count; id++) {
+    // Never early, at most a tick late.
+    uint32_t late = fired[id] - (start + delays[id]);
+    TEST_ASSERT_TRUE_MESSAGE(late < kTick, "fired outside its tick");
+    TEST_ASSERT_FALSE(wheel.isScheduled(id));
+  }
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFF, wheel.msUntilNext(now));
+}
+
+void test_cascade_boundary(void) {
+  checkCascade(0);
+  checkCascade(123457);
+}
+
+void test_millis_wrap(void) {
+  // The same timers with millis() wrapping half way through.
+  checkCascade(0xFFFFFFFF - 2 * Wheel::kNearTicks * kTick);
+  checkCascade(0xFFFFFFFF - 5);
+}
+
+void test_past_deadline(void) {
+  Wheel wheel;
+  wheel.start(1000);
+  wheel.schedule(3, 400);
+  TEST_ASSERT_EQUAL_UINT32(0, wheel.msUntilNext(1000));
+  TEST_ASSERT_EQUAL(3, wheel.expire(1000));
+  TEST_ASSERT_EQUAL(Wheel::kNone, wheel.expire(1000));
+}
+
+// Arms, moves and cancels timers at random against a map of the deadlines,
+// stepping the clock across many turns of both wheels and a millis() wrap.
+void test_random_against_reference(void) {
+  static Wheel wheel;
+  // Deadline and the time by which each timer must have fired: a tick
+  // after the deadline, or after schedule() if that was already past.
+  std::map<uint16_t, std::pair<uint32_t, uint32_t>> armed;
+  std::mt19937 random(21);
+  const uint32_t turn = Wheel::kNearTicks * kTick;
+
+  uint32_t now = 0xFFFFFFFF - 40 * turn;
+  uint32_t begin = now;
+  wheel.start(now);
+  for (int round = 0; round < 20000; round++) {
+    uint32_t op = random() % 10;
+    uint16_t id = random() % kTimers;
+    if (op < 5) {
+      uint32_t delay;
+      switch (random() % 4) {
+        case 0: delay = random() % (4 * kTick); break;
+        case 1: delay = random() % (3 * turn); break;
+        case 2: delay = random() % (Wheel::kHorizonMs - kTick); break;
+        default: delay = -(uint32_t)(random() % 50); break;   // Already due.
+      }
+      wheel.schedule(id, now + delay);
+      armed[id] = {now + delay, ((int32_t)delay > 0 ? now + delay : now) + kTick};
+    } else if (op < 7) {
+      wheel.cancel(id);
+      armed.erase(id);
+    } else {
+      // msUntilNext() may wake early, but never after a timer is due:
+      // nothing may fire before the time it gives.
+      uint32_t wait = wheel.msUntilNext(now);
+      TEST_ASSERT_EQUAL(armed.empty(), wait == 0xFFFFFFFF);
+      for (const auto &timer : armed) {
+        TEST_ASSERT_TRUE(wait <= timer.second.second - now);
+      }
+      if (wait != 0 && wait != 0xFFFFFFFF) {
+        now += wait - 1;
+        TEST_ASSERT_EQUAL(Wheel::kNone, wheel.expire(now));
+      }
+
+      now += random() % 4 == 0 ? random() % (2 * turn) : random() % (8 * kTick);
+      uint16_t due;
+      while ((due = wheel.expire(now)) != Wheel::kNone) {
+        TEST_ASSERT_TRUE(armed.count(due) == 1);
+        TEST_ASSERT_TRUE_MESSAGE((int32_t)(now - armed[due].first) >= 0, "fired early");
+        armed.erase(due);
+      }
+      for (const auto &timer : armed) {
+        TEST_ASSERT_TRUE_MESSAGE((int32_t)(now - timer.second.second) < 0, "fired late");
+      }
+    }
+
+    for (uint16_t timer = 0; timer < kTimers; timer++) {
+      TEST_ASSERT_EQUAL(armed.count(timer) == 1, wheel.isScheduled(timer));
+    }
+  }
+  TEST_ASSERT_TRUE_MESSAGE(now < begin, "the clock did not wrap");
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_cascade_boundary);
+  RUN_TEST(test_millis_wrap);
+  RUN_TEST(test_past_deadline);
+  RUN_TEST(test_random_against_reference);
+  return UNITY_END();
+}
@@ -0,0 +1,180 @@
+// Host tests for UDP_Discovery.h: pio test -e native -f test_udp_discovery
+#include <unity.h>
+#include <string.h>
+#include <UDP_Discovery.h>
+
+using namespace udpproto;
+
+static const uint32_t kMinMs = 1000;
+static const uint32_t kMaxMs = 120000;
+static const uint16_t kPort = 8181;
+// IPAddress order, first octet in the low byte.
+static const uint32_t kLocal = 0x6401A8C0;      // 192.168.1.100
+static const uint32_t kBroadcast = 0xFF01A8C0;  // 192.168.1.255
+
+// Stands in for the socket: records what would have been sent.
+struct Sent {
+  uint32_t ip;
+  uint16_t port;
+  uint16_t sequence;
+  char text[16];
+};
+
+static Sent sent[64];
+static uint8_t sentCount;
+static bool linkUp;
+
+static bool fakeSend(uint32_t ip, uint16_t port, const uint8_t *data, size_t length, void *) {
+  Frame frame;
+  if (!linkUp || parseFrame(data, length, frame) != FRAME_OK || frame.opcode != OP_ANNOUNCE ||
+      sentCount == 64) {
+    return false;
+  }
+  Sent &datagram = sent[sentCount++];
+  datagram.ip = ip;
+  datagram.port = port;
+  datagram.sequence = frame.sequence;
+  payloadText(frame, datagram.text, sizeof(datagram.text));
+  return true;
+}
+
+typedef DiscoveryResponder<kMinMs, kMaxMs> Responder;
+
+// Polls every 10ms from `from` until `to`, returns the time of the last poll.
+static uint32_t run(Responder &responder, uint32_t from, uint32_t to) {
+  uint32_t now = from;
+  for (; now < to; now += 10) {
+    responder.poll(now);
+  }
+  return now;
+}
+
+void setUp(void) {
+  sentCount = 0;
+  linkUp = true;
+}
+void tearDown(void) {}
+
+void test_silent_without_address(void) {
+  Responder responder(fakeSend, nullptr, kPort);
+  TEST_ASSERT_EQUAL(0xFFFFFFFF, responder.msUntilNext(0));
+  run(responder, 0, 5000);
+  TEST_ASSERT_EQUAL(0, sentCount);
+}
+
+void test_backoff_schedule(void) {
+  Responder responder(fakeSend, nullptr, kPort);
+  responder.setAddress(kLocal, kBroadcast);
+  run(responder, 0, 600000);
+
+  // Right away, after kMinMs, then twice as long each time up to kMaxMs.
+  const uint32_t expected[] = {0, 1000, 3000, 7000, 15000, 31000, 63000, 127000, 247000, 367000, 487000};
+  TEST_ASSERT_EQUAL(sizeof(expected) / sizeof(expected[0]), sentCount);
+  TEST_ASSERT_EQUAL(kMaxMs, responder.currentInterval());
+  for (uint8_t i = 0; i < sentCount; i++) {
+    TEST_ASSERT_EQUAL(kBroadcast, sent[i].ip);
+    TEST_ASSERT_EQUAL(kPort, sent[i].port);
+    TEST_ASSERT_EQUAL(i + 1, sent[i].sequence);
+    TEST_ASSERT_EQUAL_STRING("192.168.1.100", sent[i].text);
+  }
+  TEST_ASSERT_EQUAL(487000 + kMaxMs - 600000, responder.msUntilNext(600000));
+}
+
+void test_restarts_on_address_change(void) {
+  Responder responder(fakeSend, nullptr, kPort);
+  responder.setAddress(kLocal, kBroadcast);
+  uint32_t now = run(responder, 0, 300000);
+  uint8_t before = sentCount;
+
+  // The same address again changes nothing.
+  responder.setAddress(kLocal, kBroadcast);
+  TEST_ASSERT_GREATER_THAN(0, responder.msUntilNext(now));
+
+  // A new one is announced at once, and the backoff starts over.
+  responder.setAddress(0x6501A8C0, kBroadcast);
+  TEST_ASSERT_EQUAL(0, responder.msUntilNext(now));
+  run(responder, now, now + 3500);
+  TEST_ASSERT_EQUAL(before + 3, sentCount);
+  TEST_ASSERT_EQUAL_STRING("192.168.1.101", sent[before].text);
+  TEST_ASSERT_EQUAL(4 * kMinMs, responder.currentInterval());
+}
+
+void test_restarts_after_link_loss(void) {
+  Responder responder(fakeSend, nullptr, kPort);
+  responder.setAddress(kLocal, kBroadcast);
+  uint32_t now = run(responder, 0, 300000);
+  uint8_t before = sentCount;
+
+  // While the link is down nothing goes out; a failed announcement is tried
+  // again after kMinMs rather than at once.
+  linkUp = false;
+  responder.restart();
+  TEST_ASSERT_FALSE(responder.poll(now));
+  TEST_ASSERT_EQUAL(kMinMs, responder.msUntilNext(now));
+  TEST_ASSERT_FALSE(responder.poll(now + 10));
+
+  // The controller restarts the responder while the link is down, so the
+  // device is announced as soon as it is back.
+  now += 5000;
+  responder.restart();
+  linkUp = true;
+  TEST_ASSERT_TRUE(responder.poll(now));
+  TEST_ASSERT_EQUAL(before + 1, sentCount);
+  TEST_ASSERT_EQUAL(kMinMs, responder.msUntilNext(now));
+}
+
+void test_answers_queries(void) {
+  Responder responder(fakeSend, nullptr, kPort);
+  Frame query = {OP_DISCOVER, 77, nullptr, 0, 0};
+  TEST_ASSERT_FALSE(responder.answer(query, 0x0501A8C0, 5000, 0));  // No address yet.
+
+  responder.setAddress(kLocal, kBroadcast);
+  TEST_ASSERT_TRUE(responder.answer(query, 0x0501A8C0, 5000, 0));
+  TEST_ASSERT_EQUAL(1, sentCount);
+  TEST_ASSERT_EQUAL(0x0501A8C0, sent[0].ip);
+  TEST_ASSERT_EQUAL(5000, sent[0].port);
+  TEST_ASSERT_EQUAL(77, sent[0].sequence);
+  TEST_ASSERT_EQUAL_STRING("192.168.1.100", sent[0].text);
+}
+
+void test_rate_limits_queries_per_source(void) {
+  Responder responder(fakeSend, nullptr, kPort);
+  responder.setAddress(kLocal, kBroadcast);
+  Frame query = {OP_DISCOVER, 1, nullptr, 0, 0};
+
+  // A source querying in a tight loop is answered once per kMinMs, from
+  // whatever port it asks.
+  uint8_t answered = 0;
+  for (uint32_t now = 0; now < 10 * kMinMs; now += 10) {
+    answered += responder.answer(query, 0x0501A8C0, 5000 + now % 3, now);
+  }
+  TEST_ASSERT_EQUAL(10, answered);
+
+  // Another source is answered meanwhile.
+  TEST_ASSERT_TRUE(responder.answer(query, 0x0601A8C0, 5000, 10 * kMinMs - 10));
+}
+
+void test_rate_limits_queries_overall(void) {
+  Responder responder(fakeSend, nullptr, kPort);
+  responder.setAddress(kLocal, kBroadcast);
+  Frame query = {OP_DISCOVER, 1, nullptr, 0, 0};
+
+  // Queries from ever new sources: at most kTrackedSources per kMinMs.
+  uint32_t answered = 0;
+  for (uint32_t i = 0; i < 2000; i++) {
+    answered += responder.answer(query, 0x0A000000 + i, 5000, i);
+  }
+  TEST_ASSERT_EQUAL(2 * Responder::kTrackedSources, answered);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_silent_without_address);
+  RUN_TEST(test_backoff_schedule);
+  RUN_TEST(test_restarts_on_address_change);
+  RUN_TEST(test_restarts_after_link_loss);
+  RUN_TEST(test_answers_queries);
+  RUN_TEST(test_rate_limits_queries_per_source);
+  RUN_TEST(test_rate_limits_queries_overall);
+  return UNITY_END();
+}
@@ -0,0 +1,267 @@
+// Host tests for UDP_Protocol: pio test -e native -f test_udp_protocol
+#include <unity.h>
+#include <string.h>
+#include <UDP_Protocol.h>
+
+using namespace udpproto;
+
+static uint8_t buffer[kMaxFrameSize + 128];
+
+void setUp(void) {
+  memset(buffer, 0, sizeof(buffer));
+}
+void tearDown(void) {}
+
+static size_t encodeText(uint8_t opcode, uint16_t sequence, const char *text) {
+  return encodeFrame(buffer, sizeof(buffer), opcode, sequence, (const uint8_t *)text, strlen(text));
+}
+
+void test_round_trip(void) {
+  size_t size = encodeText(OP_SEND, 0xBEEF, "tv_power");
+  TEST_ASSERT_EQUAL(kFrameHeaderSize + 8, size);
+
+  Frame frame;
+  TEST_ASSERT_EQUAL(FRAME_OK, parseFrame(buffer, size, frame));
+  TEST_ASSERT_EQUAL(OP_SEND, frame.opcode);
+  TEST_ASSERT_EQUAL(0xBEEF, frame.sequence);
+  TEST_ASSERT_EQUAL(8, frame.length);
+  TEST_ASSERT_TRUE(frame.payload == buffer + kFrameHeaderSize);
+
+  char name[16];
+  TEST_ASSERT_TRUE(payloadText(frame, name, sizeof(name)));
+  TEST_ASSERT_EQUAL_STRING("tv_power", name);
+  TEST_ASSERT_FALSE(payloadText(frame, name, 8));  // No room for the NUL.
+}
+
+void test_round_trip_empty_and_largest(void) {
+  Frame frame;
+  size_t size = encodeFrame(buffer, sizeof(buffer), OP_STORAGE, 1, nullptr, 0);
+  TEST_ASSERT_EQUAL(kFrameHeaderSize, size);
+  TEST_ASSERT_EQUAL(FRAME_OK, parseFrame(buffer, size, frame));
+  TEST_ASSERT_EQUAL(0, frame.length);
+
+  uint8_t payload[kMaxPayloadSize];
+  for (size_t i = 0; i < sizeof(payload); i++) {
+    payload[i] = i * 7;
+  }
+  size = encodeFrame(buffer, sizeof(buffer), OP_REPLY, 2, payload, sizeof(payload));
+  TEST_ASSERT_EQUAL(kMaxFrameSize, size);
+  TEST_ASSERT_EQUAL(FRAME_OK, parseFrame(buffer, size, frame));
+  TEST_ASSERT_EQUAL_MEMORY(payload, frame.payload, sizeof(payload));
+}
+
+void test_bad_crc(void) {
+  size_t size = encodeText(OP_LEARN, 7, "fan");
+  Frame frame;
+
+  // Any flipped bit, in the header or in the payload, fails the CRC.
+  const size_t offsets[] = {3, 4, 5, 8, 11, kFrameHeaderSize, size - 1};
+  for (size_t offset : offsets) {
+    buffer[offset] ^= 0x10;
+    TEST_ASSERT_EQUAL(FRAME_BAD_CRC, parseFrame(buffer, size, frame));
+    buffer[offset] ^= 0x10;
+  }
+  TEST_ASSERT_EQUAL(FRAME_OK, parseFrame(buffer, size, frame));
+
+  buffer[0] = 'X';
+  TEST_ASSERT_EQUAL(FRAME_BAD_MAGIC, parseFrame(buffer, size, frame));
+  buffer[0] = kFrameMagic[0];
+  buffer[2] = kProtocolVersion + 1;
+  TEST_ASSERT_EQUAL(FRAME_BAD_VERSION, parseFrame(buffer, size, frame));
+}
+
+void test_truncated(void) {
+  size_t size = encodeText(OP_SCENE, 3, "movie_night");
+  Frame frame;
+  for (size_t length = 0; length < size; length++) {
+    TEST_ASSERT_EQUAL(FRAME_TOO_SHORT, parseFrame(buffer, length, frame));
+  }
+  // Trailing bytes after the payload are not part of a frame either.
+  TEST_ASSERT_EQUAL(FRAME_BAD_LENGTH, parseFrame(buffer, size + 1, frame));
+}
+
+void test_oversized(void) {
+  uint8_t payload[kMaxPayloadSize + 1] = {};
+  TEST_ASSERT_EQUAL(0, encodeFrame(buffer, sizeof(buffer), OP_REPLY, 1, payload, sizeof(payload)));
+  TEST_ASSERT_EQUAL(0, encodeFrame(buffer, kFrameHeaderSize - 1, OP_STORAGE, 1, nullptr, 0));
+
+  // A header announcing more than a frame may carry, with the bytes to match.
+  size_t size = encodeFrame(buffer, sizeof(buffer), OP_REPLY, 1, payload, kMaxPayloadSize);
+  uint16_t length = kMaxPayloadSize + 1;
+  buffer[6] = length & 0xFF;
+  buffer[7] = length >> 8;
+  Frame frame;
+  TEST_ASSERT_EQUAL(FRAME_BAD_LENGTH, parseFrame(buffer, size + 1, frame));
+
+  // Or the largest length the field holds, with a short datagram.
+  buffer[6] = 0xFF;
+  buffer[7] = 0xFF;
+  TEST_ASSERT_EQUAL(FRAME_TOO_SHORT, parseFrame(buffer, size, frame));
+}
+
+static int handled = 0;
+static void onSend(const Frame &frame, void *context) {
+  handled += *(int *)context + frame.length;
+}
+
+void test_dispatcher(void) {
+  FrameDispatcher dispatcher;
+  int weight = 100;
+  dispatcher.on(OP_SEND, onSend, &weight);
+
+  size_t size = encodeText(OP_SEND, 1, "ab");
+  TEST_ASSERT_EQUAL(FRAME_OK, dispatcher.dispatch(buffer, size));
+  TEST_ASSERT_EQUAL(102, handled);
+  size = encodeText(OP_DELETE, 2, "ab");
+  TEST_ASSERT_EQUAL(FRAME_UNHANDLED, dispatcher.dispatch(buffer, size));
+  TEST_ASSERT_EQUAL(FRAME_TOO_SHORT, dispatcher.dispatch(buffer, 3));
+
+  TEST_ASSERT_EQUAL(1, dispatcher.count(FRAME_OK));
+  TEST_ASSERT_EQUAL(1, dispatcher.count(FRAME_UNHANDLED));
+  TEST_ASSERT_EQUAL(1, dispatcher.count(FRAME_TOO_SHORT));
+}
+
+// Takes the next value of a seeded generator, so a failing run repeats.
+static uint32_t fuzzSeed;
+static uint32_t fuzzNext(uint32_t range) {
+  fuzzSeed = fuzzSeed * 1103515245 + 12345;
+  return (fuzzSeed >> 8) % range;
+}
+
+struct FuzzCalls {
+  int count;
+  const uint8_t *start;
+  const uint8_t *end;
+};
+
+static void onFuzz(const Frame &frame, void *context) {
+  FuzzCalls *calls = (FuzzCalls *)context;
+  calls->count++;
+  TEST_ASSERT_TRUE(frame.opcode < kOpcodeLimit && frame.opcode % 2 == 0);
+  TEST_ASSERT_TRUE(frame.length <= kMaxPayloadSize);
+  TEST_ASSERT_TRUE(frame.payload >= calls->start && frame.payload + frame.length <= calls->end);
+}
+
+void test_fuzz(void) {
+  FrameDispatcher dispatcher;
+  FuzzCalls calls = {};
+  for (uint8_t opcode = 0; opcode < kOpcodeLimit; opcode += 2) {
+    dispatcher.on(opcode, onFuzz, &calls);
+  }
+
+  const int kRounds = 20000;
+  uint32_t handled = 0;
+  fuzzSeed = 20;
+  for (int round = 0; round < kRounds; round++) {
+    uint8_t payload[kMaxPayloadSize];
+    size_t length = fuzzNext(kMaxPayloadSize + 1);
+    for (size_t i = 0; i < length; i++) {
+      payload[i] = fuzzNext(256);
+    }
+    uint8_t opcode = fuzzNext(kOpcodeLimit);
+    size_t size = encodeFrame(buffer, sizeof(buffer), opcode, fuzzNext(0x10000), payload, length);
+    TEST_ASSERT_EQUAL(kFrameHeaderSize + length, size);
+
+    // What parseFrame() must say of the mangled datagram, kFrameStatusCount
+    // if anything goes.
+    FrameStatus expected = kFrameStatusCount;
+    bool rejected = false;
+    bool noise = round % 3 == 2;
+    switch (fuzzNext(5)) {
+      case 0:  // Untouched.
+        expected = FRAME_OK;
+        break;
+      case 1: {  // One flipped bit.
+        size_t bit = fuzzNext(size * 8);
+        buffer[bit / 8] ^= 1 << (bit % 8);
+        rejected = true;
+        break;
+      }
+      case 2: {  // Several flipped bits, which may cancel out.
+        for (uint32_t flips = 2 + fuzzNext(8); flips > 0; flips--) {
+          size_t bit = fuzzNext(size * 8);
+          buffer[bit / 8] ^= 1 << (bit % 8);
+        }
+        break;
+      }
+      case 3:  // Cut short.
+        size = fuzzNext(size);
+        expected = FRAME_TOO_SHORT;
+        break;
+      case 4: {  // Trailing bytes.
+        size_t extra = 1 + fuzzNext(sizeof(buffer) - size);
+        for (size_t i = 0; i < extra; i++) {
+          buffer[size++] = fuzzNext(256);
+        }
+        expected = FRAME_BAD_LENGTH;
+        break;
+      }
+    }
+
+    // Every third round is noise instead: random bytes, half of them behind
+    // a valid magic and version so they get past the first checks.
+    if (noise) {
+      size = fuzzNext(sizeof(buffer) + 1);
+      for (size_t i = 0; i < size; i++) {
+        buffer[i] = fuzzNext(256);
+      }
+      if (size >= 3 && fuzzNext(2) == 0) {
+        memcpy(buffer, kFrameMagic, 2);
+        buffer[2] = kProtocolVersion;
+      }
+      expected = kFrameStatusCount;
+      rejected = false;
+    }
+
+    Frame frame;
+    FrameStatus parsed = parseFrame(buffer, size, frame);
+    TEST_ASSERT_TRUE(parsed < kFrameStatusCount);
+    if (expected != kFrameStatusCount) {
+      TEST_ASSERT_EQUAL(expected, parsed);
+    } else if (rejected) {
+      TEST_ASSERT_TRUE(parsed != FRAME_OK);
+    }
+    if (parsed == FRAME_OK && !noise) {
+      // Flips that left a valid frame must have cancelled out.
+      TEST_ASSERT_EQUAL(opcode, frame.opcode);
+      TEST_ASSERT_EQUAL(length, frame.length);
+      TEST_ASSERT_EQUAL_MEMORY(payload, frame.payload, length);
+    }
+
+    calls = {0, buffer, buffer + size};
+    FrameStatus status = dispatcher.dispatch(buffer, size);
+    TEST_ASSERT_TRUE(status < kFrameStatusCount);
+    if (parsed != FRAME_OK) {
+      TEST_ASSERT_EQUAL(parsed, status);
+    } else {
+      TEST_ASSERT_EQUAL(frame.opcode % 2 == 0 ? FRAME_OK : FRAME_UNHANDLED, status);
+    }
+    TEST_ASSERT_EQUAL(status == FRAME_OK ? 1 : 0, calls.count);
+    handled += calls.count;
+  }
+
+  uint32_t total = 0;
+  for (uint8_t status = 0; status < kFrameStatusCount; status++) {
+    total += dispatcher.count((FrameStatus)status);
+  }
+  TEST_ASSERT_EQUAL(kRounds, total);
+  TEST_ASSERT_EQUAL(handled, dispatcher.count(FRAME_OK));
+  // Every branch was taken.
+  TEST_ASSERT_TRUE(dispatcher.count(FRAME_OK) > 0);
+  TEST_ASSERT_TRUE(dispatcher.count(FRAME_UNHANDLED) > 0);
+  TEST_ASSERT_TRUE(dispatcher.count(FRAME_BAD_CRC) > 0);
+  TEST_ASSERT_TRUE(dispatcher.count(FRAME_TOO_SHORT) > 0);
+  TEST_ASSERT_TRUE(dispatcher.count(FRAME_BAD_LENGTH) > 0);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_round_trip_empty_and_largest);
+  RUN_TEST(test_bad_crc);
+  RUN_TEST(test_truncated);
+  RUN_TEST(test_oversized);
+  RUN_TEST(test_dispatcher);
+  RUN_TEST(test_fuzz);
+  return UNITY_END();
+}
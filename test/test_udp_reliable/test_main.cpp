@@ -0,0 +1,290 @@
+// Host tests for UDP_Reliable.h: pio test -e native -f test_udp_reliable
+#include <unity.h>
+#include <stdint.h>
+#include <random>
+#include <vector>
+#include <UDP_Reliable.h>
+
+using namespace udpproto;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_rtt_estimator(void) {
+  RttEstimator rtt;
+  TEST_ASSERT_EQUAL(RttEstimator::kInitialRtoMs, rtt.timeout());
+
+  // First sample: SRTT = R, RTTVAR = R / 2, RTO = SRTT + 4 * RTTVAR.
+  rtt.sample(100);
+  TEST_ASSERT_EQUAL(100, rtt.smoothedRtt());
+  TEST_ASSERT_EQUAL(300, rtt.timeout());
+
+  // A steady link converges on its round trip time, held up by kMinRtoMs.
+  for (int i = 0; i < 50; i++) {
+    rtt.sample(20);
+  }
+  TEST_ASSERT_EQUAL(20, rtt.smoothedRtt());
+  TEST_ASSERT_EQUAL(RttEstimator::kMinRtoMs, rtt.timeout());
+
+  // A slow sample backs off at once, capped at kMaxRtoMs.
+  rtt.sample(1000);
+  TEST_ASSERT_GREATER_THAN(1000, rtt.timeout());
+  for (int i = 0; i < 10; i++) {
+    rtt.sample(60000);
+  }
+  TEST_ASSERT_EQUAL(RttEstimator::kMaxRtoMs, rtt.timeout());
+}
+
+void test_receive_window_rejects_duplicates(void) {
+  ReceiveWindow window;
+  window.reset(10);
+  TEST_ASSERT_EQUAL(11, window.next());
+
+  TEST_ASSERT_EQUAL(ARRIVAL_NEW, window.accept(11));
+  TEST_ASSERT_EQUAL(ARRIVAL_DUPLICATE, window.accept(11));
+  TEST_ASSERT_EQUAL(11, window.cumulative());
+
+  // Out of order: 13 is held in the bitmap until 12 closes the gap.
+  TEST_ASSERT_EQUAL(ARRIVAL_NEW, window.accept(13));
+  TEST_ASSERT_EQUAL(ARRIVAL_DUPLICATE, window.accept(13));
+  TEST_ASSERT_EQUAL(11, window.cumulative());
+  TEST_ASSERT_EQUAL(ARRIVAL_NEW, window.accept(12));
+  TEST_ASSERT_EQUAL(13, window.cumulative());
+
+  // Long before the window, and too far ahead of it.
+  TEST_ASSERT_EQUAL(ARRIVAL_DUPLICATE, window.accept(2));
+  TEST_ASSERT_EQUAL(ARRIVAL_AHEAD, window.accept(14 + ReceiveWindow::kSpan));
+  TEST_ASSERT_EQUAL(ARRIVAL_NEW, window.accept(13 + ReceiveWindow::kSpan));
+}
+
+void test_receive_window_wraps(void) {
+  ReceiveWindow window;
+  window.reset(65534);
+  TEST_ASSERT_EQUAL(ARRIVAL_NEW, window.accept(0));
+  TEST_ASSERT_EQUAL(ARRIVAL_NEW, window.accept(65535));
+  TEST_ASSERT_EQUAL(0, window.cumulative());
+  TEST_ASSERT_EQUAL(ARRIVAL_DUPLICATE, window.accept(65535));
+  TEST_ASSERT_EQUAL(ARRIVAL_DUPLICATE, window.accept(65000));
+  TEST_ASSERT_EQUAL(ARRIVAL_NEW, window.accept(1));
+}
+
+void test_retransmit_queue_backs_off(void) {
+  RetransmitQueue<2, 16> queue;
+  const uint8_t frame[4] = {1, 2, 3, 4};
+  TEST_ASSERT_EQUAL(0xFFFFFFFF, queue.msUntilNext(0));
+  TEST_ASSERT_TRUE(queue.add(7, 100, frame, sizeof(frame), 1000, 300));
+  TEST_ASSERT_EQUAL(300, queue.msUntilNext(1000));
+  TEST_ASSERT_EQUAL(queue.kNone, queue.due(1299));
+
+  // Every retransmission doubles the timeout, up to kMaxRtoMs.
+  uint32_t now = 1300;
+  uint32_t expected[] = {600, 1200, 2400, 4800, 8000, 8000};
+  for (uint8_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+    uint8_t slot = queue.due(now);
+    TEST_ASSERT_NOT_EQUAL(queue.kNone, slot);
+    TEST_ASSERT_EQUAL_MEMORY(frame, queue[slot].frame, sizeof(frame));
+    queue.retransmitted(slot, now);
+    TEST_ASSERT_EQUAL(expected[i], queue[slot].timeout);
+    TEST_ASSERT_EQUAL(i + 2, queue[slot].transmissions);
+    TEST_ASSERT_EQUAL(queue.kNone, queue.due(now + expected[i] - 1));
+    now += expected[i];
+  }
+
+  // Sent more than once, so the round trip time is ambiguous (Karn).
+  TEST_ASSERT_EQUAL(-1, queue.acknowledge(7, 100, now));
+  TEST_ASSERT_EQUAL(0, queue.size());
+}
+
+void test_retransmit_queue_slots(void) {
+  RetransmitQueue<2, 16> queue;
+  uint8_t frame[17] = {};
+  TEST_ASSERT_FALSE(queue.add(1, 1, frame, sizeof(frame), 0, 300));   // Too large.
+  TEST_ASSERT_TRUE(queue.add(1, 1, frame, 16, 0, 300));
+  TEST_ASSERT_TRUE(queue.add(2, 1, frame, 16, 0, 300));
+  TEST_ASSERT_FALSE(queue.add(1, 2, frame, 16, 0, 300));              // Full.
+
+  TEST_ASSERT_EQUAL(-1, queue.acknowledge(1, 5, 40));                 // Unknown.
+  TEST_ASSERT_EQUAL(40, queue.acknowledge(1, 1, 40));
+  TEST_ASSERT_EQUAL(1, queue.size());
+  queue.forget(2);
+  TEST_ASSERT_EQUAL(0, queue.size());
+}
+
+// A client and the device over a link that loses, duplicates and reorders
+// datagrams, one step per millisecond. The client sends commands with up to
+// `window` unacknowledged and retransmits them like a real client would; the
+// device runs them through a ReceiveWindow and keeps its replies in a
+// RetransmitQueue until the client acknowledges them.
+struct LinkStats {
+  uint32_t commands;
+  uint32_t runTwice;
+  uint32_t replies;
+  uint32_t undelivered;
+  bool finished;
+};
+
+static LinkStats simulateLink(double loss, uint8_t window) {
+  enum Kind { COMMAND, COMMAND_ACK, REPLY, REPLY_ACK };
+  struct Datagram {
+    uint32_t arrives;
+    Kind kind;
+    uint16_t sequence;
+  };
+  struct Outstanding {
+    uint16_t sequence;
+    uint32_t sentAt;
+    uint32_t timeout;
+    uint8_t transmissions;
+  };
+  const uint32_t kCommands = 1000;
+  const uint16_t kFirst = 65000;  // Wraps half way.
+  const uint8_t kMaxTransmissions = 5;
+
+  std::mt19937 random(1);
+  std::uniform_real_distribution<double> chance(0, 1);
+  std::vector<Datagram> toDevice;
+  std::vector<Datagram> toClient;
+  auto send = [&](std::vector<Datagram> &link, uint32_t now, Kind kind, uint16_t sequence) {
+    int copies = chance(random) < loss ? 0 : chance(random) < 0.1 ? 2 : 1;
+    for (int i = 0; i < copies; i++) {
+      link.push_back({now + 5 + (uint32_t)(random() % 40), kind, sequence});
+    }
+  };
+
+  ReceiveWindow commands;
+  commands.reset(kFirst - 1);
+  RetransmitQueue<8, 16> replies;
+  RttEstimator deviceRtt;
+  const uint8_t reply[16] = {};
+  std::vector<uint8_t> runs(kCommands);
+  std::vector<uint8_t> received(kCommands);
+
+  RttEstimator clientRtt;
+  std::vector<Outstanding> outstanding;
+  uint32_t sent = 0;
+
+  LinkStats stats = {kCommands, 0, 0, 0, false};
+  for (uint32_t now = 0; now < 3600000; now++) {
+    // Client: send new commands and repeat those not acknowledged in time.
+    if (sent < kCommands && outstanding.size() < window) {
+      outstanding.push_back({(uint16_t)(kFirst + sent++), now, clientRtt.timeout(), 1});
+      send(toDevice, now, COMMAND, outstanding.back().sequence);
+    }
+    for (Outstanding &command : outstanding) {
+      if (now - command.sentAt >= command.timeout) {
+        command.sentAt = now;
+        command.timeout = command.timeout * 2 < RttEstimator::kMaxRtoMs ? command.timeout * 2 : RttEstimator::kMaxRtoMs;
+        command.transmissions++;
+        send(toDevice, now, COMMAND, command.sequence);
+      }
+    }
+
+    for (size_t i = 0; i < toDevice.size();) {
+      if (toDevice[i].arrives > now) {
+        i++;
+        continue;
+      }
+      Datagram datagram = toDevice[i];
+      toDevice.erase(toDevice.begin() + i);
+      if (datagram.kind == REPLY_ACK) {
+        int32_t rtt = replies.acknowledge(0, datagram.sequence, now);
+        if (rtt >= 0) {
+          deviceRtt.sample(rtt);
+        }
+        continue;
+      }
+      Arrival arrival = commands.accept(datagram.sequence);
+      if (arrival == ARRIVAL_AHEAD) {
+        continue;
+      }
+      send(toClient, now, COMMAND_ACK, commands.cumulative());
+      if (arrival == ARRIVAL_NEW) {
+        uint16_t index = datagram.sequence - kFirst;
+        stats.runTwice += runs[index]++ != 0;
+        if (!replies.add(0, datagram.sequence, reply, sizeof(reply), now, deviceRtt.timeout())) {
+          stats.undelivered++;
+        }
+        send(toClient, now, REPLY, datagram.sequence);
+      }
+    }
+
+    for (size_t i = 0; i < toClient.size();) {
+      if (toClient[i].arrives > now) {
+        i++;
+        continue;
+      }
+      Datagram datagram = toClient[i];
+      toClient.erase(toClient.begin() + i);
+      if (datagram.kind == REPLY) {
+        received[(uint16_t)(datagram.sequence - kFirst)] = 1;
+        send(toDevice, now, REPLY_ACK, datagram.sequence);
+        continue;
+      }
+      // Cumulative: everything up to the acknowledged number has arrived.
+      for (size_t j = 0; j < outstanding.size();) {
+        if ((int16_t)(datagram.sequence - outstanding[j].sequence) >= 0) {
+          if (outstanding[j].transmissions == 1) {
+            clientRtt.sample(now - outstanding[j].sentAt);
+          }
+          outstanding.erase(outstanding.begin() + j);
+        } else {
+          j++;
+        }
+      }
+    }
+
+    // Device: repeat replies until acknowledged, give up after a few tries.
+    uint8_t slot;
+    while ((slot = replies.due(now)) != replies.kNone) {
+      if (replies[slot].transmissions >= kMaxTransmissions) {
+        replies.remove(slot);
+        stats.undelivered++;
+        continue;
+      }
+      send(toClient, now, REPLY, replies[slot].sequence);
+      replies.retransmitted(slot, now);
+    }
+
+    if (sent == kCommands && outstanding.empty() && replies.size() == 0 && toDevice.empty() &&
+        toClient.empty()) {
+      stats.finished = true;
+      break;
+    }
+  }
+
+  for (uint32_t i = 0; i < kCommands; i++) {
+    stats.commands -= runs[i] == 0;
+    stats.replies += received[i];
+  }
+  return stats;
+}
+
+void test_lossy_link_runs_every_command_once(void) {
+  const double losses[] = {0.0, 0.1, 0.3, 0.5};
+  for (double loss : losses) {
+    LinkStats stats = simulateLink(loss, 4);
+    TEST_ASSERT_TRUE(stats.finished);
+    TEST_ASSERT_EQUAL(1000, stats.commands);
+    TEST_ASSERT_EQUAL(0, stats.runTwice);
+  }
+}
+
+void test_lossy_link_delivers_replies(void) {
+  // One command at a time keeps the retransmit queue from filling up.
+  LinkStats stats = simulateLink(0.1, 1);
+  TEST_ASSERT_TRUE(stats.finished);
+  TEST_ASSERT_EQUAL(0, stats.undelivered);
+  TEST_ASSERT_EQUAL(1000, stats.replies);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_rtt_estimator);
+  RUN_TEST(test_receive_window_rejects_duplicates);
+  RUN_TEST(test_receive_window_wraps);
+  RUN_TEST(test_retransmit_queue_backs_off);
+  RUN_TEST(test_retransmit_queue_slots);
+  RUN_TEST(test_lossy_link_runs_every_command_once);
+  RUN_TEST(test_lossy_link_delivers_replies);
+  return UNITY_END();
+}
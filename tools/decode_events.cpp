@@ -0,0 +1,93 @@
+// decode_events.cpp
+//
+// Prints the event log the firmware keeps on the SD card (see
+// include/Event_Log.h) as text, one event per line:
+//
+//   <seconds since boot>  <sequence>  <event>  <argument 0>  <argument 1>
+//
+// Pass the files oldest first, e.g. from the card's events directory:
+//
+//   g++ -std=c++11 -Iinclude tools/decode_events.cpp -o decode_events
+//   cd /media/sd/events && decode_events 3.log 2.log 1.log 0.log
+//
+// Gaps in the sequence, i.e. events that never reached the card, are marked,
+// as are events written twice because a failed write was retried.
+#include <stdio.h>
+#include <stdint.h>
+#include <Event_Format.h>
+
+using namespace eventlog;
+
+static bool decodeFile(const char *path, bool &haveSequence, uint16_t &expected) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "%s: cannot open\n", path);
+    return false;
+  }
+
+  printf("# %s\n", path);
+  uint8_t bytes[kRecordSize];
+  Record record;
+  bool first = true;
+  while (fread(bytes, 1, sizeof(bytes), file) == sizeof(bytes)) {
+    decodeRecord(bytes, record);
+    if (first) {
+      first = false;
+      if (record.id != EVENT_LOG_START || record.args[0] != kLogMagic) {
+        fprintf(stderr, "%s: not an event log\n", path);
+        fclose(file);
+        return false;
+      }
+      if ((record.args[1] & 0xFF) != kFormatVersion || (record.args[1] >> 8) != kRecordSize) {
+        fprintf(stderr, "%s: unsupported format %u\n", path, (unsigned)(record.args[1] & 0xFF));
+        fclose(file);
+        return false;
+      }
+      continue;
+    }
+
+    // The sequence starts over at every boot.
+    if (record.id == EVENT_BOOT) {
+      haveSequence = false;
+    }
+    uint16_t skipped = record.sequence - expected;
+    if (haveSequence && skipped != 0) {
+      if (skipped < 0x8000) {
+        printf("# %u events missing\n", (unsigned)skipped);
+      } else {
+        printf("# %u events repeated\n", (unsigned)(uint16_t)(expected - record.sequence));
+      }
+    }
+    haveSequence = true;
+    expected = record.sequence + 1;
+
+    printf("%10u.%03u  %5u  %-18s  %10u  %10u\n",
+           (unsigned)(record.timestamp / 1000), (unsigned)(record.timestamp % 1000),
+           (unsigned)record.sequence, eventName(record.id),
+           (unsigned)record.args[0], (unsigned)record.args[1]);
+  }
+  bool complete = feof(file);
+  fclose(file);
+  if (!complete || first) {
+    fprintf(stderr, "%s: %s\n", path, first ? "not an event log" : "read error");
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <events file>... (oldest first)\n", argv[0]);
+    return 2;
+  }
+
+  bool haveSequence = false;
+  uint16_t expected = 0;
+  int status = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!decodeFile(argv[i], haveSequence, expected)) {
+      status = 1;
+    }
+  }
+  return status;
+}